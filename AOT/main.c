@@ -0,0 +1,453 @@
+/* main.c */
+
+#include "aot.h"
+#include "disasm.h"
+#include "image.h"
+#include "memory.h"
+#include "vm.h"
+#include "vm_internal.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_CC	"cc"
+#define CC_FLAGS	"-O2 -shared -fPIC"
+
+static bool*	find_leaders	(RiscyVM* vm);
+static void	mark_address	(RiscyVM* vm, bool leader[],
+				 uint16_t address);
+static void	emit_program	(FILE* out, RiscyVM* vm, const bool leader[],
+				 const char* image);
+static void	emit_block	(FILE* out, RiscyVM* vm, const bool leader[],
+				 uint16_t pc);
+static void	emit_extension	(FILE* out, const instruction_t* in);
+static void	emit_exit	(FILE* out, RiscyVM* vm, uint16_t target,
+				 uint16_t at, const unsigned tally[],
+				 const char* indent);
+static char*	tally_args	(char* args, const unsigned tally[]);
+static bool	ends_with	(const char* s, const char* suffix);
+
+/* Translates an assembled image to C, one function per basic block, and
+ * compiles it into a shared object for "run --aot=FILE". With an output name
+ * ending in ".c", only the C file is written. */
+int main(int argc, char* argv[])
+{
+	const char*	cc	= getenv("CC");
+	bool		compile;
+	RiscyVM*	vm;
+	bool*		leader;
+	FILE*		out;
+
+	if (argc != 3) {
+		printf("Usage: aot <image> <output.so | output.c>\n");
+		exit(EXIT_FAILURE);
+	}
+
+	compile = !ends_with(argv[2], ".c");
+
+	char source[strlen(argv[2]) + sizeof ".c"];
+	sprintf(source, compile ? "%s.c" : "%s", argv[2]);
+
+	vm	= VM_init(argv[1]);
+	leader	= find_leaders(vm);
+
+	out = fopen(source, "w");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open \"%s\".\n", source);
+		exit(EXIT_FAILURE);
+	}
+	emit_program(out, vm, leader, argv[1]);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "Could not write \"%s\".\n", source);
+		exit(EXIT_FAILURE);
+	}
+
+	free(leader);
+	VM_shutdown(vm);
+
+	if (compile) {
+		if (cc == NULL || *cc == '\0')
+			cc = DEFAULT_CC;
+
+		char command[strlen(cc) + strlen(source) + strlen(argv[2])
+				+ sizeof CC_FLAGS + 32];
+		sprintf(command, "%s %s -o '%s' '%s'", cc, CC_FLAGS, argv[2],
+				source);
+		if (system(command) != 0) {
+			fprintf(stderr, "Could not compile \"%s\".\n", source);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Marks the words of text that start a basic block: the first one, those
+ * after a BEQ or a JALR, and the targets of BEQs. JALR targets are computed,
+ * so every address in the text that the program holds as a constant is taken
+ * to be one: a data word, which covers "lw r5, r0, &label; jalr r6, r5", or
+ * the value of a "movi r5, label" (lui and addi, or either one alone). A JALR
+ * to any other address is left to the interpreter. */
+static bool* find_leaders(RiscyVM* vm)
+{
+	metadata_t*	md	= &vm->metadata;
+	bool*		leader	= calloc(md->text_size + 1, sizeof *leader);
+
+	if (leader == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (md->text_size > 0)
+		leader[0] = true;
+
+	for (uint16_t i = 0; i < md->text_size; ++i) {
+		const instruction_t*	in	= &vm->decoded[i];
+		uint16_t		target	= i + 1 + in->simm;
+
+		if (in->opcode == BEQ || in->opcode == JALR)
+			leader[i + 1] = true;
+		if (in->opcode == BEQ && target < md->text_size)
+			leader[target] = true;
+	}
+
+	for (uint16_t i = 0; i < md->data_size; ++i)
+		mark_address(vm, leader, mem_read(vm, md->data_start + i));
+
+	for (uint16_t i = 0; i < md->text_size; ++i) {
+		const instruction_t*	in	= &vm->decoded[i];
+		const instruction_t*	next	= &vm->decoded[i + 1];
+
+		if (in->opcode == LUI) {
+			mark_address(vm, leader, in->uimm << 6);
+			if (i + 1 < md->text_size && next->opcode == ADDI
+					&& next->regA == in->regA
+					&& next->regB == in->regA)
+				mark_address(vm, leader,
+						(in->uimm << 6) + next->simm);
+		}
+		if (in->opcode == ADDI && in->regB == 0)
+			mark_address(vm, leader, in->simm);
+	}
+
+	return leader;
+}
+
+/* Makes `address` a leader if it is in the text */
+static void mark_address(RiscyVM* vm, bool leader[], uint16_t address)
+{
+	uint16_t offset = address - vm->metadata.text_start;
+
+	if (offset < vm->metadata.text_size)
+		leader[offset] = true;
+}
+
+static void emit_program(FILE* out, RiscyVM* vm, const bool leader[],
+				const char* image)
+{
+	metadata_t* md = &vm->metadata;
+
+	fprintf(out,
+		"/* Translated from \"%s\" by aot. See Common/aot.h. */\n"
+		"\n"
+		"#include <stdint.h>\n"
+		"\n"
+		"#define TEXT_START\t(0x%04x)\n"
+		"#define TEXT_SIZE\t(0x%04x)\n"
+		"#define EXIT_HALT\t(UINT32_C(0x%08"PRIx32"))\n"
+		"#define EXIT_STOP\t(EXIT_HALT << 1)\t/* Back to the VM */\n"
+		"\n"
+		"typedef struct {\n"
+		"\tuint16_t*\tregs;\n"
+		"\tuint16_t**\tpages;\n"
+		"\tuint16_t**\twpages;\n"
+		"\tint64_t\t\tbudget;\n"
+		"\tuint64_t*\tcounts;\n"
+		"} context_t;\n"
+		"\n"
+		"typedef uint32_t\t(*block_t)\t(context_t* c);\n"
+		"\n"
+		"#define r\t(c->regs)\n"
+		"#define READ(a)\t(c->pages[(uint16_t) (a) >> %d]"
+		"[(uint16_t) (a) & 0x%x])\n"
+		"\n"
+		"/* Adds what a block executed, by opcode, and the BEQs it took,\n"
+		" * if the VM asks for them */\n"
+		"#define TALLY(n0, n1, n2, n3, n4, n5, n6, n7, n8, taken)\t\\\n"
+		"\tdo {\t\t\t\t\t\t\t\\\n"
+		"\t\tuint64_t* n_ = c->counts;\t\t\t\\\n"
+		"\t\tif (n_ != 0) {\t\t\t\t\t\\\n"
+		"\t\t\tn_[0] += n0; n_[1] += n1; n_[2] += n2;\t\\\n"
+		"\t\t\tn_[3] += n3; n_[4] += n4; n_[5] += n5;\t\\\n"
+		"\t\t\tn_[6] += n6; n_[7] += n7; n_[8] += n8;\t\\\n"
+		"\t\t\tn_[9] += taken;\t\t\t\t\\\n"
+		"\t\t}\t\t\t\t\t\t\\\n"
+		"\t} while (0)\n"
+		"\n"
+		"/* Stores are done here unless they go to the text or to a\n"
+		" * shared page, in which case the VM does them, after getting\n"
+		" * back the instructions that were not executed. The rest are\n"
+		" * the tallies of the instructions before the store. */\n"
+		"#define STORE(a, v, pc, left, ...)\t\t\t\t\\\n"
+		"\tdo {\t\t\t\t\t\t\t\\\n"
+		"\t\tuint16_t  a_ = (a);\t\t\t\t\\\n"
+		"\t\tuint16_t* p_ = c->wpages[a_ >> %d];\t\t\\\n"
+		"\t\tif ((uint16_t) (a_ - TEXT_START) < TEXT_SIZE\t\\\n"
+		"\t\t\t\t|| p_ == 0) {\t\t\t\\\n"
+		"\t\t\tc->budget += (left);\t\t\t\\\n"
+		"\t\t\tTALLY(__VA_ARGS__);\t\t\t\\\n"
+		"\t\t\treturn (pc) | EXIT_STOP;\t\t\\\n"
+		"\t\t}\t\t\t\t\t\t\\\n"
+		"\t\tp_[a_ & 0x%x] = (v);\t\t\t\t\\\n"
+		"\t} while (0)\n"
+		"\n"
+		"const uint32_t riscy_aot_version = %d;\n"
+		"const uint16_t riscy_aot_text_start = TEXT_START;\n"
+		"const uint16_t riscy_aot_text_size = TEXT_SIZE;\n"
+		"const uint32_t riscy_aot_checksum = UINT32_C(0x%08"PRIx32");\n"
+		"\n",
+		image, md->text_start, md->text_size, AOT_EXIT_HALT,
+		PAGE_BITS, PAGE_MASK, PAGE_BITS, PAGE_MASK, AOT_VERSION,
+		text_checksum(vm->pages, PAGE_BITS, md->text_start,
+			md->text_size));
+
+	for (uint16_t i = 0; i < md->text_size; ++i) {
+		if (leader[i])
+			emit_block(out, vm, leader, md->text_start + i);
+	}
+
+	fprintf(out, "static const block_t blocks[TEXT_SIZE + 1] = {\n");
+	for (uint16_t i = 0; i < md->text_size; ++i) {
+		if (leader[i])
+			fprintf(out, "\t[0x%04x] = b_%04x,\n", i,
+					md->text_start + i);
+	}
+	fprintf(out,
+		"};\n"
+		"\n"
+		"const uint8_t riscy_aot_blocks[(TEXT_SIZE + 8) / 8] = {");
+	for (uint16_t i = 0; i < md->text_size; i += 8) {
+		uint8_t bits = 0;
+
+		for (uint16_t k = i; k < i + 8 && k < md->text_size; ++k)
+			bits |= leader[k] << (k - i);
+		fprintf(out, "%s0x%02x,", i % 64 == 0 ? "\n\t" : " ", bits);
+	}
+	fprintf(out,
+		"\n};\n"
+		"\n"
+		"uint32_t riscy_aot_run(context_t* c, uint16_t pc)\n"
+		"{\n"
+		"\tuint32_t next;\n"
+		"\n"
+		"\tfor (;;) {\n"
+		"\t\tuint16_t offset = pc - TEXT_START;\n"
+		"\n"
+		"\t\tif (offset >= TEXT_SIZE || blocks[offset] == 0)\n"
+		"\t\t\treturn pc;\n"
+		"\n"
+		"\t\tnext = blocks[offset](c);\n"
+		"\t\tif (next & (EXIT_HALT | EXIT_STOP))\n"
+		"\t\t\treturn next & ~EXIT_STOP;\n"
+		"\t\tpc = next;\n"
+		"\t}\n"
+		"}\n");
+}
+
+/* A block takes all of its instructions off the budget up front, if the
+ * budget covers them, and gives back those it does not get to execute. */
+static void emit_block(FILE* out, RiscyVM* vm, const bool leader[],
+			uint16_t pc)
+{
+	metadata_t*	md	= &vm->metadata;
+	uint16_t	last	= md->text_header + md->text_size;
+	uint16_t	length	= 0;
+	uint16_t	at	= pc;
+	char		text[64];
+	char		args[64];
+	unsigned	tally[AOT_NUM_COUNTS]	= { 0 };	/* So far */
+	unsigned	taken[AOT_NUM_COUNTS];
+	bool		ended	= false;
+
+	/* A block ends with a jump, the last word of text, or a leader */
+	do {
+		const instruction_t* in = &vm->decoded[at - md->text_start];
+		length	+= 1;
+		ended	= in->opcode == BEQ || in->opcode == JALR
+			|| at == last || leader[at + 1 - md->text_start];
+		at	+= 1;
+	} while (!ended);
+
+	fprintf(out,
+		"static uint32_t b_%04x(context_t* c)\n"
+		"{\n"
+		"\tif (c->budget < %u)\n"
+		"\t\treturn 0x%04x | EXIT_STOP;\n"
+		"\tc->budget -= %u;\n"
+		"\n", pc, length, pc, length);
+
+	for (at = pc; at < pc + length; ++at) {
+		const instruction_t*	in	= &vm->decoded[at
+							- md->text_start];
+		unsigned		A	= in->regA;
+		unsigned		B	= in->regB;
+		unsigned		C	= in->regC;
+
+		disassemble(text, sizeof text, mem_read(vm, at));
+		fprintf(out, "\t/* %04x: %s */\n", at, text);
+
+		/* A store that has to be left to the VM is not executed */
+		if (in->opcode == SW)
+			tally_args(args, tally);
+		tally[in->opcode] += 1;
+		memcpy(taken, tally, sizeof taken);
+		taken[AOT_COUNT_TAKEN] = 1;
+
+		switch (in->opcode) {
+		case ADD:
+			if (A != 0)
+				fprintf(out, "\tr[%u] = r[%u] + r[%u];\n",
+						A, B, C);
+			break;
+		case ADDI:
+			if (A != 0)
+				fprintf(out, "\tr[%u] = r[%u] + 0x%04x;\n",
+						A, B, in->simm);
+			break;
+		case NAND:
+			if (A != 0)
+				fprintf(out, "\tr[%u] = ~(r[%u] & r[%u]);\n",
+						A, B, C);
+			break;
+		case LUI:
+			if (A != 0)
+				fprintf(out, "\tr[%u] = 0x%04x;\n",
+						A, (uint16_t) (in->uimm << 6));
+			break;
+		case SW:
+			fprintf(out, "\tSTORE(r[%u] + 0x%04x, r[%u], 0x%04x, "
+					"%u, %s);\n", B, in->simm, A, at,
+					pc + length - at, args);
+			break;
+		case LW:
+			if (A != 0)
+				fprintf(out, "\tr[%u] = READ(r[%u] + 0x%04x);\n",
+						A, B, in->simm);
+			break;
+		case BEQ:
+			if (A != B) {
+				fprintf(out, "\tif (r[%u] == r[%u]) {\n",
+						A, B);
+				emit_exit(out, vm, at + 1 + in->simm, at,
+						taken, "\t\t");
+				fprintf(out, "\t}\n");
+				emit_exit(out, vm, at + 1, at, tally, "\t");
+			} else {
+				emit_exit(out, vm, at + 1 + in->simm, at,
+						taken, "\t");
+			}
+			break;
+		case JALR:
+			/* When A == B, the jump goes to the value just
+			 * written, i.e. the next instruction */
+			if (A == B) {
+				if (A != 0)
+					fprintf(out, "\tr[%u] = 0x%04x;\n",
+							A, at + 1);
+				emit_exit(out, vm, at + 1, at, tally, "\t");
+			} else {
+				fprintf(out, "\tuint32_t target = r[%u];\n",
+						B);
+				if (A != 0)
+					fprintf(out, "\tr[%u] = 0x%04x;\n",
+							A, at + 1);
+				fprintf(out, "\tTALLY(%s);\n",
+						tally_args(args, tally));
+				fprintf(out, "\treturn target%s;\n", at == last
+						? " | EXIT_HALT" : "");
+			}
+			break;
+		case EXT:
+			if (A != 0)
+				emit_extension(out, in);
+			break;
+		}
+	}
+
+	at = pc + length - 1;
+	if (vm->decoded[at - md->text_start].opcode != BEQ
+			&& vm->decoded[at - md->text_start].opcode != JALR)
+		emit_exit(out, vm, at + 1, at, tally, "\t");
+
+	fprintf(out, "}\n\n");
+}
+
+/* Same as extension_result, for a register A that is not r0 */
+static void emit_extension(FILE* out, const instruction_t* in)
+{
+	unsigned	A	= in->regA;
+	unsigned	B	= in->regB;
+	unsigned	C	= in->regC;
+
+	switch (in->operation) {
+	case EXT_MUL:
+		fprintf(out, "\tr[%u] = (uint32_t) r[%u] * r[%u];\n", A, B, C);
+		break;
+	case EXT_MULH:
+		fprintf(out, "\tr[%u] = ((uint32_t) r[%u] * r[%u]) >> 16;\n",
+				A, B, C);
+		break;
+	case EXT_DIVU:
+		fprintf(out, "\tr[%u] = r[%u] ? r[%u] / r[%u] : 0xffff;\n",
+				A, C, B, C);
+		break;
+	case EXT_REMU:
+		fprintf(out, "\tr[%u] = r[%u] ? r[%u] %% r[%u] : r[%u];\n",
+				A, C, B, C, B);
+		break;
+	case EXT_SLL:
+		fprintf(out, "\tr[%u] = r[%u] << (r[%u] & 15);\n", A, B, C);
+		break;
+	case EXT_SRL:
+		fprintf(out, "\tr[%u] = r[%u] >> (r[%u] & 15);\n", A, B, C);
+		break;
+	case EXT_SRA:
+		fprintf(out, "\tr[%u] = (int16_t) r[%u] >> (r[%u] & 15);\n",
+				A, B, C);
+		break;
+	}
+}
+
+/* Continues at `target` after the instruction at `at`, having executed what
+ * `tally` counts */
+static void emit_exit(FILE* out, RiscyVM* vm, uint16_t target, uint16_t at,
+			const unsigned tally[], const char* indent)
+{
+	metadata_t*	md	= &vm->metadata;
+	char		args[64];
+
+	fprintf(out, "%sTALLY(%s);\n", indent, tally_args(args, tally));
+	fprintf(out, "%sreturn 0x%04x%s;\n", indent, target,
+			at == md->text_header + md->text_size
+			? " | EXIT_HALT" : "");
+}
+
+/* Writes the arguments of TALLY into `args` */
+static char* tally_args(char* args, const unsigned tally[])
+{
+	char* p = args;
+
+	for (int i = 0; i < AOT_NUM_COUNTS; ++i)
+		p += sprintf(p, "%s%u", i > 0 ? ", " : "", tally[i]);
+	return args;
+}
+
+static bool ends_with(const char* s, const char* suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+
+	return n >= m && !strcmp(s + n - m, suffix);
+}
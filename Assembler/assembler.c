@@ -4,554 +4,803 @@
 #include "utility.h"
 
 #include <ctype.h>
-#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_LINE_LENGTH	(1024)
-#define WORD_SIZE	(16)
-
+#define MASK_LOW_6	(0x3f)		/* 0000 0000 0011 1111 */
 #define MASK_LOW_7	(0x7f)		/* 0000 0000 0111 1111 */
 #define MASK_LOW_10	(0x3ff)		/* 0000 0011 1111 1111 */
-#define MASK_UPP_9	(0xff80)	/* 1111 1111 1000 0000 */
 
-/* Splits up a line into proper assembly language tokens */
-static int	tokenize	(char**		tokens,
-				 const char*	src,
-				 const char*	delimiters);
+#define BRANCH_MIN	(-64)		/* Reach of the 7-bit beq offset */
+#define BRANCH_MAX	(63)
+
+#define SCRATCH		(5)		/* Register `or` may clobber */
+
+/* Prints a compile error for source line `line` and exits */
+#define COMPILE_ERROR(as, line, ...)					\
+	do {								\
+		printf("[!] Compile error (%s, line %u): ",		\
+				(as)->filename, (line));		\
+		printf(__VA_ARGS__);					\
+		exit(EXIT_FAILURE);					\
+	} while (0)
+
+/* Opcodes, in the same order as `instructions` in utility.c */
+enum { ADD, ADDI, NAND, LUI, SW, LW, BEQ, JALR };
+
+/* Pseudo-instructions, in the same order as `pseudos` below */
+enum { NOP, LLI, MOVI, AND, OR, NOT, SUB, NEG, NBR_PSEUDOS };
+
+static const char* pseudos[NBR_PSEUDOS] = {
+	"nop", "lli", "movi", "and", "or", "not", "sub", "neg",
+};
+
+/* Extension instructions: a JALR with the operation, numbered from 1 in the
+ * order of `extensions`, in bits 3-6 and register C in bits 0-2 */
+enum { MUL = 1, MULH, DIVU, REMU, SLL, SRL, SRA, NBR_EXTENSIONS };
+
+static const char* extensions[NBR_EXTENSIONS] = {
+	NULL, "mul", "mulh", "divu", "remu", "sll", "srl", "sra",
+};
+
+bool strict_risc16;
+
+/* Instruction words, from their fields */
+#define RRR(op, a, b, c)	((op) << 13 | (a) << 10 | (b) << 7 | (c))
+#define RRI(op, a, b, imm)	((op) << 13 | (a) << 10 | (b) << 7	\
+					| ((imm) & MASK_LOW_7))
+#define EXT(op, a, b, c)	(RRR(JALR, a, b, c) | (op) << 3)
+#define RI(op, a, imm)		((op) << 13 | (a) << 10			\
+					| (((imm) >> 6) & MASK_LOW_10))
+
+typedef struct	token_t		token_t;
+typedef struct	relax_t		relax_t;
+typedef struct	assembler_t	assembler_t;
+
+struct token_t {
+	char*		text;		/* NUL-terminated, inside the source */
+	uint32_t	line;
+	bool		first;		/* First token on its line */
+	bool		indented;	/* Whitespace before it on its line */
+};
+
+/* A movi of a label, assembled as lui + addi, which relax may shorten */
+struct relax_t {
+	uint16_t	offset;		/* Of the lui, within the text */
+	int		fixup;		/* Of the lui; the addi's comes next */
+	bool		is_short;	/* The address fits in one word */
+};
+
+/* Everything an assembly needs lives here, so that several can run at once */
+struct assembler_t {
+	const char*	filename;	/* Of the source, for errors */
+	program_t*	program;
+	token_t*	tokens;
+	label_t*	labels;
+	fixup_t*	fixups;
+	relax_t*	relaxes;
+	int		nbr_tokens;
+	int		nbr_labels;
+	int		nbr_fixups;
+	int		nbr_relaxes;
+	int		max_tokens;
+	int		max_labels;
+	int		max_fixups;
+	int		max_relaxes;
+	symtable_t*	names;		/* Index in `labels` of each label */
+};
+
+static void	tokenize		(assembler_t* as, char source[]);
+static void	assemble_line		(assembler_t* as, token_t* tokens,
+					 int nbr_tokens);
+static void	assemble_fill		(assembler_t* as, token_t* tokens,
+					 int nbr_tokens);
+static void	assemble_instruction	(assembler_t* as, token_t* tokens,
+					 int nbr_tokens);
+static void	assemble_pseudo		(assembler_t* as, token_t* tokens,
+					 int nbr_tokens);
+static void	assemble_extension	(assembler_t* as, token_t* tokens,
+					 int nbr_tokens);
+static void	assemble_movi		(assembler_t* as, token_t* token,
+					 uint16_t reg);
+static void	emit			(assembler_t* as, uint32_t line,
+					 uint16_t word);
+static int	get_pseudo		(const char* name);
+static int	get_extension		(const char* name);
+static bool	fits_one_word		(uint16_t value);
+static uint16_t	movi_word		(uint16_t reg, uint16_t value);
+static uint16_t	parse_register		(assembler_t* as,
+					 const token_t* token);
+static uint16_t	parse_immediate		(assembler_t* as, token_t* token,
+					 bool in_text, uint16_t offset,
+					 fixup_kind_t kind);
+static void	run_passes		(assembler_t* as, program_t* program,
+					 char source[], const char filename[]);
+static void	relax			(assembler_t* as);
+static uint16_t	label_address		(assembler_t* as, const label_t* label,
+					 const uint16_t removed[]);
+static void	resolve_labels		(assembler_t* as);
+static void*	grow			(void* array, int* max, size_t size);
+static bool	is_delimiter		(char c);
+
+void assemble(program_t* program, char source[], const char filename[])
+{
+	assembler_t as = { 0 };
 
-/* Assembles `src`, a line with instructions, and stores the result in `dest` */
-static void	assemble_line	(uint16_t*	dest,
-				 uint16_t*	line_num,
-				 const char*	src);
+	run_passes(&as, program, source, filename);
 
+	/* Pass 3 */
+	relax(&as);
+	resolve_labels(&as);
 
-/* File Cleanup 
- * 	Remove comments and trailing whitespace.
- * 	Store the result in a new file `output`.
- */
-void file_cleanup(FILE* output, FILE* input)
-{
-	char buffer[MAX_LINE_LENGTH];
-
-	while (fgets(buffer, sizeof buffer, input)) {
-		remove_comments(buffer);
-		remove_trailing_whitespace(buffer);
-		if (strlen(buffer) > MAX_LINE_LENGTH) {
-			printf("[!] Line too long: %s\n", buffer); 
-			exit(EXIT_FAILURE);
-		}
-		fprintf(output, "%s", buffer);
-	}
+	symtable_free(as.names);
+	free(as.labels);
+	free(as.fixups);
+	free(as.relaxes);
 }
 
-void check_registers(FILE* input)
+void assemble_object(program_t* program, char source[],
+		const char filename[])
 {
-	char		buffer[MAX_LINE_LENGTH];
-	char*		token;
-	char		delimiters[] = "\t\n ,";
-	uint16_t	line = 0;
-
-	while (fgets(buffer, sizeof buffer, input)) {
-		line += 1;
-		token = strtok(buffer, delimiters);
-		while (token != NULL) {
-			if (token[0] == 'r' && isdigit(token[1])) {
-				if (!is_register(token)) {
-					printf("[!] Compile error (line %u): "
-						"Invalid register \"%s\".\n",
-						line, token);
-					exit(EXIT_FAILURE);
-				}
-			}
-			token = strtok(NULL, delimiters);
-		}
-	}
-	rewind(input);
-}
-
-/* Parse Labels
- * 		If a label such as "example:" is found in `input`, store the
- * 		address (which ranges from 0 to 2^16 - 1) inside `symtable`.
- */
-void parse_labels(FILE* input, symtable_t* symtable)
-{
-	char		buffer[MAX_LINE_LENGTH];
-	char*		token;
-	char*		next_token;
-	char		delimiters[] = "\t\n ,";
-	uint16_t	address	= 0;
-	uint16_t	line	= 0;
+	assembler_t as = { 0 };
 
-	while (fgets(buffer, sizeof buffer, input)) {
+	run_passes(&as, program, source, filename);
 
-		line += 1;
+	/* The addresses are not known yet, so every movi keeps both words */
+	symtable_free(as.names);
+	free(as.relaxes);
 
-		if (is_empty_line(buffer))
-			continue;
-
-		token = strtok(buffer, delimiters); 
+	program->labels		= as.labels;
+	program->fixups		= as.fixups;
+	program->nbr_labels	= as.nbr_labels;
+	program->nbr_fixups	= as.nbr_fixups;
+}
 
-		if (strlast(token) == ':') {
+bool apply_fixup(uint16_t* word, fixup_kind_t kind, uint16_t address,
+		uint16_t next)
+{
+	int delta;
+
+	switch (kind) {
+	case FIXUP_WORD:
+		*word = address;
+		break;
+	case FIXUP_SIMM:
+		*word |= address & MASK_LOW_7;
+		break;
+	case FIXUP_LOW6:
+		*word |= address & MASK_LOW_6;
+		break;
+	case FIXUP_UIMM:
+		*word |= (address >> 6) & MASK_LOW_10;
+		break;
+	case FIXUP_BRANCH:
+		delta = address - next;
+		if (delta < BRANCH_MIN || delta > BRANCH_MAX)
+			return false;
+		*word |= delta & MASK_LOW_7;
+		break;
+	}
 
-			if (buffer[0] != token[0]) {
-				printf("[!] Compile error (line %u): Labels may"
-					" not be indented.\n", line);
-				exit(EXIT_FAILURE);
-			}
+	return true;
+}
 
-			/* Get next token. Should be directive or opcode. */
-			next_token = strtok(NULL, delimiters);
+/* Passes 1 and 2 */
+static void run_passes(assembler_t* as, program_t* program, char source[],
+		const char filename[])
+{
+	int end;
+
+	program->data_size	= 0;
+	program->text_size	= 0;
+	program->symtable	= symtable_init();
+	program->labels		= NULL;
+	program->fixups		= NULL;
+	program->nbr_labels	= 0;
+	program->nbr_fixups	= 0;
+	as->filename		= filename;
+	as->program		= program;
+	as->names		= symtable_init();
+
+	/* Pass 1 */
+	tokenize(as, source);
+
+	/* Pass 2, one line at a time */
+	for (int i = 0; i < as->nbr_tokens; i = end) {
+		for (end = i + 1; end < as->nbr_tokens; ++end) {
+			if (as->tokens[end].first)
+				break;
+		}
+		assemble_line(as, &as->tokens[i], end - i);
+	}
 
-			/* Remove ending ':' character */
-			token[strlen(token) - 1] = '\0';
+	free(as->tokens);
+}
 
-			if (next_token == NULL) {
-				printf("[!] Compile error (line %u): Label \"%s"
-					"\" may not be on a line by itself.\n",
-					line, token);
-				exit(EXIT_FAILURE);
-			}
+/* Splits `source` into tokens by writing NULs over the delimiters, newlines
+ * and comments that separate them. */
+static void tokenize(assembler_t* as, char source[])
+{
+	char*		p		= source;
+	uint32_t	line		= 1;
+	bool		first		= true;
+	bool		indented	= false;
+	token_t*	token;
+
+	while (*p != '\0') {
+		if (*p == '\n') {
+			*p++		= '\0';
+			line		+= 1;
+			first		= true;
+			indented	= false;
+			continue;
+		}
 
-			/* Add 1 or 2 to the address, because the data will be
-			 * prepended by a one-line data header and the text by
-			 * a one-line text header
-			 */
-			/* TODO(Alexander): or .space */
-			if (streq(next_token, ".fill")) {
-				symtable_add(symtable, token, address + 1);
-
-			} else if (is_instruction(next_token)) {
-				symtable_add(symtable, token, address + 2);
-
-			} else {
-				printf("[!] Compile error (line %u): Unknown "
-					"token \"%s\".\n", line, next_token);
-				exit(EXIT_FAILURE);
-			}
+		if (*p == '#') {
+			while (*p != '\n' && *p != '\0')
+				*p++ = '\0';
+			continue;
 		}
 
-		address += 1;
+		if (is_delimiter(*p)) {
+			*p++		= '\0';
+			indented	= true;
+			continue;
+		}
 
+		if (as->nbr_tokens == as->max_tokens) {
+			as->tokens = grow(as->tokens, &as->max_tokens,
+						sizeof *as->tokens);
+		}
+		token		= &as->tokens[as->nbr_tokens++];
+		token->text	= p;
+		token->line	= line;
+		token->first	= first;
+		token->indented	= indented;
+		first		= false;
+
+		while (*p != '\0' && *p != '\n' && *p != '#'
+				&& !is_delimiter(*p))
+			++p;
 	}
-	symtable_print(symtable);
-	rewind(input);		/* A real programmer doesn't litter. */
 }
 
-/* Reduces the input by removing all labels "to the left", i.e. those that end
- * with a ':', and also replaces the lables given as arguments to instructions
- * with their binary representations, i.e. their real addresses.
- */
-void replace_labels(FILE* output, FILE* input, symtable_t* symtable)
+static void assemble_line(assembler_t* as, token_t* tokens, int nbr_tokens)
 {
-	char		buffer_in[MAX_LINE_LENGTH];
-	char		buffer_out[MAX_LINE_LENGTH];
-	char		buffer_str[MAX_LINE_LENGTH];
-	char*		token;
-	char		delimiters[]	= "\n\t ,";
-	uint16_t	address		= 0;
-
-	if (output == NULL || input == NULL || symtable == NULL) {
-		fprintf(stderr, "%s:%s: [!] Error: NULL parameter.\n",
-				__FILE__, __func__);
-		exit(EXIT_FAILURE);
-	}
-	
-	memset(buffer_out, '\0', sizeof buffer_out);
-
-	/* Walk through lines */
-	while (fgets(buffer_in, sizeof buffer_in, input)) {
-//		printf("Got line:\t%s", buffer_in);
-
-		/* Walk through tokens */
-		token = strtok(buffer_in, delimiters);
-		while (token != NULL) {
-//			printf("\tGot token:\t%s\n", token);
-
-			/* Don't write the [label_name:] tokens to the
-			 * output. They are already parsed. */
-			if (strlast(token) == ':') {
-				token = strtok(NULL, delimiters);
-				continue;
-			}
-
-			/* beq (Branch If Equals) must be parsed separately
-			 * because it can be written both with a label or a
-			 * number as its immediate argument */
-			if (streq(token, "beq")) {
-				printf("GOT BEQ <-------------------\n");
-				strcat(buffer_out, token);
-				strcat(buffer_out, " ");
-				strcat(buffer_out, strtok(NULL, delimiters));
-				strcat(buffer_out, " ");
-				strcat(buffer_out, strtok(NULL, delimiters));
-				strcat(buffer_out, " ");
-
-				token = strtok(NULL, delimiters);
-				printf("beq arg 3 = %s\n", token);
-
-				/* If label, calculate offset with address */
-				if (symtable_contains(symtable, token)) {
-					uint16_t n =
-					symtable_get_address(symtable, token)
-					- address + 2;
-
-					sprintf(buffer_str, "0x%04x", n);
-
-				/* If number, just print number */
-				} else if (is_hex(token) || is_binary(token) ||
-						is_dec(token)) {
-					strcpy(buffer_str, token);
-
-				} else {
-					printf("[!] Compile error (line %d): "
-						"Invalid token \"%s\".\n",
-						address + 1, token);
-					exit(1);
-				}
-				strcat(buffer_out, buffer_str);
-				break;	/* Done, get next line */
-			}
-
-			char format[] = "0x%04x ";
-
-			if (symtable_contains(symtable, token)) {
-				sprintf(buffer_str, format,
-					symtable_get_address(symtable, token));
-				printf("&%s = %s\n", token, buffer_str);
-
-			} else if (is_directive(token)	|| is_register(token) ||
-				is_instruction(token)) {
-				sprintf(buffer_str, "%s ", token);
-
-			} else if (is_binary(token) || is_hex(token) ||
-					is_dec(token)) {
-				sprintf(buffer_str, format, str_to_int(token));
+	program_t*	program	= as->program;
+	char*		name	= tokens[0].text;
+	uint32_t	line	= tokens[0].line;
+	label_t*	label;
+
+	if (is_label(name)) {
+		if (tokens[0].indented) {
+			COMPILE_ERROR(as, line, "Labels may not be indented.\n");
+		}
 
-			} else {
-				printf("[!] Compile error (line %d): Invalid "
-					"token \"%s\".\n", address + 1, token);
-				exit(EXIT_FAILURE);
-			}
+		/* Remove ending ':' character */
+		name[strlen(name) - 1] = '\0';
 
-			strcat(buffer_out, buffer_str);
+		if (name[0] == '\0' || is_dec(name) || is_register(name)) {
+			COMPILE_ERROR(as, line, "Invalid label \"%s\".\n", name);
+		}
+		if (strlen(name) > MAX_LABEL_LENGTH) {
+			COMPILE_ERROR(as, line, "Label \"%s\" is longer than %d "
+				"characters.\n", name, MAX_LABEL_LENGTH);
+		}
+		if (nbr_tokens == 1) {
+			COMPILE_ERROR(as, line, "Label \"%s\" may not be on a "
+				"line by itself.\n", name);
+		}
+		if (symtable_contains(as->names, name)) {
+			COMPILE_ERROR(as, line, "Label \"%s\" is already "
+					"defined.\n", name);
+		}
+		symtable_add(as->names, name, as->nbr_labels);
 
-			/* Get next token */
-			token = strtok(NULL, delimiters);
+		/* The label names the word assembled from the rest of the
+		 * line; its address is known once the data size is. */
+		if (as->nbr_labels == as->max_labels) {
+			as->labels = grow(as->labels, &as->max_labels,
+						sizeof *as->labels);
 		}
-		strcat(buffer_out, "\n");
-		fprintf(output, "%s", buffer_out);
-		memset(buffer_out, '\0', sizeof buffer_out);
+		label		= &as->labels[as->nbr_labels++];
+		label->name	= name;
+		label->line	= line;
+		label->in_text	= !is_directive(tokens[1].text);
+		label->offset	= label->in_text ? program->text_size
+						 : program->data_size;
+
+		tokens		+= 1;
+		nbr_tokens	-= 1;
+	}
 
-		address += 1;
+	/* Two header words share the memory with data and text */
+	if (program->data_size + program->text_size >= MEM_SIZE - 1) {
+		COMPILE_ERROR(as, line, "Program does not fit in memory.\n");
 	}
 
-	rewind(output);		/* A real programmer doesn't litter; */
-	rewind(input);		/* "Reset" the read position in the file. */
+	if (is_directive(tokens[0].text))
+		assemble_fill(as, tokens, nbr_tokens);
+	else if (get_pseudo(tokens[0].text) >= 0)
+		assemble_pseudo(as, tokens, nbr_tokens);
+	else if (get_extension(tokens[0].text) > 0)
+		assemble_extension(as, tokens, nbr_tokens);
+	else
+		assemble_instruction(as, tokens, nbr_tokens);
 }
 
-void assemble_data(FILE* output, FILE* input)
+/* TODO(Alexander):
+ * 	Add the .space directive described in
+ * 	http://www.eng.umd.edu/~blj/RiSC/RiSC-isa.pdf
+ */
+static void assemble_fill(assembler_t* as, token_t* tokens, int nbr_tokens)
 {
-	char		buffer_in[MAX_LINE_LENGTH];
-	char*		token;			/* Part of an instruction */
-	char*		delimiters;		/* Split tokens on these */
-	uint16_t	lines_out[MEM_SIZE];
-	uint16_t	line_nbr;		/* For compile error messages */
-	uint16_t	data_size;		/* For the data header */
+	program_t*	program	= as->program;
+	uint32_t	line	= tokens[0].line;
 
-	delimiters	= "\t\n ";
-	memset(lines_out, 0, sizeof *lines_out);
-	line_nbr	= 0;
-	data_size	= 0;
+	if (!streq(tokens[0].text, ".fill")) {
+		COMPILE_ERROR(as, line, "Unknown directive \"%s\".\n",
+				tokens[0].text);
+	}
+	if (nbr_tokens != 2) {
+		COMPILE_ERROR(as, line, ".fill directive takes one argument.\n");
+	}
 
-	while (fgets(buffer_in, sizeof buffer_in, input)) {
+	program->data[program->data_size] = parse_immediate(as, &tokens[1],
+				false, program->data_size, FIXUP_WORD);
+	program->data_size += 1;
+}
 
-		line_nbr += 1;
+static void assemble_instruction(assembler_t* as, token_t* tokens,
+		int nbr_tokens)
+{
+	static const int nbr_operands[NBR_INSTRUCTIONS] = {
+		[ADD]	= 3,	[ADDI]	= 3,	[NAND]	= 3,	[LUI]	= 2,
+		[SW]	= 3,	[LW]	= 3,	[BEQ]	= 3,	[JALR]	= 2,
+	};
+
+	program_t*	program	= as->program;
+	uint16_t	offset	= program->text_size;
+	uint32_t	line	= tokens[0].line;
+	int		opcode	= get_opcode(tokens[0].text);
+	uint16_t	word;
+
+	if (opcode < 0) {
+		COMPILE_ERROR(as, line, "Unknown opcode \"%s\".\n",
+				tokens[0].text);
+	}
+	if (nbr_tokens - 1 != nbr_operands[opcode]) {
+		COMPILE_ERROR(as, line, "\"%s\" takes %d operands, not %d.\n",
+				tokens[0].text, nbr_operands[opcode],
+				nbr_tokens - 1);
+	}
 
-		/* Get the first token if the line */
-		token = strtok(buffer_in, delimiters);
+	word = opcode << 13 | parse_register(as, &tokens[1]) << 10;
+
+	switch (opcode) {
+	case ADD:
+	case NAND:
+		word |= parse_register(as, &tokens[2]) << 7;
+		word |= parse_register(as, &tokens[3]);
+		break;
+	case ADDI:
+	case SW:
+	case LW:
+		word |= parse_register(as, &tokens[2]) << 7;
+		word |= parse_immediate(as, &tokens[3], true, offset,
+						FIXUP_SIMM) & MASK_LOW_7;
+		break;
+	case BEQ:
+		word |= parse_register(as, &tokens[2]) << 7;
+		word |= parse_immediate(as, &tokens[3], true, offset,
+						FIXUP_BRANCH) & MASK_LOW_7;
+		break;
+	case LUI:
+		word |= (parse_immediate(as, &tokens[2], true, offset,
+					FIXUP_UIMM) >> 6) & MASK_LOW_10;
+		break;
+	case JALR:
+		word |= parse_register(as, &tokens[2]) << 7;
+		break;
+	}
 
-		/* Skips empty lines */
-		if (token == NULL) {
-//			printf("Got NULL token.\n");
-			continue;
-		}
+	program->text[offset]	= word;
+	program->text_size	+= 1;
+}
 
-		/* Only parse .fill directives.
-		 * TODO(Alexander):
-		 * 	Add the .space directive described in
-		 * 	http://www.eng.umd.edu/~blj/RiSC/RiSC-isa.pdf
-		 */
-		if (!streq(token, ".fill")) {
-			continue;
-		}
+/* Each pseudo-instruction expands to the shortest sequence that does the job
+ * for its operands. Only `or` needs a register of its own, SCRATCH, which it
+ * may not be given as an operand. */
+static void assemble_pseudo(assembler_t* as, token_t* tokens, int nbr_tokens)
+{
+	static const int nbr_operands[NBR_PSEUDOS] = {
+		[NOP]	= 0,	[LLI]	= 2,	[MOVI]	= 2,	[AND]	= 3,
+		[OR]	= 3,	[NOT]	= 2,	[SUB]	= 3,	[NEG]	= 2,
+	};
+
+	uint32_t	line	= tokens[0].line;
+	int		pseudo	= get_pseudo(tokens[0].text);
+	uint16_t	offset	= as->program->text_size;
+	uint16_t	a	= 0;
+	uint16_t	b	= 0;
+	uint16_t	c	= 0;
+
+	if (nbr_tokens - 1 != nbr_operands[pseudo]) {
+		COMPILE_ERROR(as, line, "\"%s\" takes %d operands, not %d.\n",
+				tokens[0].text, nbr_operands[pseudo],
+				nbr_tokens - 1);
+	}
 
-		/* Get the next token */
-		token = strtok(NULL, delimiters);
-
-		if (token == NULL) {
-			printf("[!] Compile error: Line %d: .fill directive is "
-				"missing argument.\n", line_nbr);
-			exit(EXIT_FAILURE);
-		} 
-
-		printf("token = %s\n", token);
-
-		/* 
-		 * Hex and binary checks
-		 */
-		if (token[0] == '0' && token[1] == 'x')
-		{
-			printf("token = %s\n", token);
-			if (strlen(token) != 2 + 4)
-			{
-				fprintf(stderr, "[!] Error in %s: %s.\n",
-						__FILE__, __func__);
-				exit(EXIT_FAILURE);
-			}
-			if (!is_hex(token))
-			{
-				printf("[!] Compile error: Line %d: Invalid hex"
-				" number 0x%s.\n", line_nbr, token);
-				exit(EXIT_FAILURE);
-			}
+	if (pseudo != NOP)
+		a = parse_register(as, &tokens[1]);
+	if (pseudo == NOT || pseudo == NEG || nbr_operands[pseudo] == 3)
+		b = parse_register(as, &tokens[2]);
+	if (nbr_operands[pseudo] == 3)
+		c = parse_register(as, &tokens[3]);
+
+	switch (pseudo) {
+	case NOP:
+		emit(as, line, RRR(ADD, 0, 0, 0));
+		break;
+	case LLI:
+		/* a |= imm & 0x3f, after a lui */
+		emit(as, line, RRI(ADDI, a, a, parse_immediate(as, &tokens[2],
+					true, offset, FIXUP_LOW6) & MASK_LOW_6));
+		break;
+	case MOVI:
+		assemble_movi(as, &tokens[2], a);
+		break;
+	case AND:
+		emit(as, line, RRR(NAND, a, b, c));
+		emit(as, line, RRR(NAND, a, a, a));
+		break;
+	case OR:
+		/* a = ~b nand ~c */
+		if (b == c) {
+			emit(as, line, RRR(ADD, a, b, 0));
+			break;
 		}
-
-		else if (token[0] == '0' && token[1] == 'b')
-		{
-			if (strlen(token) != 2 + 16)
-			{
-				printf( "[!] Compile error: Line %d: binary "
-				"numbers must be 16 characters long; is %lu "
-				"characters long.\n", line_nbr, strlen(token));
-				exit(EXIT_FAILURE);
-			}
-			if (!is_binary(token))
-			{
-				printf( "[!] Compile error: Line %d: Invalid "
-				"binary number %s.\n", line_nbr, token);
-				exit(EXIT_FAILURE);
-			}
+		if (a == SCRATCH || b == SCRATCH || c == SCRATCH) {
+			COMPILE_ERROR(as, line, "\"or\" uses r%d as scratch, "
+				"so it may not be an operand.\n", SCRATCH);
 		}
-
-		else
-		{
-			printf("[!] Compile error: Line %d: Not a binary or hex"
-				"adecimal number (%s).\n", line_nbr, token);
-			exit(EXIT_FAILURE);
+		emit(as, line, RRR(NAND, SCRATCH, b, b));
+		emit(as, line, RRR(NAND, a, c, c));
+		emit(as, line, RRR(NAND, a, a, SCRATCH));
+		break;
+	case NOT:
+		emit(as, line, RRR(NAND, a, b, b));
+		break;
+	case SUB:
+		/* b - c == ~(~b + c) == b + (~c + 1) */
+		if (b == c) {
+			emit(as, line, RRR(ADD, a, 0, 0));
+		} else if (a != c) {
+			emit(as, line, RRR(NAND, a, b, b));
+			emit(as, line, RRR(ADD, a, a, c));
+			emit(as, line, RRR(NAND, a, a, a));
+		} else {
+			emit(as, line, RRR(NAND, a, c, c));
+			emit(as, line, RRI(ADDI, a, a, 1));
+			emit(as, line, RRR(ADD, a, b, a));
 		}
-
-		lines_out[data_size] = str_to_int(token);
-
-		data_size += 1;
+		break;
+	case NEG:
+		emit(as, line, RRR(NAND, a, b, b));
+		emit(as, line, RRI(ADDI, a, a, 1));
+		break;
 	}
+}
 
-	/* Print as binary */
-#if 0
-	char binbuf[17];
-	fprintf(output, "%s\n", dec_to_bin(binbuf, data_size, 16));
-	for (int i = 0; i < data_size; ++i) {
-		fprintf(output, "%s\n", dec_to_bin(binbuf, lines_out[i], 16));
+/* op rA, rB, rC: rA = rB op rC. See documentation.txt. */
+static void assemble_extension(assembler_t* as, token_t* tokens,
+		int nbr_tokens)
+{
+	uint32_t	line	= tokens[0].line;
+
+	if (strict_risc16) {
+		COMPILE_ERROR(as, line, "\"%s\" is an extension instruction, "
+				"which --strict rejects.\n", tokens[0].text);
 	}
-#endif
-
-	/* Print as hex */
-	char format[] = "0x%04x\n";
-//	char format[] = "%"PRIu16"\n";
-	fprintf(output, format, data_size);
-	for (int i = 0; i < data_size; ++i) {
-		fprintf(output, format, lines_out[i]);
+	if (nbr_tokens != 4) {
+		COMPILE_ERROR(as, line, "\"%s\" takes 3 operands, not %d.\n",
+				tokens[0].text, nbr_tokens - 1);
 	}
 
-	rewind(output);		/* A real programmer doesn't litter; */
-	rewind(input);          /* "Reset" the read position in the file. */
+	emit(as, line, EXT(get_extension(tokens[0].text),
+				parse_register(as, &tokens[1]),
+				parse_register(as, &tokens[2]),
+				parse_register(as, &tokens[3])));
 }
 
-void assemble_text(FILE* output, FILE* input)
+/* A value that addi or lui can load on its own takes one word, and any other
+ * value lui + addi. The value of a label is not known until pass 3, so it is
+ * given both words here, and relax takes the addi out again if the address
+ * turns out to fit in one. */
+static void assemble_movi(assembler_t* as, token_t* token, uint16_t reg)
 {
-	char		buffer_in[MAX_LINE_LENGTH];
-	uint16_t	lines_out[MEM_SIZE];
-//	uint16_t	line_nbr = 0;
-	uint16_t	text_size = 0;
-
-	memset(lines_out, 0, sizeof *lines_out);
-	while (fgets(buffer_in, sizeof buffer_in, input)) {
-		assemble_line(&lines_out[text_size], &text_size, buffer_in);
-//		text_size += 1;
+	uint16_t	offset	= as->program->text_size;
+	uint16_t	value;
+	relax_t*	r;
+
+	if (is_dec(token->text) || is_hex(token->text)
+			|| is_binary(token->text)) {
+		value = str_to_int(token->text);
+		if (fits_one_word(value)) {
+			emit(as, token->line, movi_word(reg, value));
+		} else {
+			emit(as, token->line, RI(LUI, reg, value));
+			emit(as, token->line, RRI(ADDI, reg, reg,
+						value & MASK_LOW_6));
+		}
+		return;
 	}
 
-	/* Print as binary */
-#if 0
-	char binbuf[17];
-	fprintf(output, "%s\n", dec_to_bin(binbuf, text_size, 16));
-	for (int i = 0; i < text_size; ++i) {
-		fprintf(output, "%s\n",
-				dec_to_bin(binbuf, lines_out[i], 16));
+	if (as->nbr_relaxes == as->max_relaxes) {
+		as->relaxes = grow(as->relaxes, &as->max_relaxes,
+					sizeof *as->relaxes);
 	}
-#endif
-
-	/* Print as hex */
-	char format[] = "0x%04x\n";
-//	char format[] = "%"PRIu16"\n";
-	fprintf(output, format, text_size);
-	for (int i = 0; i < text_size; ++i) {
-		fprintf(output, format, lines_out[i]);
-	}
-
-	rewind(output);		/* A real programmer doesn't litter; */
-	rewind(input);          /* "Reset" the read position in the file. */
+	r		= &as->relaxes[as->nbr_relaxes++];
+	r->offset	= offset;
+	r->fixup	= as->nbr_fixups;
+
+	emit(as, token->line, RI(LUI, reg, parse_immediate(as, token, true,
+					offset, FIXUP_UIMM)));
+	emit(as, token->line, RRI(ADDI, reg, reg, parse_immediate(as, token,
+					true, offset + 1, FIXUP_LOW6)));
 }
 
-/* Assembles an assembly line [src] and stores the result as an unsigned 16-bit
- * integer in [dest]
- */
-static void assemble_line(uint16_t* dest, uint16_t* line_num, const char* src)
+/* Appends `word` to the text */
+static void emit(assembler_t* as, uint32_t line, uint16_t word)
 {
-	char*	delimiters	= "\n\t ,";
-	char**	tokens		= calloc(WORD_SIZE, sizeof(char*));
-	int	num_tokens;	/* Used when calling the instructions */
-
-	/* All of the below values are not certain to exist, namely arg3 */
-	char	arg1	[11]	= {0};
-	char	arg2	[11]	= {0};
-	char	arg3	[11]	= {0};
+	program_t* program = as->program;
 
-	/* Split up line into tokens */
-	num_tokens = tokenize(tokens, src, delimiters);	
+	if (program->data_size + program->text_size >= MEM_SIZE - 1) {
+		COMPILE_ERROR(as, line, "Program does not fit in memory.\n");
+	}
+	program->text[program->text_size++] = word;
+}
 
-	/* Parse the tokens */
-	for (int i = 0; i < num_tokens; ++i) {
+/* Returns the pseudo-instruction called `name`, or -1 if it is not one */
+static int get_pseudo(const char* name)
+{
+	for (int i = 0; i < NBR_PSEUDOS; ++i) {
+		if (streq(name, pseudos[i]))
+			return i;
+	}
+	return -1;
+}
 
-		if (tokens[i] == NULL) {
-			printf("[!] Got NULL token\n");
-			continue;
-		}
+/* Returns the extension instruction called `name`, or 0 if it is not one */
+static int get_extension(const char* name)
+{
+	for (int i = 1; i < NBR_EXTENSIONS; ++i) {
+		if (streq(name, extensions[i]))
+			return i;
+	}
+	return 0;
+}
 
-		if (is_directive(tokens[i])) {
-			break;
-		}
+/* Whether addi (-64 to 63) or lui (a multiple of 64) can load `value` */
+static bool fits_one_word(uint16_t value)
+{
+	return value <= 0x003f || value >= 0xffc0 || (value & MASK_LOW_6) == 0;
+}
 
-		switch (num_tokens - 1) {
-		case 3:	strcpy(arg3, tokens[i + 3]);	/* Intentional */
-		case 2:	strcpy(arg2, tokens[i + 2]);	/* fallthrough */	
-		case 1:	strcpy(arg1, tokens[i + 1]);
-		}
+static uint16_t movi_word(uint16_t reg, uint16_t value)
+{
+	if ((value & MASK_LOW_6) == 0)
+		return RI(LUI, reg, value);
+	return RRI(ADDI, reg, 0, value);
+}
 
-		printf("Input:\t%s ", tokens[i]);
-		for (int j = 1; j < num_tokens; ++j)
-			printf("%s ", tokens[i + j]);
-		printf("\n");
+static uint16_t parse_register(assembler_t* as, const token_t* token)
+{
+	if (!is_register(token->text)) {
+		COMPILE_ERROR(as, token->line, "Invalid register \"%s\".\n",
+				token->text);
+	}
+	return token->text[1] - '0';
+}
 
+/* Returns the value of a number. A label is left as 0, to be patched by
+ * resolve_labels into the word at `offset` of its segment. */
+static uint16_t parse_immediate(assembler_t* as, token_t* token, bool in_text,
+		uint16_t offset, fixup_kind_t kind)
+{
+	fixup_t* fixup;
 
-		char* t = tokens[i];
+	if (is_dec(token->text) || is_hex(token->text)
+			|| is_binary(token->text))
+		return str_to_int(token->text);
 
-		uint16_t
-		regA, regB, regC, simm, uimm;
+	if (token->text[0] == 'r' && isdigit((unsigned char) token->text[1])) {
+		COMPILE_ERROR(as, token->line, "Invalid register \"%s\".\n",
+				token->text);
+	}
 
-		if (streq(t, "add" ) || streq(t, "nand")) {
-			regA = get_reg_num(arg1) << 10;
-			regB = get_reg_num(arg2) << 7;
-			regC = get_reg_num(arg3);
+	if (as->nbr_fixups == as->max_fixups) {
+		as->fixups = grow(as->fixups, &as->max_fixups,
+					sizeof *as->fixups);
+	}
+	fixup		= &as->fixups[as->nbr_fixups++];
+	fixup->name	= token->text;
+	fixup->line	= token->line;
+	fixup->in_text	= in_text;
+	fixup->offset	= offset;
+	fixup->kind	= kind;
+
+	return 0;
+}
 
-		} else if (streq(t, "addi") || streq(t, "sw")
-			|| streq(t, "lw") || streq(t, "beq")) {
-			regA = get_reg_num(arg1) << 10;
-			regB = get_reg_num(arg2) << 7;
-			simm = str_to_int(arg3) & MASK_LOW_7;
+/* Takes the addi out of each movi of a label whose address fits in one word.
+ * All of them start out short, and those whose label then does not fit are
+ * made long again, until none changes. Words are only ever put back, so this
+ * ends, and no beq gets further from its target than it was in pass 2. */
+static void relax(assembler_t* as)
+{
+	program_t*	program		= as->program;
+	uint16_t*	removed;	/* Words taken out before each offset */
+	uint16_t	address;
+	uint16_t	count;
+	relax_t*	r;
+	fixup_t*	fixup;
+	bool		changed;
+	int		n;
+
+	if (as->nbr_relaxes == 0)
+		return;
+
+	removed = malloc((program->text_size + 1) * sizeof *removed);
+	if (removed == NULL) {
+		fprintf(stderr, "%s:%s: [!] Error: Failed to allocate "
+				"memory.\n", __FILE__, __func__);
+		exit(EXIT_FAILURE);
+	}
 
-		} else if (streq(t, "lui" )) {
-			regA = get_reg_num(arg1) << 10;
-//			printf("arg2 = %s\n", arg2);
-//			printf("str_to_int(arg2) = 0x%04x\n", str_to_int(arg2));
-//			printf("str_to_int(arg2) >> 6 = 0x%04x\n", str_to_int(arg2) >> 6);
+	for (int i = 0; i < as->nbr_relaxes; ++i)
+		as->relaxes[i].is_short = true;
+
+	do {
+		count = 0;
+		for (int offset = 0, i = 0; offset <= program->text_size;
+								++offset) {
+			removed[offset] = count;
+			if (i < as->nbr_relaxes
+			&& as->relaxes[i].offset + 1 == offset) {
+				count	+= as->relaxes[i].is_short;
+				i	+= 1;
+			}
+		}
 
-			uimm = str_to_int(arg2) >> 6;
-			// XXX	Before: uimm = str_to_int(arg2) & MASK_LOW_10
-			
-//			printf("uimm & 0x3ff = 0x%04x\n", uimm & 0x3ff);
+		changed = false;
+		for (int i = 0; i < as->nbr_relaxes; ++i) {
+			r	= &as->relaxes[i];
+			fixup	= &as->fixups[r->fixup];
 
-			/* XXX Probably unnecessary: */
-			uimm &= MASK_LOW_10;
+			/* An undefined label is reported by resolve_labels */
+			if (!r->is_short
+			|| !symtable_contains(as->names, fixup->name))
+				continue;
 
-		} else if (streq(t, "jalr")) {
-			regA = get_reg_num(arg1) << 10;
-			regB = get_reg_num(arg2) << 7;
+			address = label_address(as, &as->labels[
+				symtable_get_address(as->names, fixup->name)],
+				removed);
+			if (!fits_one_word(address)) {
+				r->is_short	= false;
+				changed		= true;
+			}
 		}
+	} while (changed);
 
-		*dest = streq(t, "add" ) ?  0x0000 | regA | regB | regC :
-			streq(t, "addi") ?  0x2000 | regA | regB | simm :
-			streq(t, "nand") ?  0x4000 | regA | regB | regC :
-			streq(t, "lui" ) ?  0x6000 | regA | uimm        :
-			streq(t, "sw"  ) ?  0x8000 | regA | regB | simm :
-			streq(t, "lw"  ) ?  0xa000 | regA | regB | simm :
-			streq(t, "beq" ) ?  0xc000 | regA | regB | simm :
-			streq(t, "jalr") ? (0xe000 | regA | regB) & MASK_UPP_9
-			: 0xe001; /* The ternary operator needs an "else" */
-
-		if (*dest == 0xe001) {
-			// TODO(Alexander): What happens if it wasn't an opcode?
-			fprintf(stderr, "----------------------------------\n");
-			fprintf(stderr, "[!] Compile error (line %u): Unknown "
-					"opcode \"%s\".\n", *line_num, t);
-			fprintf(stderr, "----------------------------------\n");
-		}
+	/* Fill in the short ones, whose fixups are then done with */
+	for (int i = 0; i < as->nbr_relaxes; ++i) {
+		r	= &as->relaxes[i];
+		fixup	= &as->fixups[r->fixup];
+		if (!r->is_short)
+			continue;
 
-		char binbuf[17];
-		printf("*dest = %s\n", dec_to_bin(binbuf, *dest, 16));
-		printf("*dest = %"PRIu16"\n", *dest);
-		printf("\n");
+		address = label_address(as, &as->labels[
+			symtable_get_address(as->names, fixup->name)], removed);
+		program->text[r->offset] = movi_word(
+				program->text[r->offset] >> 10 & 0x7, address);
+		fixup[0].name = NULL;
+		fixup[1].name = NULL;
+	}
 
-		*line_num += 1;
+	n = 0;
+	for (int i = 0; i < as->nbr_fixups; ++i) {
+		fixup = &as->fixups[i];
+		if (fixup->name == NULL)
+			continue;
+		if (fixup->in_text)
+			fixup->offset -= removed[fixup->offset];
+		as->fixups[n++] = *fixup;
+	}
+	as->nbr_fixups = n;
 
-		break;	/* Unconditional break at the end of the for loop, why?
-			   The function should only actually keep looping as
-			   long as the first token is _not_ an instruction.
-			   When the function finally encounters an instruction,
-			   it counts the arguments and acts accordingly. */
+	for (int i = 0; i < as->nbr_labels; ++i) {
+		if (as->labels[i].in_text)
+			as->labels[i].offset -= removed[as->labels[i].offset];
 	}
 
-	if (tokens != NULL) {
-		free(tokens);
+	/* A word is taken out where the count goes up */
+	for (int offset = 0; offset < program->text_size; ++offset) {
+		if (removed[offset + 1] == removed[offset]) {
+			program->text[offset - removed[offset]] =
+				program->text[offset];
+		}
 	}
+	program->text_size -= removed[program->text_size];
+
+	free(removed);
 }
 
-int tokenize(char** tokens, const char* src, const char* delimiters)
+/* The address of `label`, once the words in `removed` are taken out */
+static uint16_t label_address(assembler_t* as, const label_t* label,
+		const uint16_t removed[])
 {
-	char	src_copy[MAX_LINE_LENGTH];
-	char*	token;
-	int	num_tokens;
-
-	strncpy		(src_copy, src, strlen(src) + 1);
-	num_tokens	= 0;
-	token		= strtok(src_copy, delimiters);
-
-	while (token != NULL) {
-		tokens[num_tokens] = token;
-		num_tokens += 1;
-		token = strtok(NULL, delimiters);
-	}
-
-	return num_tokens;
+	if (!label->in_text)
+		return 1 + label->offset;
+	return as->program->data_size + 2 + label->offset
+		- removed[label->offset];
 }
 
+/* Data starts right after the data header at address 0, and text right
+ * after the text header that follows the data. */
+static void resolve_labels(assembler_t* as)
+{
+	program_t*	program		= as->program;
+	uint16_t	text_start	= program->data_size + 2;
+	uint16_t	address;
+	uint16_t*	word;
+	label_t*	label;
+	fixup_t*	fixup;
+
+	for (int i = 0; i < as->nbr_labels; ++i) {
+		label	= &as->labels[i];
+		address	= label->in_text ? text_start + label->offset
+					 : 1 + label->offset;
+		symtable_add(program->symtable, label->name, address);
+	}
 
+	for (int i = 0; i < as->nbr_fixups; ++i) {
+		fixup = &as->fixups[i];
 
-/* XXX
- * Currently unused functions
- */
+		if (!symtable_contains(program->symtable, fixup->name)) {
+			COMPILE_ERROR(as, fixup->line, "Undefined label \"%s\".\n",
+					fixup->name);
+		}
+		address	= symtable_get_address(program->symtable, fixup->name);
+		word	= fixup->in_text ? &program->text[fixup->offset]
+					 : &program->data[fixup->offset];
+
+		if (!apply_fixup(word, fixup->kind, address,
+					text_start + fixup->offset + 1)) {
+			COMPILE_ERROR(as, fixup->line, "Label \"%s\" is too far "
+				"away for beq (%d words).\n", fixup->name,
+				address - (text_start + fixup->offset + 1));
+		}
+	}
+}
 
-#if 0
-void file_remove_blank_lines(FILE* output, FILE* input)
+/* Doubles the capacity of a dynamic array of `size`-byte elements */
+static void* grow(void* array, int* max, size_t size)
 {
-	char buffer[160 + 1];
-
-	while (fgets(buffer, sizeof buffer, input)) {
-		if (!is_empty_line(buffer)) {
-			fprintf(output, "%s", buffer);
-		}
+	*max	= *max == 0 ? 256 : 2 * *max;
+	array	= realloc(array, *max * size);
+	if (array == NULL) {
+		fprintf(stderr, "%s:%s: [!] Error: Failed to allocate "
+				"memory.\n", __FILE__, __func__);
+		exit(EXIT_FAILURE);
 	}
+	return array;
 }
-#endif
 
+static bool is_delimiter(char c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == '\r' || c == '\v'
+		|| c == '\f';
+}
@@ -4,36 +4,89 @@
 #define ASSEMBLER_H
 
 #include "symtable.h"
+#include "utility.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 /* PASSES
- * Pass 1:	Remove comments and trailing whitespace.
- * Pass 2:	Check so that there are valid registers.
- * Pass 3:	Store the addresses of all labels that end with ':'.
- * Pass 4:	Replace labels with their addresses from pass 2.
- * 		Also report symbol errors.
- * Pass 5:	Assemble data.
- * Pass 6:	Assemble text.
+ * The whole source is held in memory, and nothing is written back as text.
+ * Pass 1:	Split the source into tokens, in place. Comments are dropped.
+ * Pass 2:	Assemble each line into the data or the text segment. Labels
+ * 		are recorded along with the segment offset they label, and
+ * 		every use of a label leaves a fixup behind, since addresses in
+ * 		the text depend on the final size of the data.
+ * Pass 3:	Give the labels their addresses and patch them into the words
+ * 		that use them.
+ *
+ * An object file (see Common/object.h) is the program after pass 2: the
+ * labels and fixups are written out as they are, and pass 3 is left to the
+ * link tool, once it knows where each object ends up.
  */
 
-/* Removes comments and trailing whitespace */
-void	file_cleanup	(FILE* output, FILE* input);
+/* How the address of a label is patched into the word that uses it */
+typedef enum {
+	FIXUP_WORD,		/* .fill: the whole address */
+	FIXUP_SIMM,		/* addi, sw, lw: the low 7 bits */
+	FIXUP_LOW6,		/* lli, movi: the low 6 bits */
+	FIXUP_UIMM,		/* lui: the upper 10 bits */
+	FIXUP_BRANCH,		/* beq: the offset from the next instruction */
+} fixup_kind_t;
 
-/* Check so that there are no tokens that begin with 'r' and end with one or
- * more digits. */
-void	check_registers	(FILE* input);
+typedef struct	label_t		label_t;
+typedef struct	fixup_t		fixup_t;
+typedef struct	program_t	program_t;
 
-/* Search for labels in `input` and stores them in `symtable` */
-void	parse_labels	(FILE* input, symtable_t* symtable);
+struct label_t {
+	char*		name;
+	uint32_t	line;
+	bool		in_text;	/* Labels text, else data */
+	uint16_t	offset;		/* Within its segment */
+};
 
-/* Puts the binary representations of the labels in [output], as a replacement
- * of the symbolic labels in [input]. */
-void	replace_labels	(FILE* output, FILE* input, symtable_t* symtable);
+struct fixup_t {
+	char*		name;		/* Label used */
+	uint32_t	line;
+	bool		in_text;	/* Word is in text, else data */
+	uint16_t	offset;		/* Of the word, within its segment */
+	fixup_kind_t	kind;
+};
 
-/* Converts a "clean" file with assembly instructions to ones and zeros */
-void	assemble_data	(FILE* output, FILE* input);
-void	assemble_text	(FILE* output, FILE* input);
+struct program_t {
+	uint16_t	data[MEM_SIZE];		/* Assembled .fill words */
+	uint16_t	text[MEM_SIZE];		/* Assembled instructions */
+	uint16_t	data_size;
+	uint16_t	text_size;
+	symtable_t*	symtable;		/* Addresses of all labels */
+	label_t*	labels;			/* Left by assemble_object */
+	fixup_t*	fixups;
+	int		nbr_labels;
+	int		nbr_fixups;
+};
 
-#endif
+/* If true, the extension instructions (mul, divu, sll, ...) are compile
+ * errors, for code that has to run on plain RiSC-16. Set by --strict before
+ * anything is assembled. */
+extern bool	strict_risc16;
+
+/* Assembles `source`, a NUL-terminated assembly program read from
+ * `filename`, into `program`. The source is modified in place.
+ * `program->symtable` must be freed by calling symtable_free. Exits on the
+ * first compile error. Several programs may be assembled at once, on
+ * different threads. */
+void	assemble	(program_t* program, char source[],
+			 const char filename[]);
+
+/* Like assemble, but stops after pass 2: the symbol table is left empty,
+ * and the labels and fixups are kept in `program`, to be freed along with
+ * it. Their names point into `source`. */
+void	assemble_object	(program_t* program, char source[],
+			 const char filename[]);
 
+/* Patches `address` into `word` as a fixup of `kind` asks. `next` is the
+ * address of the instruction after `word`, which beq offsets are from.
+ * Returns false if a beq cannot reach `address`. */
+bool	apply_fixup	(uint16_t* word, fixup_kind_t kind, uint16_t address,
+			 uint16_t next);
+
+#endif
@@ -0,0 +1,296 @@
+/* driver.c */
+
+#define _POSIX_C_SOURCE	200809L	/* mkdir, getpid */
+
+#include "driver.h"
+#include "assembler.h"
+#include "output.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Part of every cache key. Bump it whenever the same source would assemble
+ * to something else, so that old entries are no longer found. */
+#define CACHE_VERSION		(1)
+
+#define FNV64_OFFSET_BASIS	(UINT64_C(14695981039346656037))
+#define FNV64_PRIME		(UINT64_C(1099511628211))
+
+typedef struct	driver_t	driver_t;
+
+struct driver_t {
+	char**		inputs;
+	int		nbr_inputs;
+	int		next;		/* Next input to assemble */
+	int		nbr_workers;	/* Started so far, for their ids */
+	format_t	format;
+	char*		cache_dir;	/* NULL for no cache */
+	bool*		cached;		/* Per input: copied from the cache */
+};
+
+static const char* extensions[] = {
+	[FORMAT_IMAGE]	= ".img",
+	[FORMAT_HEX]	= ".hex",
+	[FORMAT_OBJECT]	= ".o",
+};
+
+static void*	worker		(void* arg);
+static void	assemble_file	(driver_t* driver, program_t* program,
+				 int index, int worker_id);
+static uint64_t	hash_source	(const char* source, format_t format);
+static char*	output_name	(const char* input, format_t format);
+static char*	join		(const char* a, const char* b);
+static bool	copy_file	(const char* from, const char* to);
+static void	store		(const char* from, const char* to,
+				 int worker_id);
+
+void assemble_files(char* inputs[], int nbr_inputs, format_t format,
+		int nbr_threads, char* cache_dir)
+{
+	pthread_t*	threads;
+	driver_t	driver;
+	int		nbr_cached	= 0;
+
+	if (nbr_threads < 1)
+		nbr_threads = 1;
+	if (nbr_threads > nbr_inputs)
+		nbr_threads = nbr_inputs;
+
+	if (cache_dir != NULL && mkdir(cache_dir, 0777) != 0
+			&& errno != EEXIST) {
+		fprintf(stderr, "Failed to create the cache %s (%s)\n",
+				cache_dir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	driver.inputs		= inputs;
+	driver.nbr_inputs	= nbr_inputs;
+	driver.next		= 0;
+	driver.nbr_workers	= 0;
+	driver.format		= format;
+	driver.cache_dir	= cache_dir;
+	driver.cached		= calloc(nbr_inputs, sizeof *driver.cached);
+	threads			= malloc(nbr_threads * sizeof *threads);
+	if (driver.cached == NULL || threads == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nbr_threads; ++i) {
+		if (pthread_create(&threads[i], NULL, worker, &driver) != 0) {
+			fprintf(stderr, "Could not start worker thread %d.\n",
+					i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (int i = 0; i < nbr_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* Printed once all are done, so lines do not interleave */
+	for (int i = 0; i < nbr_inputs; ++i) {
+		char* output = output_name(inputs[i], format);
+
+		printf("%s -> %s%s\n", inputs[i], output,
+				driver.cached[i] ? " (cached)" : "");
+		nbr_cached += driver.cached[i];
+		free(output);
+	}
+	printf("%d files assembled, %d copied from the cache.\n",
+			nbr_inputs - nbr_cached, nbr_cached);
+
+	free(driver.cached);
+	free(threads);
+}
+
+/* Takes the next input until there are none left. Each worker has a
+ * program_t of its own, which is reused from one file to the next. */
+static void* worker(void* arg)
+{
+	driver_t*	driver		= arg;
+	int		worker_id;
+	int		index;
+
+	program_t* program = malloc(sizeof *program);
+	if (program == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	worker_id = __atomic_fetch_add(&driver->nbr_workers, 1,
+					__ATOMIC_RELAXED);
+	for (;;) {
+		index = __atomic_fetch_add(&driver->next, 1,
+					__ATOMIC_RELAXED);
+		if (index >= driver->nbr_inputs)
+			break;
+		assemble_file(driver, program, index, worker_id);
+	}
+
+	free(program);
+	return NULL;
+}
+
+static void assemble_file(driver_t* driver, program_t* program, int index,
+		int worker_id)
+{
+	char*		input	= driver->inputs[index];
+	char*		output	= output_name(input, driver->format);
+	char*		source	= read_file(input);
+	bool		has_sym	= driver->format != FORMAT_OBJECT;
+	char		key[16 + 4 + 1];
+	char*		entry		= NULL;	/* Output in the cache */
+	char*		entry_sym	= NULL;
+	char*		output_sym;
+	FILE*		file;
+
+	output_sym = join(output, ".sym");
+
+	/* A hit only counts if all of the output could be copied */
+	if (driver->cache_dir != NULL) {
+		sprintf(key, "/%016"PRIx64"%s", hash_source(source,
+				driver->format), extensions[driver->format]);
+		entry		= join(driver->cache_dir, key);
+		entry_sym	= join(entry, ".sym");
+
+		driver->cached[index] = copy_file(entry, output) && (!has_sym
+					|| copy_file(entry_sym, output_sym));
+		if (driver->cached[index]) {
+			free(entry);
+			free(entry_sym);
+			free(output_sym);
+			free(output);
+			free(source);
+			return;
+		}
+	}
+
+	if (driver->format == FORMAT_OBJECT) {
+		assemble_object(program, source, input);
+		file = safer_fopen(output, "wb");
+		write_object(file, program);
+		fclose(file);
+	} else {
+		assemble(program, source, input);
+		write_program(program, output,
+				driver->format == FORMAT_HEX);
+	}
+
+	/* The .sym goes in first: a cache entry is only complete, and found,
+	 * once its output is there */
+	if (entry != NULL) {
+		if (has_sym)
+			store(output_sym, entry_sym, worker_id);
+		store(output, entry, worker_id);
+		free(entry);
+		free(entry_sym);
+	}
+
+	symtable_free(program->symtable);
+	free(program->labels);
+	free(program->fixups);
+	free(output_sym);
+	free(output);
+	free(source);
+}
+
+/* 64-bit FNV-1a over what determines the output: the source, the format,
+ * --strict (a file it rejects must not be found) and the version of the
+ * assembler's output */
+static uint64_t hash_source(const char* source, format_t format)
+{
+	uint64_t	hash	= FNV64_OFFSET_BASIS;
+	char		prefix[32];
+
+	sprintf(prefix, "riscy %d %d %d\n", CACHE_VERSION, (int) format,
+			(int) strict_risc16);
+	for (const char* p = prefix; *p != '\0'; ++p) {
+		hash ^= (unsigned char) *p;
+		hash *= FNV64_PRIME;
+	}
+	for (const char* p = source; *p != '\0'; ++p) {
+		hash ^= (unsigned char) *p;
+		hash *= FNV64_PRIME;
+	}
+	return hash;
+}
+
+/* `name.s` becomes `name` followed by the extension of the format */
+static char* output_name(const char* input, format_t format)
+{
+	char*	base	= join(input, "");
+	char*	output;
+
+	base[strlen(base) - 2] = '\0';
+	output = join(base, extensions[format]);
+	free(base);
+
+	return output;
+}
+
+/* Returns `a` followed by `b`, which must be freed */
+static char* join(const char* a, const char* b)
+{
+	char* s = malloc(strlen(a) + strlen(b) + 1);
+	if (s == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(s, a);
+	strcat(s, b);
+	return s;
+}
+
+/* Returns false if `from` could not be read, or `to` written */
+static bool copy_file(const char* from, const char* to)
+{
+	char	buffer[8192];
+	size_t	count;
+	bool	ok	= true;
+	FILE*	in	= fopen(from, "rb");
+	FILE*	out;
+
+	if (in == NULL)
+		return false;
+
+	out = fopen(to, "wb");
+	if (out == NULL) {
+		fclose(in);
+		return false;
+	}
+
+	while ((count = fread(buffer, 1, sizeof buffer, in)) > 0) {
+		if (fwrite(buffer, 1, count, out) != count)
+			ok = false;
+	}
+	if (ferror(in))
+		ok = false;
+
+	fclose(in);
+	if (fclose(out) != 0)
+		ok = false;
+	return ok;
+}
+
+/* Copies an output into the cache. It is written under a name of its own and
+ * then renamed, so that other builds sharing the cache never see half of it.
+ * A cache that cannot be written to is not an error. */
+static void store(const char* from, const char* to, int worker_id)
+{
+	char temp[32];
+
+	sprintf(temp, ".%ld.%d", (long) getpid(), worker_id);
+	char* partial = join(to, temp);
+
+	if (!copy_file(from, partial) || rename(partial, to) != 0)
+		remove(partial);
+
+	free(partial);
+}
@@ -0,0 +1,32 @@
+/*
+ * driver.h
+ *
+ * Assembles many source files in one process (asm --batch), on a pool of
+ * threads. Each `name.s` is written next to itself, as `name.img` (and
+ * `name.img.sym`), `name.hex` (and `name.hex.sym`) or `name.o`.
+ *
+ * With a cache directory, the output of every file is also kept there under
+ * a hash of the file's contents and the output format, and a file whose hash
+ * is found is copied from the cache instead of being assembled again.
+ */
+
+#ifndef DRIVER_H
+#define DRIVER_H
+
+typedef enum {
+	FORMAT_IMAGE,		/* Common/image.h */
+	FORMAT_HEX,		/* Legacy text format */
+	FORMAT_OBJECT,		/* Common/object.h, for the link tool */
+} format_t;
+
+/**
+ * assemble_files
+ * 	Assembles `nbr_inputs` files in the given format, on `nbr_threads`
+ * 	threads, and prints one line per file. `cache_dir` may be NULL, for
+ * 	no cache; it is created if it does not exist. Exits on the first
+ * 	compile error.
+ */
+void	assemble_files	(char* inputs[], int nbr_inputs, format_t format,
+			 int nbr_threads, char* cache_dir);
+
+#endif
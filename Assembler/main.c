@@ -1,117 +1,94 @@
 /* main.c */
 
+#define _POSIX_C_SOURCE	200809L	/* sysconf */
+
 #include "assembler.h"
+#include "driver.h"
+#include "output.h"
 #include "utility.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /* TODO(Alexander)
  * 	Search for all TODOs in assembler.c.
  */
 
+static void	assemble_many	(int argc, char* argv[]);
+static void	check_extension	(char* filename);
+
 int main(int argc, char* argv[])
 {
-	char*	input_filename	= argv[1];	/* Assembly code to assemble */
-	char*	output_filename	= argv[2];	/* Output of assembled code */
-	char*	tmp_filename1	= "fbf7c968";	/* Temporary buffer file 1 */
-	char*	tmp_filename2	= "62fe98d2";	/* Temporary buffer file 2 */
-	FILE*	input		= NULL;	
-	FILE*	output		= NULL;		
-	FILE*	tmpfile1	= NULL;
-	FILE*	tmpfile2	= NULL;
-
-	symtable_t*	symtable;	/* Will be assigned to the return value
-					   of the parsed_labels function, to
-					   later be passed as a parameter into
-					   the replace_labels function.
-					   [!!!] This has to be freed by calling
-					   symtable_free. */
-
-	if (argc != 3) {
-		printf("Usage: assembler <input_filename> <output_filename>\n");
-		exit(EXIT_FAILURE);
+	char*		input_filename	= argv[1];	/* Assembly code */
+	char*		output_filename	= argv[2];	/* Assembled code */
+	char*		source		= NULL;		/* All of the input */
+	FILE*		output		= NULL;
+	bool		write_as_hex	= false;	/* Legacy text output */
+	bool		write_as_object	= false;	/* For the link tool */
+	bool		usage		= false;	/* Unknown option */
+	program_t*	program;			/* Assembled segments
+							   and their labels */
+
+	/* Options first: many files at once */
+	if (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+		assemble_many(argc, argv);
+
+	for (int i = 3; i < argc; ++i) {
+		if (streq(argv[i], "--hex"))
+			write_as_hex = true;
+		else if (streq(argv[i], "--object"))
+			write_as_object = true;
+		else if (streq(argv[i], "--strict"))
+			strict_risc16 = true;
+		else
+			usage = true;
 	}
-
-	/* File must end with ".s" */
-	char* ext = strrchr(input_filename, '.');
-	if (ext == '\0') {
-		fprintf(stderr, "Invalid filename \"%s\"; file must end with a "
-				".s extension.\n", input_filename);
-		exit(EXIT_FAILURE);
-	} else if (!streq(".s", ext)) {
-		fprintf(stderr, "Invalid extension \"%s\"; file must end with a"
-				" .s extension.\n", ext);
+	if (argc < 3 || usage || (write_as_hex && write_as_object)) {
+		printf("Usage: assembler <input_filename> <output_filename> "
+			"[--hex | --object] [--strict]\n"
+			"       assembler [--hex | --object] [--strict] "
+			"[--threads=N] [--cache=DIR] --batch "
+			"<input_filename>...\n");
 		exit(EXIT_FAILURE);
 	}
 
+	check_extension(input_filename);
+
 	printf( "\n========================================================\n"
 		"Starting assembler.\n"
 		"========================================================\n\n");
 
-	/* Open files for [file_cleanup] */
-	input		= safer_fopen(input_filename, "r");
-	tmpfile1	= safer_fopen(tmp_filename1, "w");
-
-	/* Make the file easier to parse by removing all comments,
-	 * empty lines and whitespace */
-	printf("Start : file_cleanup\n");
-	file_cleanup(tmpfile1, input);
-	printf("End   : file_cleanup\n\n");
-
-	/* First temporary file should now be read from instead of written to */
-	fclose(tmpfile1);
-	tmpfile1 = safer_fopen(tmp_filename1, "r");
-
-	printf("Start : check_register\n");
-	check_registers(tmpfile1);
-	printf("End   : check_register\n");
-
-	/* Scan for labels and store their respective addresses */
-	symtable = symtable_init();
-	printf("Start : parse_labels\n");
-	parse_labels(tmpfile1, symtable);
-	printf("End   : parse_labels\n\n");
-
-	/* Tedious to read from and write to the first temporary file at the
-	 * same time. Open a second temporary file to write to instead. */
-	tmpfile2 = safer_fopen(tmp_filename2, "w");
-
-	/* Replace all labels with their binary addressed */
-	printf("Start : replace_labels\n");
-	replace_labels(tmpfile2, tmpfile1, symtable);
-	printf("End   : replace_labels\n\n");
-
-	/* Reopen tmpfile2 for reading, and open the user output file for
-	 * writing. */
-	fclose(tmpfile2);
-	tmpfile2 = safer_fopen(tmp_filename2, "r");
-	output = safer_fopen(output_filename, "w");
-
-	/* Assemble the .fill directives to binary */
-	printf("Start : assemble_data.\n");
-	assemble_data(output, tmpfile2);
-	printf("End   : assemble_data.\n\n");
-
-	/* Close [output] for writing, repoen it for appending (the data). */
-	fclose(output);
-	output = safer_fopen(output_filename, "a");
-
-	/* Assemble the instructions to binary */
-	printf("Start : assemble_text.\n");
-	assemble_text(output, tmpfile2);
-	printf("End   : assemble_text.\n\n");
-
-	/* Done with the assembly. Close all files and free all memory. */
-	remove(tmp_filename1);
-	remove(tmp_filename2);
-	fclose(input);
-	fclose(tmpfile1);
-	fclose(tmpfile2);
-	fclose(output);
-
-	symtable_free(symtable);
+	program = malloc(sizeof *program);
+	if (program == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Read the source once, and assemble it in memory */
+	source = read_file(input_filename);
+
+	if (write_as_object) {
+		/* Leave the labels, and their uses, to the link tool */
+		assemble_object(program, source, input_filename);
+		output = safer_fopen(output_filename, "wb");
+		write_object(output, program);
+		fclose(output);
+		printf("%d labels and %d uses of labels left to link.\n",
+				program->nbr_labels, program->nbr_fixups);
+	} else {
+		assemble(program, source, input_filename);
+		symtable_print(program->symtable);
+		write_program(program, output_filename, write_as_hex);
+	}
+
+	/* Done with the assembly. Free all memory. */
+	symtable_free(program->symtable);
+	free(program->labels);
+	free(program->fixups);
+	free(program);
+	free(source);
 
 	printf( "\n========================================================\n"
 		"Exiting assembler.\n"
@@ -120,3 +97,56 @@ int main(int argc, char* argv[])
 	exit(EXIT_SUCCESS);
 }
 
+/* asm [--hex | --object] [--strict] [--threads=N] [--cache=DIR]
+ *     --batch <inputs>... */
+static void assemble_many(int argc, char* argv[])
+{
+	format_t	format		= FORMAT_IMAGE;
+	char*		cache_dir	= NULL;
+	int		nbr_threads	= sysconf(_SC_NPROCESSORS_ONLN);
+	int		i;
+
+	for (i = 1; i < argc && !streq(argv[i], "--batch"); ++i) {
+		if (streq(argv[i], "--hex"))
+			format = FORMAT_HEX;
+		else if (streq(argv[i], "--object"))
+			format = FORMAT_OBJECT;
+		else if (streq(argv[i], "--strict"))
+			strict_risc16 = true;
+		else if (!strncmp(argv[i], "--threads=", 10))
+			nbr_threads = atoi(argv[i] + 10);
+		else if (!strncmp(argv[i], "--cache=", 8))
+			cache_dir = argv[i] + 8;
+		else
+			break;
+	}
+
+	if (i + 1 >= argc || !streq(argv[i], "--batch")) {
+		printf("Usage: assembler [--hex | --object] [--strict] "
+			"[--threads=N] [--cache=DIR] --batch "
+			"<input_filename>...\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int j = i + 1; j < argc; ++j)
+		check_extension(argv[j]);
+
+	assemble_files(&argv[i + 1], argc - i - 1, format, nbr_threads,
+			cache_dir);
+	exit(EXIT_SUCCESS);
+}
+
+/* File must end with ".s" */
+static void check_extension(char* filename)
+{
+	char* ext = strrchr(filename, '.');
+	if (ext == NULL) {
+		fprintf(stderr, "Invalid filename \"%s\"; file must end with a "
+				".s extension.\n", filename);
+		exit(EXIT_FAILURE);
+	} else if (!streq(".s", ext)) {
+		fprintf(stderr, "Invalid extension \"%s\"; file must end with a"
+				" .s extension.\n", ext);
+		exit(EXIT_FAILURE);
+	}
+}
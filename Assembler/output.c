@@ -0,0 +1,213 @@
+/* output.c */
+
+#include "output.h"
+#include "image.h"
+#include "object.h"
+#include "utility.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void	write_bytes	(FILE* output, const uint8_t* bytes,
+				 size_t size);
+static uint32_t	write_words	(FILE* output, const uint16_t words[],
+				 uint16_t size, uint32_t checksum);
+
+void write_program(const program_t* program, char* output_filename,
+		bool write_as_hex)
+{
+	FILE* output;
+
+	/* Write the data followed by the text */
+	if (write_as_hex) {
+		output = safer_fopen(output_filename, "w");
+		write_hex(output, program->data, program->data_size,
+				program->text, program->text_size);
+	} else {
+		output = safer_fopen(output_filename, "wb");
+		write_image(output, program->data, program->data_size,
+				program->text, program->text_size);
+	}
+	fclose(output);
+
+	/* Write the labels next to the output, for the VM's profiler */
+	char* symbol_filename = malloc(strlen(output_filename) + 4 + 1);
+	if (symbol_filename == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(symbol_filename, "%s.sym", output_filename);
+	FILE* symbol_file = safer_fopen(symbol_filename, "w");
+	symtable_write(program->symtable, symbol_file);
+	fclose(symbol_file);
+	free(symbol_filename);
+}
+
+void write_image(FILE* output, const uint16_t data[], uint16_t data_size,
+		const uint16_t text[], uint16_t text_size)
+{
+	uint8_t		header[IMAGE_HEADER_SIZE]	= {0};
+	uint8_t		segments[2][IMAGE_SEGMENT_SIZE]	= {{0}};
+	uint32_t	offset;
+	uint32_t	checksum;
+
+	/* Data is loaded right after the data header at address 0, and text
+	 * right after the text header that follows the data. */
+	offset = IMAGE_HEADER_SIZE + sizeof segments;
+	image_put16(&segments[0][0], IMAGE_SEGMENT_DATA);
+	image_put16(&segments[0][2], 1);
+	image_put16(&segments[0][4], data_size);
+	image_put32(&segments[0][8], offset);
+
+	offset += 2 * data_size;
+	image_put16(&segments[1][0], IMAGE_SEGMENT_TEXT);
+	image_put16(&segments[1][2], data_size + 2);
+	image_put16(&segments[1][4], text_size);
+	image_put32(&segments[1][8], offset);
+
+	/* The checksum is only known once the words are written */
+	write_bytes(output, header, sizeof header);
+	write_bytes(output, &segments[0][0], sizeof segments);
+	checksum = write_words(output, data, data_size, IMAGE_CHECKSUM_INIT);
+	checksum = write_words(output, text, text_size, checksum);
+
+	header[0] = IMAGE_MAGIC[0];
+	header[1] = IMAGE_MAGIC[1];
+	header[2] = IMAGE_MAGIC[2];
+	header[3] = IMAGE_MAGIC[3];
+	image_put16(&header[4], IMAGE_VERSION);
+	image_put16(&header[6], IMAGE_FLAG_CHECKSUM);
+	image_put16(&header[8], 2);
+	image_put32(&header[12], checksum);
+
+	rewind(output);
+	write_bytes(output, header, sizeof header);
+}
+
+void write_hex(FILE* output, const uint16_t data[], uint16_t data_size,
+		const uint16_t text[], uint16_t text_size)
+{
+	char format[] = "0x%04x\n";
+
+	fprintf(output, format, data_size);
+	for (int i = 0; i < data_size; ++i) {
+		fprintf(output, format, data[i]);
+	}
+
+	fprintf(output, format, text_size);
+	for (int i = 0; i < text_size; ++i) {
+		fprintf(output, format, text[i]);
+	}
+}
+
+void write_object(FILE* output, const program_t* program)
+{
+	static const uint16_t kinds[] = {
+		[FIXUP_WORD]	= OBJECT_RELOC_WORD,
+		[FIXUP_SIMM]	= OBJECT_RELOC_SIMM,
+		[FIXUP_UIMM]	= OBJECT_RELOC_UIMM,
+		[FIXUP_BRANCH]	= OBJECT_RELOC_BRANCH,
+		[FIXUP_LOW6]	= OBJECT_RELOC_LOW6,
+	};
+
+	const label_t*	label;
+	const fixup_t*	fixup;
+	uint32_t	names_size	= 0;
+	uint32_t	name		= 0;	/* Offset of the next name */
+	size_t		size;
+	uint8_t*	bytes;
+	uint8_t*	p;
+
+	for (int i = 0; i < program->nbr_labels; ++i)
+		names_size += strlen(program->labels[i].name) + 1;
+	for (int i = 0; i < program->nbr_fixups; ++i)
+		names_size += strlen(program->fixups[i].name) + 1;
+
+	/* The checksum covers all of it, so the file is built in memory */
+	size = OBJECT_HEADER_SIZE
+		+ 2 * ((size_t) program->data_size + program->text_size)
+		+ (size_t) OBJECT_SYMBOL_SIZE * program->nbr_labels
+		+ (size_t) OBJECT_RELOC_SIZE * program->nbr_fixups
+		+ names_size;
+	bytes = calloc(size, 1);
+	if (bytes == NULL) {
+		fprintf(stderr, "%s:%s: [!] Error: Failed to allocate "
+				"memory.\n", __FILE__, __func__);
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(bytes, OBJECT_MAGIC, OBJECT_MAGIC_SIZE);
+	image_put16(bytes + 4, OBJECT_VERSION);
+	image_put16(bytes + 8, program->data_size);
+	image_put16(bytes + 10, program->text_size);
+	image_put32(bytes + 12, program->nbr_labels);
+	image_put32(bytes + 16, program->nbr_fixups);
+	image_put32(bytes + 20, names_size);
+
+	p = bytes + OBJECT_HEADER_SIZE;
+	for (int i = 0; i < program->data_size; ++i, p += 2)
+		image_put16(p, program->data[i]);
+	for (int i = 0; i < program->text_size; ++i, p += 2)
+		image_put16(p, program->text[i]);
+
+	/* Names are stored in the order of the symbols, then relocations */
+	for (int i = 0; i < program->nbr_labels; ++i) {
+		label = &program->labels[i];
+		image_put16(p, label->in_text ? OBJECT_SEGMENT_TEXT
+					      : OBJECT_SEGMENT_DATA);
+		image_put16(p + 2, label->offset);
+		image_put32(p + 4, name);
+		name	+= strlen(label->name) + 1;
+		p	+= OBJECT_SYMBOL_SIZE;
+	}
+	for (int i = 0; i < program->nbr_fixups; ++i) {
+		fixup = &program->fixups[i];
+		image_put16(p, fixup->in_text ? OBJECT_SEGMENT_TEXT
+					      : OBJECT_SEGMENT_DATA);
+		image_put16(p + 2, fixup->offset);
+		image_put16(p + 4, kinds[fixup->kind]);
+		image_put32(p + 8, name);
+		image_put32(p + 12, fixup->line);
+		name	+= strlen(fixup->name) + 1;
+		p	+= OBJECT_RELOC_SIZE;
+	}
+
+	for (int i = 0; i < program->nbr_labels; ++i) {
+		strcpy((char*) p, program->labels[i].name);
+		p += strlen(program->labels[i].name) + 1;
+	}
+	for (int i = 0; i < program->nbr_fixups; ++i) {
+		strcpy((char*) p, program->fixups[i].name);
+		p += strlen(program->fixups[i].name) + 1;
+	}
+
+	image_put32(bytes + 24, image_checksum(IMAGE_CHECKSUM_INIT,
+			bytes + OBJECT_HEADER_SIZE, size - OBJECT_HEADER_SIZE));
+
+	write_bytes(output, bytes, size);
+	free(bytes);
+}
+
+static void write_bytes(FILE* output, const uint8_t* bytes, size_t size)
+{
+	if (fwrite(bytes, 1, size, output) != size) {
+		fprintf(stderr, "%s:%s: [!] Error: Failed to write output.\n",
+				__FILE__, __func__);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Writes `words` little-endian and returns the updated checksum */
+static uint32_t write_words(FILE* output, const uint16_t words[],
+		uint16_t size, uint32_t checksum)
+{
+	uint8_t bytes[2];
+
+	for (int i = 0; i < size; ++i) {
+		image_put16(bytes, words[i]);
+		write_bytes(output, bytes, sizeof bytes);
+		checksum = image_checksum(checksum, bytes, sizeof bytes);
+	}
+
+	return checksum;
+}
@@ -0,0 +1,37 @@
+/* output.h */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "assembler.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Writes the assembled program as a binary image, see Common/image.h */
+void	write_image	(FILE*		output,
+			 const uint16_t	data[],
+			 uint16_t	data_size,
+			 const uint16_t	text[],
+			 uint16_t	text_size);
+
+/* Writes the assembled program in the legacy text format: one "0x%04x" line
+ * per word, each segment preceded by a line holding its size. */
+void	write_hex	(FILE*		output,
+			 const uint16_t	data[],
+			 uint16_t	data_size,
+			 const uint16_t	text[],
+			 uint16_t	text_size);
+
+/* Writes an assembled program to `output_filename`, as an image or in the
+ * legacy text format, and its labels to `output_filename`.sym */
+void	write_program	(const program_t* program,
+			 char*		output_filename,
+			 bool		write_as_hex);
+
+/* Writes a program left by assemble_object as an object file, see
+ * Common/object.h */
+void	write_object	(FILE*		output,
+			 const program_t* program);
+
+#endif
@@ -6,37 +6,63 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_LABELS		(MEM_SIZE)
-#define MAX_LABEL_LENGTH	(80)
+#define INITIAL_SLOTS		(256)		/* A power of two */
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+
+#define FNV_OFFSET_BASIS	(UINT32_C(2166136261))
+#define FNV_PRIME		(UINT32_C(16777619))
 
 typedef struct entry_t entry_t;
+typedef struct block_t block_t;
 
+/* The entries are kept in the order they were added, for printing. The
+ * hash index is an open-addressing table with linear probing, which holds
+ * 1 + the position of an entry in `entries`, or 0 for an empty slot. It is
+ * kept at most half full. */
 struct symtable_t {
-	uint16_t	nbr_entries;
-	entry_t*	entries[MAX_LABELS];
+	entry_t*	entries;
+	uint32_t	nbr_entries;
+	uint32_t	max_entries;
+	uint32_t*	slots;
+	uint32_t	nbr_slots;
+	block_t*	arena;		/* Storage for the names */
 };
 
 struct entry_t {
-	char		name[MAX_LABEL_LENGTH + 1];
+	char*		name;		/* Interned in the arena */
+	uint32_t	hash;
 	uint16_t	address;
 };
 
+/* A chunk of the arena. Names are never freed one by one, so they are just
+ * packed one after the other, and all blocks are freed with the table. */
+struct block_t {
+	block_t*	next;
+	size_t		used;
+	size_t		size;
+	char		bytes[];
+};
+
+static void*	allocate	(size_t size);
+static uint32_t	hash_name	(const char* name);
+static int	find		(symtable_t* symtable, const char* name,
+				 uint32_t hash, uint32_t* slot);
+static char*	intern		(symtable_t* symtable, const char* name);
+static void	rehash		(symtable_t* symtable);
+
 symtable_t* symtable_init()
 {
 	symtable_t*	symtable;
-	
-	symtable = malloc(sizeof *symtable);
-	if (symtable == NULL) {
-		fprintf(stderr,
-			"%s:%s: [!] Error: Failed to allocate memory.\n",
-			__FILE__, __func__);
-		exit(EXIT_FAILURE);
-	}
 
-	symtable->nbr_entries = 0;
-	for (int i = 0; i < MAX_LABELS; ++i) {
-		symtable->entries[i] = NULL;
-	}
+	symtable		= allocate(sizeof *symtable);
+	symtable->entries	= NULL;
+	symtable->nbr_entries	= 0;
+	symtable->max_entries	= 0;
+	symtable->nbr_slots	= INITIAL_SLOTS;
+	symtable->slots		= allocate(INITIAL_SLOTS
+						* sizeof *symtable->slots);
+	symtable->arena		= NULL;
+	memset(symtable->slots, 0, INITIAL_SLOTS * sizeof *symtable->slots);
 
 	return symtable;
 }
@@ -44,6 +70,9 @@ symtable_t* symtable_init()
 void symtable_add(symtable_t* symtable, char* name, uint16_t address)
 {
 	entry_t*	entry;
+	uint32_t	hash;
+	uint32_t	slot;
+	bool		known;
 
 	if (symtable == NULL || name == NULL) {
 		fprintf(stderr,
@@ -52,26 +81,43 @@ void symtable_add(symtable_t* symtable, char* name, uint16_t address)
 		exit(EXIT_FAILURE);
 	}
 
-	entry = malloc(sizeof *entry);
-	if (entry == NULL) {
-		fprintf(stderr,
-			"%s:%s: [!] Error: Failed to allocate memory.\n",
-			__FILE__, __func__);
-		exit(EXIT_FAILURE);
+	if (symtable->nbr_entries == symtable->max_entries) {
+		symtable->max_entries = symtable->max_entries == 0 ? 64
+					: 2 * symtable->max_entries;
+		symtable->entries = realloc(symtable->entries,
+			symtable->max_entries * sizeof *symtable->entries);
+		if (symtable->entries == NULL) {
+			fprintf(stderr,
+				"%s:%s: [!] Error: Failed to allocate memory.\n",
+				__FILE__, __func__);
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	strcpy(entry->name, name);
-	entry->address = address;
+	/* A name added twice keeps its first address, as lookups go */
+	hash	= hash_name(name);
+	known	= find(symtable, name, hash, &slot) >= 0;
 
-	symtable->entries[symtable->nbr_entries++] = entry;
+	entry		= &symtable->entries[symtable->nbr_entries];
+	entry->name	= intern(symtable, name);
+	entry->hash	= hash;
+	entry->address	= address;
+	symtable->nbr_entries += 1;
+
+	if (!known) {
+		symtable->slots[slot] = symtable->nbr_entries;
+		if (2 * symtable->nbr_entries > symtable->nbr_slots)
+			rehash(symtable);
+	}
 }
 
 uint16_t symtable_get_address(symtable_t* symtable, char* name)
 {
-	for (int i = 0; i < symtable->nbr_entries; ++i) {
-		if (streq(name, symtable->entries[i]->name)) {
-			return symtable->entries[i]->address;
-		}
+	uint32_t	slot;
+	int		index = find(symtable, name, hash_name(name), &slot);
+
+	if (index >= 0) {
+		return symtable->entries[index].address;
 	}
 	printf("[!] %s: %s: Could not find label \"%s\".\n",
 		__FILE__, __func__, name);
@@ -80,12 +126,9 @@ uint16_t symtable_get_address(symtable_t* symtable, char* name)
 
 bool symtable_contains(symtable_t* symtable, char* name)
 {
-	for (int i = 0; i < symtable->nbr_entries; ++i) {
-		if (streq(name, symtable->entries[i]->name)) {
-			return true;
-		}
-	}
-	return false;
+	uint32_t slot;
+
+	return find(symtable, name, hash_name(name), &slot) >= 0;
 }
 
 void symtable_print(symtable_t* symtable)
@@ -98,24 +141,135 @@ void symtable_print(symtable_t* symtable)
 	}
 
 	printf("Printing entries:\n");
-	for (int i = 0; i < symtable->nbr_entries; ++i) {
+	for (uint32_t i = 0; i < symtable->nbr_entries; ++i) {
 		printf(
 			"&%s\t= 0x%04x\n",
-			symtable->entries[i]->name,
-			symtable->entries[i]->address
+			symtable->entries[i].name,
+			symtable->entries[i].address
 		);
 	}
 }
 
+void symtable_write(symtable_t* symtable, FILE* output)
+{
+	for (uint32_t i = 0; i < symtable->nbr_entries; ++i) {
+		fprintf(output, "0x%04x %s\n",
+			symtable->entries[i].address,
+			symtable->entries[i].name);
+	}
+}
+
 void symtable_free(symtable_t* symtable)
 {
-	for (int i = 0; i < symtable->nbr_entries; ++i) {
-		if (symtable->entries[i] != NULL) {
-			free(symtable->entries[i]);
+	block_t* next;
+
+	if (symtable == NULL) {
+		return;
+	}
+	while (symtable->arena != NULL) {
+		next = symtable->arena->next;
+		free(symtable->arena);
+		symtable->arena = next;
+	}
+	free(symtable->entries);
+	free(symtable->slots);
+	free(symtable);
+}
+
+static void* allocate(size_t size)
+{
+	void* p = malloc(size);
+	if (p == NULL) {
+		fprintf(stderr,
+			"%s:%s: [!] Error: Failed to allocate memory.\n",
+			__FILE__, __func__);
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/* 32-bit FNV-1a */
+static uint32_t hash_name(const char* name)
+{
+	uint32_t hash = FNV_OFFSET_BASIS;
+
+	for (; *name != '\0'; ++name) {
+		hash ^= (unsigned char) *name;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/* Returns the position of `name` in the entries, or -1 if it is not there.
+ * Either way, `slot` is left at the slot where the search stopped. */
+static int find(symtable_t* symtable, const char* name, uint32_t hash,
+		uint32_t* slot)
+{
+	uint32_t	mask	= symtable->nbr_slots - 1;
+	uint32_t	i	= hash & mask;
+	entry_t*	entry;
+
+	while (symtable->slots[i] != 0) {
+		entry = &symtable->entries[symtable->slots[i] - 1];
+		if (entry->hash == hash && streq(entry->name, name)) {
+			*slot = i;
+			return symtable->slots[i] - 1;
 		}
+		i = (i + 1) & mask;
 	}
-	if (symtable != NULL) {
-		free(symtable);
+
+	*slot = i;
+	return -1;
+}
+
+/* Copies `name` into the arena */
+static char* intern(symtable_t* symtable, const char* name)
+{
+	size_t		size	= strlen(name) + 1;
+	block_t*	block	= symtable->arena;
+	char*		copy;
+
+	if (block == NULL || block->size - block->used < size) {
+		block		= allocate(sizeof *block + (size
+					> ARENA_BLOCK_SIZE ? size
+					: ARENA_BLOCK_SIZE));
+		block->next	= symtable->arena;
+		block->used	= 0;
+		block->size	= size > ARENA_BLOCK_SIZE ? size
+						: ARENA_BLOCK_SIZE;
+		symtable->arena	= block;
 	}
+
+	copy		= block->bytes + block->used;
+	block->used	+= size;
+	memcpy(copy, name, size);
+
+	return copy;
 }
 
+/* Doubles the number of slots and puts every indexed entry back */
+static void rehash(symtable_t* symtable)
+{
+	uint32_t*	old_slots	= symtable->slots;
+	uint32_t	old_nbr_slots	= symtable->nbr_slots;
+	uint32_t	mask;
+	uint32_t	i;
+
+	symtable->nbr_slots	= 2 * old_nbr_slots;
+	symtable->slots		= allocate(symtable->nbr_slots
+						* sizeof *symtable->slots);
+	memset(symtable->slots, 0, symtable->nbr_slots
+					* sizeof *symtable->slots);
+	mask = symtable->nbr_slots - 1;
+
+	for (uint32_t j = 0; j < old_nbr_slots; ++j) {
+		if (old_slots[j] == 0)
+			continue;
+		i = symtable->entries[old_slots[j] - 1].hash & mask;
+		while (symtable->slots[i] != 0)
+			i = (i + 1) & mask;
+		symtable->slots[i] = old_slots[j];
+	}
+
+	free(old_slots);
+}
@@ -3,7 +3,8 @@
  *
  * A symbol table in which symbolic labels found in the assembly program are
  * stored. This table only consist of pairs: the name of the symbol, and its
- * address.
+ * address. Lookups go through a hash index, so they take constant time no
+ * matter how many labels a program has.
  */
 
 #ifndef SYMTABLE_H
@@ -11,6 +12,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+
+#define MAX_LABEL_LENGTH	(80)
 
 typedef struct symtable_t symtable_t;
 
@@ -67,6 +71,19 @@ bool symtable_contains (symtable_t* symtable, char* name);
  */
 void symtable_print (symtable_t* symtable);
 
+/**
+ * symtable_write
+ * 	Writes the entire symbol table to `output`, one symbol per line, in the
+ * 	order the symbols were added:
+ * 		0x0007 loop
+ * 		0x000c end
+ * 	This is the ".sym" file written next to the assembled program, which
+ * 	the VM reads to put labels on its profiles.
+ * 	@param `symtable`	A pointer to the symbol table under operation.
+ * 	@param `output`		The file to write to.
+ */
+void symtable_write (symtable_t* symtable, FILE* output);
+
 /**
  * symtable_free
  * 	Deconstructs a symbol table created with symtable_init.
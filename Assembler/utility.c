@@ -21,7 +21,7 @@ FILE* safer_fopen(char* filename, char* action)
 			fprintf(stderr, "Failed to open %s for reading (%s)\n",
 					filename, strerror(errno));
 		}
-		if (strcmp(action, "w") == 0) {
+		if (action[0] == 'w') {
 			fprintf(stderr, "Failed to open %s for writing (%s)\n",
 					filename, strerror(errno));
 		}
@@ -30,6 +30,41 @@ FILE* safer_fopen(char* filename, char* action)
 	return tmp;
 }
 
+/* Reads all of `filename` into a NUL-terminated buffer, which must be freed */
+char* read_file(char* filename)
+{
+	FILE*	file	= safer_fopen(filename, "r");
+	char*	buffer	= NULL;
+	size_t	size	= 0;
+	size_t	max	= 0;
+	size_t	count;
+
+	do {
+		if (size + 1 >= max) {
+			max	= max == 0 ? 4096 : 2 * max;
+			buffer	= realloc(buffer, max);
+			if (buffer == NULL) {
+				fprintf(stderr, "%s:%s: [!] Error: Failed to "
+					"allocate memory.\n", __FILE__,
+					__func__);
+				exit(EXIT_FAILURE);
+			}
+		}
+		count	= fread(buffer + size, 1, max - size - 1, file);
+		size	+= count;
+	} while (count > 0);
+
+	if (ferror(file)) {
+		fprintf(stderr, "Failed to read %s (%s)\n", filename,
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fclose(file);
+
+	buffer[size] = '\0';
+	return buffer;
+}
+
 uint16_t get_reg_num(const char* reg)
 {
 	if (strlen(reg) != 2) {
@@ -39,6 +74,17 @@ uint16_t get_reg_num(const char* reg)
 	return reg[1] - '0';
 }
 
+/* Returns the opcode of an instruction mnemonic, or -1 if it is not one */
+int get_opcode(const char* name)
+{
+	for (int i = 0; i < NBR_INSTRUCTIONS; ++i) {
+		if (streq(name, instructions[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 char* dec_to_bin(char* bin, int dec, int nbr_bits)
 {
 	int i;
@@ -66,30 +112,6 @@ uint16_t str_to_int(const char* str)
 	return (uint16_t) ret;
 }
 
-void remove_comments(char* line)
-{
-	int i;
-	for (i = 0; line[i] != '\0'; ++i) {
-		if (line[i] == '#') {
-			break;
-		}
-	}
-	line[i]		= '\n';
-	line[i + 1]	= '\0';
-}
-
-void remove_trailing_whitespace(char* line)
-{
-	char* end = line + strlen(line) - 1;
-
-	while (isspace(*end)) {
-		*end = '\0';
-		--end;
-	}
-	*(end + 1) = '\n';
-	*(end + 2) = '\0';
-}
-
 char strlast(const char* str)
 {
 	return str[strlen(str) - 1];
@@ -139,7 +161,7 @@ bool is_hex(const char* str)
 		return false;
 	}
 	for (unsigned long i = 2; i < strlen(str); ++i) {
-		if ( ! (isdigit(str[i]) || ('a' <= str[i] && str[i] <= 'f')) ) {
+		if (!isxdigit((unsigned char) str[i])) {
 			return false;
 		}
 	}
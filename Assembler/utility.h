@@ -12,14 +12,13 @@
 #define NBR_INSTRUCTIONS	(8)
 
 FILE*	safer_fopen			(char* filename, char* action);
+char*	read_file			(char* filename);
 
 uint16_t	get_reg_num		(const char* name);
+int		get_opcode		(const char* name);
 uint16_t	str_to_int		(const char* str);
 char*		dec_to_bin		(char* bin, int dec, int nbr_bits);
 
-void	remove_comments			(char* line);
-void	remove_trailing_whitespace	(char* line);
-
 char	strlast				(const char* str);
 bool	streq				(const char* s1, const char* s2);
 bool	is_dec				(const char* str);
@@ -0,0 +1,168 @@
+/* bench.c */
+
+#define _POSIX_C_SOURCE	200809L	/* clock_gettime */
+
+#include "jit.h"
+#include "memory.h"
+#include "vm.h"
+#include "vm_internal.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_REPEAT	(5)
+#define RESULT_ADDRESS	(1)	/* First data word, `result` by convention */
+
+typedef uint64_t	(*engine_run_t)	(RiscyVM* vm);
+typedef struct		engine_t	engine_t;
+
+struct engine_t {
+	const char*	name;
+	engine_run_t	run;
+};
+
+static uint64_t	run_step	(RiscyVM* vm);
+static uint64_t	run_interp	(RiscyVM* vm);
+static uint64_t	run_jit		(RiscyVM* vm);
+static double	now		(void);
+static void	program_name	(char* buf, size_t size, const char* path);
+
+/* "step" is the VM_fetch, VM_decode and VM_execute loop of the public API,
+ * "interp" is VM_run and "jit" is JIT_run. */
+static const engine_t engines[] = {
+	{ "step",	run_step	},
+	{ "interp",	run_interp	},
+	{ "jit",	run_jit		},
+};
+
+#define NBR_ENGINES	((int) (sizeof engines / sizeof engines[0]))
+
+/* Runs each program to completion on each engine, `repeat` times, and prints
+ * one tab-separated line per program and engine with the best time. Every
+ * run starts from a fresh clone of the loaded program, so loading is not
+ * timed. Exits with failure if a program does not halt or if the engines
+ * disagree on its result. */
+int main(int argc, char* argv[])
+{
+	int		repeat	= DEFAULT_REPEAT;
+	int		first	= 1;
+	char		name[64];
+
+	if (argc > 1 && !strncmp(argv[1], "--repeat=", 9)) {
+		repeat	= atoi(argv[1] + 9);
+		first	= 2;
+	}
+	if (first >= argc || repeat < 1) {
+		printf("Usage: bench [--repeat=N] <program> ...\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("program\tengine\tinstructions\tseconds\tmips\tresult\n");
+
+	for (int i = first; i < argc; ++i) {
+		RiscyVM*	prototype	= VM_init(argv[i]);
+		uint16_t	expected	= 0;
+
+		program_name(name, sizeof name, argv[i]);
+
+		for (int e = 0; e < NBR_ENGINES; ++e) {
+			double		best	= -1;
+			uint64_t	steps	= 0;
+			uint16_t	result	= 0;
+
+			for (int r = 0; r < repeat; ++r) {
+				vm_error_t	error;
+				RiscyVM*	vm	= VM_clone(prototype,
+								&error);
+				double		start	= now();
+				double		seconds;
+
+				if (vm == NULL) {
+					fprintf(stderr, "%s\n",
+						VM_strerror(error));
+					exit(EXIT_FAILURE);
+				}
+
+				steps	= engines[e].run(vm);
+				seconds	= now() - start;
+
+				if (VM_is_running(vm)) {
+					fprintf(stderr, "%s did not halt.\n",
+							argv[i]);
+					exit(EXIT_FAILURE);
+				}
+				result = mem_read(vm, RESULT_ADDRESS);
+				VM_shutdown(vm);
+
+				if (best < 0 || seconds < best)
+					best = seconds;
+			}
+
+			if (e == 0) {
+				expected = result;
+			} else if (result != expected) {
+				fprintf(stderr, "%s: %s gave %"PRIu16", %s "
+					"gave %"PRIu16".\n", argv[i],
+					engines[e].name, result,
+					engines[0].name, expected);
+				exit(EXIT_FAILURE);
+			}
+
+			printf("%s\t%s\t%"PRIu64"\t%.6f\t%.2f\t%"PRIu16"\n",
+				name, engines[e].name, steps, best,
+				best > 0 ? steps / best / 1e6 : 0.0, result);
+			fflush(stdout);
+		}
+
+		VM_shutdown(prototype);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static uint64_t run_step(RiscyVM* vm)
+{
+	uint64_t steps = 0;
+
+	while (VM_is_running(vm)) {
+		VM_fetch(vm);
+		VM_decode(vm);
+		VM_execute(vm);
+		steps += 1;
+	}
+	return steps;
+}
+
+static uint64_t run_interp(RiscyVM* vm)
+{
+	return VM_run(vm, UINT64_MAX);
+}
+
+static uint64_t run_jit(RiscyVM* vm)
+{
+	return JIT_run(vm, UINT64_MAX);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* "Bench/sort.img" -> "sort" */
+static void program_name(char* buf, size_t size, const char* path)
+{
+	const char*	base	= strrchr(path, '/');
+	const char*	dot;
+
+	base	= base != NULL ? base + 1 : path;
+	dot	= strrchr(base, '.');
+	snprintf(buf, size, "%.*s", (int) (dot != NULL ? dot - base
+						: (long) strlen(base)), base);
+}
@@ -0,0 +1,76 @@
+# div.s
+# Divides n = 150 * i by every d = j, 1 <= i, j <= 200, with a restoring
+# long division routine, and sums the quotients and remainders modulo 2^16.
+
+result:	.fill	0			# Sum of the quotients and remainders
+i:	.fill	1
+j:	.fill	0
+n:	.fill	0			# 150 * i
+count:	.fill	0			# Bits left in the current division
+max:	.fill	200
+&div:	.fill	div
+
+outer:	lw	r1, r0, n
+	addi	r1, r1, 50
+	addi	r1, r1, 50
+	addi	r1, r1, 50
+	sw	r1, r0, n		# n += 150
+	addi	r2, r0, 1
+	sw	r2, r0, j		# j = 1
+inner:	lw	r1, r0, n
+	lw	r2, r0, j
+	lw	r3, r0, &div
+	jalr	r6, r3			# r3 = n / j, r4 = n % j
+	lw	r1, r0, result
+	add	r1, r1, r3
+	add	r1, r1, r4
+	sw	r1, r0, result		# result += n / j + n % j
+	lw	r2, r0, j
+	lw	r1, r0, max
+	beq	r1, r2, next
+	addi	r2, r2, 1
+	sw	r2, r0, j		# j += 1
+	beq	r0, r0, inner
+next:	lw	r2, r0, i
+	beq	r1, r2, done
+	addi	r2, r2, 1
+	sw	r2, r0, i		# i += 1
+	beq	r0, r0, outer
+
+# div(r1 = n, r2 = d) -> r3 = n / d, r4 = n % d, for n, d < 0x8000.
+# Clobbers r1 and r5.
+div:	addi	r7, r7, -1
+	sw	r6, r7, 0		# Free r6 for use as a temporary
+	addi	r3, r0, 0		# quotient = 0
+	addi	r4, r0, 0		# remainder = 0
+	addi	r5, r0, 15
+	sw	r5, r0, count
+	add	r1, r1, r1		# Bit 15 of n is always 0
+dloop:	lui	r5, 0x8000
+	nand	r5, r5, r1
+	nand	r5, r5, r5		# r5 = n & 0x8000
+	add	r4, r4, r4		# remainder <<= 1
+	beq	r5, r0, dzero
+	addi	r4, r4, 1		# Shift the top bit of n in
+dzero:	add	r1, r1, r1		# n <<= 1
+	add	r3, r3, r3		# quotient <<= 1
+	nand	r5, r2, r2
+	addi	r5, r5, 1
+	add	r5, r4, r5		# r5 = remainder - d
+	lui	r6, 0x8000
+	nand	r6, r6, r5
+	nand	r6, r6, r6		# r6 = sign of remainder - d
+	beq	r6, r0, dsub
+	beq	r0, r0, dnext
+dsub:	add	r4, r5, r0		# remainder -= d
+	addi	r3, r3, 1		# quotient |= 1
+dnext:	lw	r5, r0, count
+	addi	r5, r5, -1
+	sw	r5, r0, count
+	beq	r5, r0, ddone
+	beq	r0, r0, dloop
+ddone:	lw	r6, r7, 0
+	addi	r7, r7, 1
+	jalr	r0, r6
+
+done:	add	r0, r0, r0		# Halt
@@ -0,0 +1,37 @@
+# fib.s
+# Computes fib(26) modulo 2^16 by naive recursion, with a stack frame per
+# call and calls through jalr r6.
+
+result:	.fill	0			# fib(26)
+&fib:	.fill	fib
+
+	addi	r1, r0, 26
+	lw	r4, r0, &fib
+	jalr	r6, r4			# r2 = fib(26)
+	sw	r2, r0, result
+	beq	r0, r0, done
+
+# fib(r1 = n) -> r2. Clobbers r1, r3 and r4.
+fib:	addi	r7, r7, -3		# Frame: return address, n, fib(n - 1)
+	sw	r6, r7, 0
+	sw	r1, r7, 1
+	beq	r1, r0, base		# fib(0) = 0
+	addi	r3, r0, 1
+	beq	r1, r3, base		# fib(1) = 1
+	addi	r1, r1, -1
+	lw	r4, r0, &fib
+	jalr	r6, r4			# r2 = fib(n - 1)
+	sw	r2, r7, 2
+	lw	r1, r7, 1
+	addi	r1, r1, -2
+	lw	r4, r0, &fib
+	jalr	r6, r4			# r2 = fib(n - 2)
+	lw	r3, r7, 2
+	add	r2, r2, r3
+	beq	r0, r0, return
+base:	add	r2, r1, r0
+return:	lw	r6, r7, 0
+	addi	r7, r7, 3
+	jalr	r0, r6
+
+done:	add	r0, r0, r0		# Halt
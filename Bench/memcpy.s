@@ -0,0 +1,71 @@
+# memcpy.s
+# Copies a block of 4096 words from 0x4000 to 0x6000 and back again, 400
+# times, four words per iteration. result is the sum of the block at the
+# end, modulo 2^16.
+
+result:	.fill	0			# Sum of the words of the block
+rounds:	.fill	400
+&copy:	.fill	copy
+
+# Fill the block with 1, 4, 7, ...
+	lui	r1, 0x4000
+	addi	r2, r0, 1
+	lui	r3, 0x5000		# r3 = &block[4096]
+	nand	r3, r3, r3
+	addi	r3, r3, 1		# r3 = -&block[4096]
+fill:	sw	r2, r1, 0
+	addi	r2, r2, 3
+	addi	r1, r1, 1
+	add	r4, r1, r3
+	beq	r4, r0, round
+	beq	r0, r0, fill
+
+round:	lui	r1, 0x4000
+	lui	r2, 0x6000
+	lw	r5, r0, &copy
+	jalr	r6, r5			# Copy 0x4000 to 0x6000
+	lui	r1, 0x6000
+	lui	r2, 0x4000
+	lw	r5, r0, &copy
+	jalr	r6, r5			# Copy it back
+	lw	r1, r0, rounds
+	addi	r1, r1, -1
+	sw	r1, r0, rounds
+	beq	r1, r0, sum
+	beq	r0, r0, round
+
+sum:	lui	r1, 0x4000
+	lui	r3, 0x5000
+	nand	r3, r3, r3
+	addi	r3, r3, 1		# r3 = -&block[4096]
+	addi	r5, r0, 0
+sloop:	lw	r2, r1, 0
+	add	r5, r5, r2
+	addi	r1, r1, 1
+	add	r4, r1, r3
+	beq	r4, r0, store
+	beq	r0, r0, sloop
+store:	sw	r5, r0, result
+	beq	r0, r0, done
+
+# copy(r1 = source, r2 = destination) copies 4096 words. Clobbers r1 to r5.
+copy:	lui	r5, 0x1000
+	add	r5, r1, r5
+	nand	r5, r5, r5
+	addi	r5, r5, 1		# r5 = -(source + 4096)
+cloop:	lw	r3, r1, 0
+	lw	r4, r1, 1
+	sw	r3, r2, 0
+	sw	r4, r2, 1
+	lw	r3, r1, 2
+	lw	r4, r1, 3
+	sw	r3, r2, 2
+	sw	r4, r2, 3
+	addi	r1, r1, 4
+	addi	r2, r2, 4
+	add	r3, r1, r5
+	beq	r3, r0, cdone
+	beq	r0, r0, cloop
+cdone:	jalr	r0, r6
+
+done:	add	r0, r0, r0		# Halt
@@ -0,0 +1,44 @@
+# mul.s
+# Multiplies every pair (i, j), 0 <= i, j < 300, with a shift-and-add
+# routine and sums the products modulo 2^16.
+
+result:	.fill	0			# Sum of the products
+i:	.fill	0
+j:	.fill	0
+n:	.fill	300
+&mul:	.fill	mul
+
+outer:	sw	r0, r0, j		# j = 0
+inner:	lw	r1, r0, i
+	lw	r2, r0, j
+	lw	r3, r0, &mul
+	jalr	r6, r3			# r3 = i * j
+	lw	r1, r0, result
+	add	r1, r1, r3
+	sw	r1, r0, result		# result += i * j
+	lw	r2, r0, j
+	addi	r2, r2, 1
+	sw	r2, r0, j		# j += 1
+	lw	r1, r0, n
+	beq	r1, r2, next
+	beq	r0, r0, inner
+next:	lw	r2, r0, i
+	addi	r2, r2, 1
+	sw	r2, r0, i		# i += 1
+	beq	r1, r2, done
+	beq	r0, r0, outer
+
+# mul(r1 = a, r2 = b) -> r3 = a * b. Clobbers r1, r4 and r5.
+mul:	addi	r3, r0, 0		# product = 0
+	addi	r4, r0, 1		# bit = 1
+mloop:	nand	r5, r2, r4
+	nand	r5, r5, r5		# r5 = b & bit
+	beq	r5, r0, mskip
+	add	r3, r3, r1		# product += a
+mskip:	add	r1, r1, r1		# a <<= 1
+	add	r4, r4, r4		# bit <<= 1
+	beq	r4, r0, mdone		# All 16 bits done
+	beq	r0, r0, mloop
+mdone:	jalr	r0, r6
+
+done:	add	r0, r0, r0		# Halt
@@ -0,0 +1,51 @@
+# sieve.s
+# Runs the sieve of Eratosthenes over [2, 8000) 80 times, and counts the
+# primes found over all rounds modulo 2^16. The sieve lives in free memory
+# at 0x4000.
+
+result:	.fill	0			# Number of primes found
+rounds:	.fill	80
+negend:	.fill	-24384			# -(0x4000 + 8000)
+
+round:	lui	r1, 0x4000		# r1 = &sieve[0]
+	lw	r3, r0, negend		# r3 = -&sieve[8000]
+	lui	r4, 0x8000		# r4 = sign mask
+clear:	sw	r0, r1, 0
+	sw	r0, r1, 1
+	sw	r0, r1, 2
+	sw	r0, r1, 3
+	addi	r1, r1, 4
+	add	r6, r1, r3
+	beq	r6, r0, start		# Cleared sieve[0..8000)
+	beq	r0, r0, clear
+
+start:	lui	r1, 0x4000
+	addi	r1, r1, 2		# p = &sieve[2]
+ploop:	lw	r5, r1, 0
+	beq	r5, r0, prime
+	beq	r0, r0, pnext
+prime:	lw	r5, r0, result
+	addi	r5, r5, 1
+	sw	r5, r0, result		# result += 1
+	lui	r5, 0xc000
+	add	r5, r1, r5		# r5 = p - &sieve[0]
+	add	r2, r1, r5		# m = p + p
+mloop:	add	r6, r2, r3
+	nand	r6, r6, r4
+	nand	r6, r6, r6		# r6 = sign of m - &sieve[8000]
+	beq	r6, r0, pnext
+	sw	r4, r2, 0		# Cross m off
+	add	r2, r2, r5		# m += p
+	beq	r0, r0, mloop
+pnext:	addi	r1, r1, 1
+	add	r6, r1, r3
+	beq	r6, r0, next		# p == 8000
+	beq	r0, r0, ploop
+
+next:	lw	r1, r0, rounds
+	addi	r1, r1, -1
+	sw	r1, r0, rounds
+	beq	r1, r0, done
+	beq	r0, r0, round
+
+done:	add	r0, r0, r0		# Halt
@@ -0,0 +1,127 @@
+# sort.s
+# Copies a 64-word .fill array to free memory at 0x4000 and sorts it with
+# insertion sort, 1500 times. Each round folds the sorted words into a hash,
+# which ends up in result.
+
+result:	.fill	0			# Hash of the sorted words
+rounds:	.fill	1500
+negend:	.fill	-16448			# -(0x4000 + 64)
+&array:	.fill	array
+
+# Copy the array. work[-1], which is never written, stays 0 and stops the
+# inner loop of the sort.
+round:	lw	r1, r0, &array
+	lui	r2, 0x4000		# r2 = &work[0]
+	lw	r6, r0, negend		# r6 = -&work[64]
+copy:	lw	r3, r1, 0
+	sw	r3, r2, 0
+	addi	r1, r1, 1
+	addi	r2, r2, 1
+	add	r3, r2, r6
+	beq	r3, r0, sort
+	beq	r0, r0, copy
+
+sort:	lui	r1, 0x4000
+	addi	r1, r1, 1		# i = &work[1]
+	lui	r5, 0x8000		# r5 = sign mask
+outer:	lw	r3, r1, 0		# key = *i
+	addi	r2, r1, -1		# j = i - 1
+inner:	lw	r4, r2, 0
+	nand	r4, r4, r4
+	addi	r4, r4, 1
+	add	r4, r3, r4
+	nand	r4, r4, r5
+	nand	r4, r4, r4		# r4 = sign of key - *j
+	beq	r4, r0, insert		# *j <= key
+	lw	r4, r2, 0
+	sw	r4, r2, 1		# j[1] = *j
+	addi	r2, r2, -1
+	beq	r0, r0, inner
+insert:	sw	r3, r2, 1		# j[1] = key
+	addi	r1, r1, 1
+	add	r4, r1, r6
+	beq	r4, r0, hash		# i == &work[64]
+	beq	r0, r0, outer
+
+hash:	lui	r1, 0x4000
+	lw	r3, r0, result
+hloop:	lw	r2, r1, 0
+	add	r3, r3, r3
+	add	r3, r3, r2		# result = 2 * result + *i
+	addi	r1, r1, 1
+	add	r4, r1, r6
+	beq	r4, r0, next
+	beq	r0, r0, hloop
+next:	sw	r3, r0, result
+	lw	r1, r0, rounds
+	addi	r1, r1, -1
+	sw	r1, r0, rounds
+	beq	r1, r0, done
+	beq	r0, r0, round
+
+done:	add	r0, r0, r0		# Halt
+
+array:	.fill	12091
+	.fill	14155
+	.fill	7352
+	.fill	16096
+	.fill	14621
+	.fill	9053
+	.fill	14342
+	.fill	13642
+	.fill	4203
+	.fill	14501
+	.fill	11189
+	.fill	15652
+	.fill	15277
+	.fill	11531
+	.fill	1343
+	.fill	13379
+	.fill	4862
+	.fill	2085
+	.fill	1174
+	.fill	15990
+	.fill	7976
+	.fill	14991
+	.fill	7751
+	.fill	1553
+	.fill	4904
+	.fill	2205
+	.fill	2540
+	.fill	5273
+	.fill	3455
+	.fill	5749
+	.fill	3413
+	.fill	3917
+	.fill	2762
+	.fill	8128
+	.fill	7422
+	.fill	15148
+	.fill	11647
+	.fill	5158
+	.fill	1343
+	.fill	11966
+	.fill	10303
+	.fill	9205
+	.fill	3981
+	.fill	4380
+	.fill	9968
+	.fill	15997
+	.fill	14101
+	.fill	13543
+	.fill	12667
+	.fill	10809
+	.fill	555
+	.fill	4892
+	.fill	9309
+	.fill	14424
+	.fill	3237
+	.fill	6982
+	.fill	5202
+	.fill	265
+	.fill	10251
+	.fill	6169
+	.fill	1192
+	.fill	4938
+	.fill	12524
+	.fill	7365
@@ -0,0 +1,72 @@
+/*
+ * aot.h
+ *
+ * Interface between the shared objects built by the aot tool and the VM that
+ * loads them (run --aot=FILE). The tool translates the text of an image to C,
+ * one function per basic block, and the C file is compiled on its own, so it
+ * repeats the definitions below instead of including this header.
+ *
+ * A shared object exports
+ *
+ * 	AOT_SYMBOL_VERSION	uint32_t, AOT_VERSION
+ * 	AOT_SYMBOL_TEXT_START	uint16_t, address of the first text word
+ * 	AOT_SYMBOL_TEXT_SIZE	uint16_t, number of text words
+ * 	AOT_SYMBOL_CHECKSUM	uint32_t, image_checksum of the text words,
+ * 				little-endian, from IMAGE_CHECKSUM_INIT
+ * 	AOT_SYMBOL_BLOCKS	uint8_t[text size / 8 + 1], with bit i % 8
+ * 				of byte i / 8 set if a block starts at text
+ * 				word i
+ * 	AOT_SYMBOL_RUN		aot_run_fn
+ *
+ * The VM refuses an object whose version, text bounds or checksum do not
+ * match the program it has loaded.
+ *
+ * run(context, pc) runs translated blocks, starting with the one at `pc`,
+ * while `context->budget` covers the next block. It returns the next pc in
+ * bits 0-15 along with the AOT_EXIT_ flags, after taking the instructions it
+ * executed off the budget. Unless AOT_EXIT_HALT is set, the VM then has to
+ * execute the instruction at that pc: it is a store the translation may not
+ * do (into text, or into a page shared with another VM), an address no block
+ * starts at, or more than the budget left. The VM interprets from a pc that
+ * starts no block until it reaches one that does, without calling run.
+ *
+ * If `context->counts` is not NULL, every block adds what it executed to it
+ * as it exits: the instructions by opcode (0-8, numbered as in the VM), and
+ * at AOT_COUNT_TAKEN, the BEQs taken.
+ */
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+
+#define AOT_VERSION		(3)
+
+#define AOT_SYMBOL_VERSION	"riscy_aot_version"
+#define AOT_SYMBOL_TEXT_START	"riscy_aot_text_start"
+#define AOT_SYMBOL_TEXT_SIZE	"riscy_aot_text_size"
+#define AOT_SYMBOL_CHECKSUM	"riscy_aot_checksum"
+#define AOT_SYMBOL_BLOCKS	"riscy_aot_blocks"
+#define AOT_SYMBOL_RUN		"riscy_aot_run"
+
+#define AOT_EXIT_PC(r)		((uint16_t) ((r) & 0xffff))
+#define AOT_EXIT_HALT		(UINT32_C(1) << 16)	/* Executed the last
+							   instruction of the
+							   text */
+
+#define AOT_COUNT_TAKEN		(9)	/* After the nine opcodes */
+#define AOT_NUM_COUNTS		(10)
+
+typedef struct	aot_context_t	aot_context_t;
+
+struct aot_context_t {
+	uint16_t*	regs;		/* vm->regs, with regs[0] == 0 */
+	uint16_t**	pages;		/* vm->pages */
+	uint16_t**	wpages;		/* vm->wpages */
+	int64_t		budget;		/* Instructions left to execute */
+	uint64_t*	counts;		/* AOT_NUM_COUNTS tallies, or NULL */
+};
+
+typedef uint32_t	(*aot_run_fn)	(aot_context_t* context, uint16_t pc);
+
+#endif
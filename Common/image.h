@@ -0,0 +1,104 @@
+/*
+ * image.h
+ *
+ * The binary executable image written by the assembler and loaded by the VM.
+ * All multi-byte fields are little-endian.
+ *
+ * 	offset	size	field
+ * 	------	----	-----------------------------------------------
+ * 	0	4	magic, "RSCY"
+ * 	4	2	format version (IMAGE_VERSION)
+ * 	6	2	flags (IMAGE_FLAG_*)
+ * 	8	2	number of segments
+ * 	10	2	reserved, 0
+ * 	12	4	checksum of all segment words, if IMAGE_FLAG_CHECKSUM
+ * 	16	12 * n	segment table, see below
+ * 	...		segment words, 16 bits each
+ *
+ * Each entry in the segment table is
+ *
+ * 	0	2	type (IMAGE_SEGMENT_*)
+ * 	2	2	load address of the first word
+ * 	4	2	number of words
+ * 	6	2	reserved, 0
+ * 	8	4	file offset of the first word
+ *
+ * In memory, each segment is preceded by a header word holding its size, as
+ * described under "Program layout" in documentation.txt; the loader writes
+ * the header words itself.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IMAGE_MAGIC		"RSCY"
+#define IMAGE_MAGIC_SIZE	(4)
+#define IMAGE_VERSION		(1)
+
+#define IMAGE_HEADER_SIZE	(16)
+#define IMAGE_SEGMENT_SIZE	(12)
+
+#define IMAGE_FLAG_CHECKSUM	(0x0001)
+
+#define IMAGE_SEGMENT_DATA	(1)
+#define IMAGE_SEGMENT_TEXT	(2)
+
+static inline uint16_t image_get16(const uint8_t* p)
+{
+	return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static inline uint32_t image_get32(const uint8_t* p)
+{
+	return (uint32_t) image_get16(p) | (uint32_t) image_get16(p + 2) << 16;
+}
+
+static inline void image_put16(uint8_t* p, uint16_t w)
+{
+	p[0] = w & 0xff;
+	p[1] = w >> 8;
+}
+
+static inline void image_put32(uint8_t* p, uint32_t d)
+{
+	image_put16(p, d & 0xffff);
+	image_put16(p + 2, d >> 16);
+}
+
+/* 32-bit FNV-1a over `size` bytes, continuing from `hash`. Start with
+ * IMAGE_CHECKSUM_INIT. */
+#define IMAGE_CHECKSUM_INIT	(UINT32_C(2166136261))
+
+static inline uint32_t image_checksum(uint32_t hash, const uint8_t* bytes,
+					size_t size)
+{
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= UINT32_C(16777619);
+	}
+	return hash;
+}
+
+/* image_checksum of the `size` text words at `start`, little-endian, in a
+ * memory of pages of 1 << `page_bits` words. This is what an AOT object
+ * records in AOT_SYMBOL_CHECKSUM. */
+static inline uint32_t text_checksum(uint16_t* const* pages,
+					unsigned page_bits, uint16_t start,
+					uint16_t size)
+{
+	uint16_t	mask	= (uint16_t) ((1u << page_bits) - 1);
+	uint32_t	hash	= IMAGE_CHECKSUM_INIT;
+	uint8_t		bytes[2];
+
+	for (uint16_t i = 0; i < size; ++i) {
+		uint16_t address = (uint16_t) (start + i);
+		image_put16(bytes, pages[address >> page_bits][address & mask]);
+		hash = image_checksum(hash, bytes, sizeof bytes);
+	}
+	return hash;
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * object.h
+ *
+ * The object file written by `asm --object` and combined into an image by the
+ * link tool. It holds one module's data and text as assembled, with every use
+ * of a label left as a relocation, since the addresses are only known once
+ * the link tool has placed the modules. All multi-byte fields are
+ * little-endian.
+ *
+ * 	offset	size	field
+ * 	------	----	-----------------------------------------------
+ * 	0	4	magic, "RSCO"
+ * 	4	2	format version (OBJECT_VERSION)
+ * 	6	2	reserved, 0
+ * 	8	2	number of data words
+ * 	10	2	number of text words
+ * 	12	4	number of symbols
+ * 	16	4	number of relocations
+ * 	20	4	size of the name table, in bytes
+ * 	24	4	checksum of everything after the header
+ * 	28	...	data words, then text words, 16 bits each
+ * 	...	8 * n	symbols, see below
+ * 	...	16 * n	relocations, see below
+ * 	...		name table: NUL-terminated names, one after the other
+ *
+ * A symbol is a label defined by the module:
+ *
+ * 	0	2	segment (OBJECT_SEGMENT_*)
+ * 	2	2	offset of the word it labels, within its segment
+ * 	4	4	offset of its name in the name table
+ *
+ * A relocation is a word that uses a label, defined here or elsewhere:
+ *
+ * 	0	2	segment (OBJECT_SEGMENT_*) of the word
+ * 	2	2	offset of the word within its segment
+ * 	4	2	how the address is patched in (OBJECT_RELOC_*)
+ * 	6	2	reserved, 0
+ * 	8	4	offset of the label's name in the name table
+ * 	12	4	source line, for error messages
+ *
+ * The checksum is image_checksum (see image.h) from IMAGE_CHECKSUM_INIT.
+ */
+
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#define OBJECT_MAGIC		"RSCO"
+#define OBJECT_MAGIC_SIZE	(4)
+#define OBJECT_VERSION		(1)
+
+#define OBJECT_HEADER_SIZE	(28)
+#define OBJECT_SYMBOL_SIZE	(8)
+#define OBJECT_RELOC_SIZE	(16)
+
+#define OBJECT_SEGMENT_DATA	(1)
+#define OBJECT_SEGMENT_TEXT	(2)
+
+#define OBJECT_RELOC_WORD	(1)	/* .fill: the whole address */
+#define OBJECT_RELOC_SIMM	(2)	/* addi, sw, lw: the low 7 bits */
+#define OBJECT_RELOC_UIMM	(3)	/* lui: the upper 10 bits */
+#define OBJECT_RELOC_BRANCH	(4)	/* beq: the offset from the next word */
+#define OBJECT_RELOC_LOW6	(5)	/* lli, movi: the low 6 bits */
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * trace.h
+ *
+ * The execution trace written by "run --trace=FILE" and read by "dump".
+ * A trace is a header followed by one fixed-size record per instruction
+ * executed, in the order they were executed.
+ *
+ * 	offset	size	field
+ * 	------	----	-----------------------------------------------
+ * 	0	4	magic, "RSCT"
+ * 	4	2	format version (TRACE_VERSION)
+ * 	6	2	byte order mark, TRACE_BYTE_ORDER
+ * 	8	2	size of a record in bytes (TRACE_RECORD_SIZE)
+ * 	10	6	reserved, 0
+ * 	16	...	records, see trace_record_t
+ *
+ * Everything after the magic is in the byte order of the machine that wrote
+ * the trace, so that the VM can copy records out as they are. A reader on a
+ * machine of the other byte order sees the mark byte-swapped and must swap
+ * every field.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC		"RSCT"
+#define TRACE_MAGIC_SIZE	(4)
+#define TRACE_VERSION		(1)
+#define TRACE_BYTE_ORDER	(0x1234)
+
+#define TRACE_HEADER_SIZE	(16)
+#define TRACE_RECORD_SIZE	(12)
+
+/* Bits of trace_record_t.flags. The low three bits name the register. */
+#define TRACE_FLAG_REG		(0x0008)	/* `value` written to register */
+#define TRACE_FLAG_MEM		(0x0010)	/* `data` written to `address` */
+#define TRACE_MASK_REG		(0x0007)
+
+typedef struct	trace_record_t	trace_record_t;
+
+struct trace_record_t {
+	uint16_t	pc;		/* Address of the instruction */
+	uint16_t	word;		/* The instruction, as fetched */
+	uint16_t	flags;		/* TRACE_FLAG_*, register number */
+	uint16_t	value;		/* New value of the register */
+	uint16_t	address;	/* Address stored to */
+	uint16_t	data;		/* Word stored */
+};
+
+#endif
@@ -0,0 +1,393 @@
+/* main.c */
+
+#include "assembler.h"
+#include "image.h"
+#include "object.h"
+#include "output.h"
+#include "symtable.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Prints an error about the object `filename` and exits */
+#define LINK_ERROR(filename, ...)					\
+	do {								\
+		printf("[!] Link error (%s): ", (filename));		\
+		printf(__VA_ARGS__);					\
+		exit(EXIT_FAILURE);					\
+	} while (0)
+
+typedef struct	object_t	object_t;
+
+struct object_t {
+	char*		filename;
+	program_t*	program;	/* As assemble_object left it */
+	char*		names;		/* Storage for the label names */
+	uint16_t	data_base;	/* Offsets of its data and text within */
+	uint16_t	text_base;	/* the linked segments */
+	symtable_t*	symbols;	/* Addresses of its own labels */
+};
+
+static void	read_object	(object_t* object);
+static char*	read_name	(object_t* object, const uint8_t* names,
+				 uint32_t names_size, uint32_t offset);
+static void	place_objects	(object_t objects[], int nbr_objects,
+				 program_t* linked);
+static void	define_labels	(object_t objects[], int nbr_objects,
+				 program_t* linked, symtable_t* globals,
+				 symtable_t* clashes);
+static void	relocate	(object_t* object, program_t* linked,
+				 symtable_t* globals, symtable_t* clashes);
+static uint8_t*	read_bytes	(char* filename, size_t* size);
+
+int main(int argc, char* argv[])
+{
+	char*		output_filename	= NULL;
+	bool		write_as_hex	= false;	/* Legacy text output */
+	object_t*	objects;
+	int		nbr_objects	= 0;
+	program_t*	linked;				/* All objects, with
+							   their labels resolved */
+	symtable_t*	globals;			/* Labels by name */
+	symtable_t*	clashes;			/* Labels defined by
+							   more than one object */
+
+	objects = calloc(argc, sizeof *objects);
+	linked	= malloc(sizeof *linked);
+	if (objects == NULL || linked == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		if (streq(argv[i], "--hex"))
+			write_as_hex = true;
+		else if (output_filename == NULL)
+			output_filename = argv[i];
+		else
+			objects[nbr_objects++].filename = argv[i];
+	}
+
+	if (nbr_objects == 0) {
+		printf("Usage: link <output_filename> <object_filename>... "
+			"[--hex]\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < nbr_objects; ++i)
+		read_object(&objects[i]);
+
+	globals			= symtable_init();
+	clashes			= symtable_init();
+	linked->symtable	= symtable_init();
+	linked->labels		= NULL;
+	linked->fixups		= NULL;
+	linked->nbr_labels	= 0;
+	linked->nbr_fixups	= 0;
+
+	place_objects(objects, nbr_objects, linked);
+	define_labels(objects, nbr_objects, linked, globals, clashes);
+	for (int i = 0; i < nbr_objects; ++i)
+		relocate(&objects[i], linked, globals, clashes);
+
+	write_program(linked, output_filename, write_as_hex);
+	printf("Linked %d objects into \"%s\": %u data words, %u text "
+		"words.\n", nbr_objects, output_filename, linked->data_size,
+		linked->text_size);
+
+	/* Done with the link. Free all memory. */
+	for (int i = 0; i < nbr_objects; ++i) {
+		symtable_free(objects[i].symbols);
+		free(objects[i].program->labels);
+		free(objects[i].program->fixups);
+		free(objects[i].program);
+		free(objects[i].names);
+	}
+	symtable_free(globals);
+	symtable_free(clashes);
+	symtable_free(linked->symtable);
+	free(linked);
+	free(objects);
+
+	exit(EXIT_SUCCESS);
+}
+
+/* Reads an object file into `object->program`, checking everything the link
+ * relies on: sizes, offsets and names. */
+static void read_object(object_t* object)
+{
+	static const fixup_kind_t kinds[] = {
+		[OBJECT_RELOC_WORD]	= FIXUP_WORD,
+		[OBJECT_RELOC_SIMM]	= FIXUP_SIMM,
+		[OBJECT_RELOC_UIMM]	= FIXUP_UIMM,
+		[OBJECT_RELOC_BRANCH]	= FIXUP_BRANCH,
+		[OBJECT_RELOC_LOW6]	= FIXUP_LOW6,
+	};
+
+	char*		filename	= object->filename;
+	program_t*	program;
+	uint8_t*	bytes;
+	size_t		file_size;
+	const uint8_t*	p;
+	const uint8_t*	names;
+	uint32_t	nbr_symbols;
+	uint32_t	nbr_relocs;
+	uint32_t	names_size;
+	uint16_t	segment;
+	uint16_t	kind;
+	size_t		size;
+	label_t*	label;
+	fixup_t*	fixup;
+
+	bytes	= read_bytes(filename, &file_size);
+	p	= bytes;
+
+	if (file_size < OBJECT_HEADER_SIZE
+			|| memcmp(p, OBJECT_MAGIC, OBJECT_MAGIC_SIZE) != 0) {
+		LINK_ERROR(filename, "Not an object file.\n");
+	}
+	if (image_get16(p + 4) != OBJECT_VERSION) {
+		LINK_ERROR(filename, "Unsupported object version %u.\n",
+				image_get16(p + 4));
+	}
+
+	program = malloc(sizeof *program);
+	if (program == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	object->program		= program;
+	program->data_size	= image_get16(p + 8);
+	program->text_size	= image_get16(p + 10);
+	nbr_symbols		= image_get32(p + 12);
+	nbr_relocs		= image_get32(p + 16);
+	names_size		= image_get32(p + 20);
+
+	size = OBJECT_HEADER_SIZE
+		+ 2 * ((size_t) program->data_size + program->text_size)
+		+ (size_t) OBJECT_SYMBOL_SIZE * nbr_symbols
+		+ (size_t) OBJECT_RELOC_SIZE * nbr_relocs
+		+ names_size;
+	if (size != file_size
+			|| program->data_size + program->text_size >= MEM_SIZE) {
+		LINK_ERROR(filename, "Truncated or invalid object.\n");
+	}
+	if (image_checksum(IMAGE_CHECKSUM_INIT, p + OBJECT_HEADER_SIZE,
+			size - OBJECT_HEADER_SIZE) != image_get32(p + 24)) {
+		LINK_ERROR(filename, "Checksum mismatch.\n");
+	}
+
+	p += OBJECT_HEADER_SIZE;
+	for (int i = 0; i < program->data_size; ++i, p += 2)
+		program->data[i] = image_get16(p);
+	for (int i = 0; i < program->text_size; ++i, p += 2)
+		program->text[i] = image_get16(p);
+
+	/* The names are copied out, so the file can be freed */
+	names		= p + (size_t) OBJECT_SYMBOL_SIZE * nbr_symbols
+			    + (size_t) OBJECT_RELOC_SIZE * nbr_relocs;
+	object->names	= malloc(names_size + 1);
+	program->labels	= malloc((nbr_symbols + 1) * sizeof *program->labels);
+	program->fixups	= malloc((nbr_relocs + 1) * sizeof *program->fixups);
+	if (object->names == NULL || program->labels == NULL
+			|| program->fixups == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(object->names, names, names_size);
+	program->nbr_labels = nbr_symbols;
+	program->nbr_fixups = nbr_relocs;
+
+	for (uint32_t i = 0; i < nbr_symbols; ++i, p += OBJECT_SYMBOL_SIZE) {
+		label		= &program->labels[i];
+		segment		= image_get16(p);
+		label->in_text	= segment == OBJECT_SEGMENT_TEXT;
+		label->offset	= image_get16(p + 2);
+		label->name	= read_name(object, names, names_size,
+						image_get32(p + 4));
+		label->line	= 0;
+
+		if ((segment != OBJECT_SEGMENT_DATA
+				&& segment != OBJECT_SEGMENT_TEXT)
+		|| label->offset >= (label->in_text ? program->text_size
+						    : program->data_size)) {
+			LINK_ERROR(filename, "Invalid symbol \"%s\".\n",
+					label->name);
+		}
+	}
+
+	for (uint32_t i = 0; i < nbr_relocs; ++i, p += OBJECT_RELOC_SIZE) {
+		fixup		= &program->fixups[i];
+		segment		= image_get16(p);
+		kind		= image_get16(p + 4);
+		fixup->in_text	= segment == OBJECT_SEGMENT_TEXT;
+		fixup->offset	= image_get16(p + 2);
+		fixup->name	= read_name(object, names, names_size,
+						image_get32(p + 8));
+		fixup->line	= image_get32(p + 12);
+
+		if ((segment != OBJECT_SEGMENT_DATA
+				&& segment != OBJECT_SEGMENT_TEXT)
+		|| fixup->offset >= (fixup->in_text ? program->text_size
+						    : program->data_size)
+		|| kind < OBJECT_RELOC_WORD || kind > OBJECT_RELOC_LOW6) {
+			LINK_ERROR(filename, "Invalid relocation of \"%s\" "
+					"(line %u).\n", fixup->name,
+					fixup->line);
+		}
+		fixup->kind = kinds[kind];
+	}
+
+	free(bytes);
+}
+
+/* Returns the name at `offset` of the name table, as copied to
+ * `object->names` */
+static char* read_name(object_t* object, const uint8_t* names,
+		uint32_t names_size, uint32_t offset)
+{
+	if (offset >= names_size
+			|| memchr(names + offset, '\0', names_size - offset)
+								== NULL) {
+		LINK_ERROR(object->filename, "Invalid name offset %u.\n",
+				offset);
+	}
+	return object->names + offset;
+}
+
+/* The data of all objects comes first, in the order they were given, and
+ * then their text. The program starts at the text of the first object. */
+static void place_objects(object_t objects[], int nbr_objects,
+		program_t* linked)
+{
+	program_t*	program;
+	uint32_t	data_size	= 0;
+	uint32_t	text_size	= 0;
+
+	for (int i = 0; i < nbr_objects; ++i) {
+		program = objects[i].program;
+
+		/* Two header words share the memory with data and text */
+		if (data_size + program->data_size + text_size
+				+ program->text_size > MEM_SIZE - 1) {
+			LINK_ERROR(objects[i].filename, "Program does not fit "
+					"in memory.\n");
+		}
+
+		objects[i].data_base = data_size;
+		objects[i].text_base = text_size;
+		memcpy(&linked->data[data_size], program->data,
+				program->data_size * sizeof *program->data);
+		memcpy(&linked->text[text_size], program->text,
+				program->text_size * sizeof *program->text);
+
+		data_size += program->data_size;
+		text_size += program->text_size;
+	}
+
+	linked->data_size = data_size;
+	linked->text_size = text_size;
+}
+
+/* A label is first looked up in the object that uses it, so that objects may
+ * each have a "loop" of their own. Only the labels used from elsewhere have
+ * to be defined once. */
+static void define_labels(object_t objects[], int nbr_objects,
+		program_t* linked, symtable_t* globals, symtable_t* clashes)
+{
+	uint16_t	text_start	= linked->data_size + 2;
+	uint16_t	address;
+	object_t*	object;
+	label_t*	label;
+
+	for (int i = 0; i < nbr_objects; ++i) {
+		object		= &objects[i];
+		object->symbols	= symtable_init();
+
+		for (int j = 0; j < object->program->nbr_labels; ++j) {
+			label	= &object->program->labels[j];
+			address	= label->in_text
+				? text_start + object->text_base + label->offset
+				: 1 + object->data_base + label->offset;
+
+			symtable_add(object->symbols, label->name, address);
+			symtable_add(linked->symtable, label->name, address);
+
+			if (!symtable_contains(globals, label->name))
+				symtable_add(globals, label->name, address);
+			else if (!symtable_contains(clashes, label->name))
+				symtable_add(clashes, label->name, address);
+		}
+	}
+}
+
+static void relocate(object_t* object, program_t* linked,
+		symtable_t* globals, symtable_t* clashes)
+{
+	uint16_t	text_start	= linked->data_size + 2;
+	uint16_t	address;
+	uint16_t	next;
+	uint16_t*	word;
+	fixup_t*	fixup;
+
+	for (int i = 0; i < object->program->nbr_fixups; ++i) {
+		fixup = &object->program->fixups[i];
+
+		if (symtable_contains(object->symbols, fixup->name)) {
+			address = symtable_get_address(object->symbols,
+							fixup->name);
+		} else if (symtable_contains(clashes, fixup->name)) {
+			LINK_ERROR(object->filename, "Label \"%s\" (line %u) is "
+				"defined in more than one object.\n",
+				fixup->name, fixup->line);
+		} else if (symtable_contains(globals, fixup->name)) {
+			address = symtable_get_address(globals, fixup->name);
+		} else {
+			LINK_ERROR(object->filename, "Undefined label \"%s\" "
+				"(line %u).\n", fixup->name, fixup->line);
+		}
+
+		if (fixup->in_text) {
+			word = &linked->text[object->text_base + fixup->offset];
+			next = text_start + object->text_base + fixup->offset
+				+ 1;
+		} else {
+			word = &linked->data[object->data_base + fixup->offset];
+			next = 0;	/* Only beq uses it */
+		}
+
+		if (!apply_fixup(word, fixup->kind, address, next)) {
+			LINK_ERROR(object->filename, "Label \"%s\" (line %u) is "
+				"too far away for beq (%d words).\n",
+				fixup->name, fixup->line, address - next);
+		}
+	}
+}
+
+/* Returns the whole file `filename`, which must be freed */
+static uint8_t* read_bytes(char* filename, size_t* size)
+{
+	FILE*		file	= safer_fopen(filename, "rb");
+	uint8_t*	bytes;
+	long		length;
+
+	if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0) {
+		LINK_ERROR(filename, "Could not read the file.\n");
+	}
+	rewind(file);
+
+	bytes = malloc(length + 1);
+	if (bytes == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (fread(bytes, 1, length, file) != (size_t) length) {
+		LINK_ERROR(filename, "Could not read the file.\n");
+	}
+	fclose(file);
+
+	*size = length;
+	return bytes;
+}
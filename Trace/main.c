@@ -0,0 +1,104 @@
+/* main.c */
+
+#include "disasm.h"
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORDS_PER_READ	(4096)
+
+static uint16_t	swap16		(uint16_t w);
+static void	print_record	(uint64_t index, const trace_record_t* r);
+
+/* Renders a trace written by "run --trace=FILE" as text, one line per
+ * instruction executed. */
+int main(int argc, char* argv[])
+{
+	static trace_record_t	records[RECORDS_PER_READ];
+	uint8_t		header[TRACE_HEADER_SIZE];
+	uint16_t	fields[3];	/* Version, byte order, record size */
+	uint64_t	index	= 0;
+	size_t		count;
+	bool		swap;
+	FILE*		input;
+
+	if (argc != 2) {
+		printf("Usage: dump <trace_filename>\n");
+		exit(EXIT_FAILURE);
+	}
+
+	input = fopen(argv[1], "rb");
+	if (input == NULL) {
+		fprintf(stderr, "Could not open \"%s\".\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(header, 1, sizeof header, input) != sizeof header
+			|| memcmp(header, TRACE_MAGIC, TRACE_MAGIC_SIZE)) {
+		fprintf(stderr, "\"%s\" is not a trace file.\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(fields, header + TRACE_MAGIC_SIZE, sizeof fields);
+	swap = fields[1] != TRACE_BYTE_ORDER;
+	if (swap) {
+		for (int i = 0; i < 3; ++i)
+			fields[i] = swap16(fields[i]);
+	}
+	if (fields[1] != TRACE_BYTE_ORDER || fields[0] != TRACE_VERSION
+			|| fields[2] != TRACE_RECORD_SIZE) {
+		fprintf(stderr, "\"%s\": unsupported trace version %u.\n",
+				argv[1], fields[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	while ((count = fread(records, TRACE_RECORD_SIZE, RECORDS_PER_READ,
+							input)) > 0) {
+		for (size_t i = 0; i < count; ++i) {
+			trace_record_t* r = &records[i];
+			if (swap) {
+				r->pc		= swap16(r->pc);
+				r->word		= swap16(r->word);
+				r->flags	= swap16(r->flags);
+				r->value	= swap16(r->value);
+				r->address	= swap16(r->address);
+				r->data		= swap16(r->data);
+			}
+			print_record(index++, r);
+		}
+	}
+
+	if (ferror(input)) {
+		fprintf(stderr, "Could not read \"%s\".\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	fclose(input);
+
+	printf("%"PRIu64" instructions\n", index);
+	return EXIT_SUCCESS;
+}
+
+static uint16_t swap16(uint16_t w)
+{
+	return (uint16_t) (w << 8 | w >> 8);
+}
+
+static void print_record(uint64_t index, const trace_record_t* r)
+{
+	char	text[32];
+
+	printf("%12"PRIu64"  0x%04x  0x%04x  %-*s", index, r->pc, r->word,
+			r->flags ? 22 : 0,
+			disassemble(text, sizeof text, r->word));
+
+	if (r->flags & TRACE_FLAG_REG)
+		printf("  r%u = 0x%04x", r->flags & TRACE_MASK_REG, r->value);
+	if (r->flags & TRACE_FLAG_MEM)
+		printf("  [0x%04x] = 0x%04x", r->address, r->data);
+
+	printf("\n");
+}
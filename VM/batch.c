@@ -0,0 +1,313 @@
+/* batch.c */
+
+#include "batch.h"
+#include "jit.h"
+#include "lockstep.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "vm.h"
+#include "vm_internal.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* If true, more information will be printed. Defined in vm_main.c. */
+extern bool print_verbose_output;
+
+typedef struct	batch_t		batch_t;
+
+struct batch_t {
+	RiscyVM**	vms;		/* One instance per input */
+	char**		inputs;
+	int		nbr_inputs;
+	int		next;		/* Next instance to run */
+	int		chunk;		/* Instances taken at a time */
+	batch_engine_t	engine;
+	int*		parked;		/* Instances detached by lockstep_run,
+					   to be finished with VM_run */
+	int		nbr_parked;
+	stats_t*	stats;		/* Those of every instance, added up,
+					   or NULL */
+};
+
+static void	load_data	(RiscyVM* vm, char filename[]);
+static void	print_error	(RiscyVM* vm);
+static void*	worker		(void* arg);
+static void	park		(batch_t* batch, int first, int n);
+static int	unpark		(batch_t* batch);
+static vm_error_t time_slice	(batch_t* batch, int nbr_threads,
+				 uint64_t quantum);
+static void	report		(RiscyVM* vm, int id,
+				 const guest_stats_t* stats, void* user);
+static void	add_stats	(batch_t* batch, RiscyVM* vm);
+
+/* Keeps the reports of instances that halt at the same time apart */
+static pthread_mutex_t	report_lock	= PTHREAD_MUTEX_INITIALIZER;
+
+/* Guards batch_t.parked */
+static pthread_mutex_t	parked_lock	= PTHREAD_MUTEX_INITIALIZER;
+
+vm_error_t batch_run(char program[], char* inputs[], int nbr_inputs,
+		int nbr_threads, batch_engine_t engine, uint64_t quantum,
+		char stats_filename[])
+{
+	RiscyVM*	prototype;
+	pthread_t*	threads;
+	batch_t		batch;
+	vm_error_t	error;
+	int		started	= 0;
+
+	if (nbr_threads < 1)
+		nbr_threads = 1;
+	if (nbr_threads > nbr_inputs)
+		nbr_threads = nbr_inputs;
+	if (engine == BATCH_LOCKSTEP && nbr_threads > (nbr_inputs
+				+ LOCKSTEP_LANES - 1) / LOCKSTEP_LANES)
+		nbr_threads = (nbr_inputs + LOCKSTEP_LANES - 1)
+				/ LOCKSTEP_LANES;
+
+	batch.vms	= malloc(nbr_inputs * sizeof *batch.vms);
+	batch.parked	= malloc(nbr_inputs * sizeof *batch.parked);
+	batch.stats	= stats_filename != NULL ? stats_create() : NULL;
+	threads		= malloc(nbr_threads * sizeof *threads);
+	if (batch.vms == NULL || batch.parked == NULL || threads == NULL
+			|| (stats_filename != NULL && batch.stats == NULL)) {
+		free(threads);
+		stats_free(batch.stats);
+		free(batch.parked);
+		free(batch.vms);
+		return VM_ERROR_MEMORY;
+	}
+
+	batch.inputs	 = inputs;
+	batch.nbr_inputs = nbr_inputs;
+	batch.next	 = 0;
+	batch.chunk	 = engine == BATCH_LOCKSTEP ? LOCKSTEP_LANES : 1;
+	batch.engine	 = engine;
+	batch.nbr_parked = 0;
+
+	/* Load the program once. Cloning is done up front, on this thread,
+	 * since it touches the reference counts of the prototype's pages.
+	 * With stats, each instance counts for itself, and the counts are
+	 * added up as the instances are reported. */
+	prototype	= VM_open(program, &error);
+	for (int i = 0; i < nbr_inputs && error == VM_OK; ++i) {
+		batch.vms[i] = VM_clone(prototype, &error);
+		if (error == VM_OK && batch.stats != NULL) {
+			error = stats_start(batch.vms[i]);
+			if (error != VM_OK)
+				VM_shutdown(batch.vms[i]);
+		}
+		if (error != VM_OK) {
+			while (i-- > 0)
+				VM_shutdown(batch.vms[i]);
+		}
+	}
+	VM_shutdown(prototype);
+
+	if (error != VM_OK) {
+		free(threads);
+		stats_free(batch.stats);
+		free(batch.parked);
+		free(batch.vms);
+		return error;
+	}
+
+	if (quantum > 0) {
+		error = time_slice(&batch, nbr_threads, quantum);
+	} else {
+		/* The threads that did start take the instances of those
+		 * that did not, and this one does the work if none could */
+		while (started < nbr_threads && pthread_create(
+				&threads[started], NULL, worker, &batch) == 0)
+			started += 1;
+		if (started == 0)
+			worker(&batch);
+
+		for (int i = 0; i < started; ++i)
+			pthread_join(threads[i], NULL);
+
+		for (int i = 0; i < nbr_inputs; ++i) {
+			printf("Instance %d: \"%s\"\n", i, inputs[i]);
+			print_error(batch.vms[i]);
+			VM_print_regs(batch.vms[i]);
+			VM_print_data(batch.vms[i]);
+			if (print_verbose_output)
+				VM_print_memory(batch.vms[i]);
+			printf("\n");
+			add_stats(&batch, batch.vms[i]);
+			VM_shutdown(batch.vms[i]);
+		}
+	}
+
+	if (batch.stats != NULL && error == VM_OK)
+		error = stats_save(batch.stats, stats_filename);
+
+	free(threads);
+	stats_free(batch.stats);
+	free(batch.parked);
+	free(batch.vms);
+	return error;
+}
+
+/* Takes the next instances off the list until there are none left, first
+ * finishing any that lockstep_run detached. A worker that parks instances
+ * checks for them again before it stops, so none are left behind. */
+static void* worker(void* arg)
+{
+	batch_t*	batch = arg;
+	int		i;
+	int		n;
+
+	for (;;) {
+		if ((i = unpark(batch)) >= 0) {
+			VM_run(batch->vms[i], UINT64_MAX);
+			continue;
+		}
+
+		i = __atomic_fetch_add(&batch->next, batch->chunk,
+				__ATOMIC_RELAXED);
+		if (i >= batch->nbr_inputs)
+			break;
+		n = batch->nbr_inputs - i < batch->chunk
+			? batch->nbr_inputs - i : batch->chunk;
+
+		for (int k = i; k < i + n; ++k)
+			load_data(batch->vms[k], batch->inputs[k]);
+
+		switch (batch->engine) {
+		case BATCH_INTERP:
+			VM_run(batch->vms[i], UINT64_MAX);
+			break;
+		case BATCH_JIT:
+			JIT_run(batch->vms[i], UINT64_MAX);
+			break;
+		case BATCH_LOCKSTEP:
+			if (lockstep_run(&batch->vms[i], n) > 0)
+				park(batch, i, n);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Adds the instances among the `n` from `first` that are still running */
+static void park(batch_t* batch, int first, int n)
+{
+	pthread_mutex_lock(&parked_lock);
+	for (int k = first; k < first + n; ++k) {
+		if (batch->vms[k]->is_running)
+			batch->parked[batch->nbr_parked++] = k;
+	}
+	pthread_mutex_unlock(&parked_lock);
+}
+
+/* Takes a parked instance, or returns -1 if there is none */
+static int unpark(batch_t* batch)
+{
+	int i = -1;
+
+	pthread_mutex_lock(&parked_lock);
+	if (batch->nbr_parked > 0)
+		i = batch->parked[--batch->nbr_parked];
+	pthread_mutex_unlock(&parked_lock);
+	return i;
+}
+
+/* Hands every instance to a scheduler, which reports and shuts each down as
+ * soon as it halts, or shuts down the rest if it cannot run them */
+static vm_error_t time_slice(batch_t* batch, int nbr_threads,
+		uint64_t quantum)
+{
+	sched_t*	sched;
+	vm_error_t	error	= VM_ERROR_MEMORY;
+	int		i	= 0;
+
+	sched = sched_create(nbr_threads, quantum, batch->engine == BATCH_JIT,
+			report, batch);
+	if (sched != NULL) {
+		for (; i < batch->nbr_inputs; ++i) {
+			load_data(batch->vms[i], batch->inputs[i]);
+			if (sched_add(sched, batch->vms[i]) < 0)
+				break;
+		}
+		if (i == batch->nbr_inputs)
+			error = sched_run(sched);
+		sched_free(sched);
+	}
+
+	/* Those the scheduler never got */
+	for (; i < batch->nbr_inputs; ++i)
+		VM_shutdown(batch->vms[i]);
+
+	return error;
+}
+
+static void report(RiscyVM* vm, int id, const guest_stats_t* stats,
+		void* user)
+{
+	batch_t* batch = user;
+
+	pthread_mutex_lock(&report_lock);
+	printf("Instance %d: \"%s\"\n", id, batch->inputs[id]);
+	print_error(vm);
+	VM_print_regs(vm);
+	VM_print_data(vm);
+	if (print_verbose_output)
+		VM_print_memory(vm);
+	printf("%"PRIu64" instructions in %"PRIu64" slices, %.3f ms of CPU, "
+		"moved %"PRIu32" times\n\n", stats->steps, stats->slices,
+		stats->cpu_ns / 1e6, stats->steals);
+	add_stats(batch, vm);
+	pthread_mutex_unlock(&report_lock);
+}
+
+/* Adds the stats of an instance to those of the batch, if they are kept */
+static void add_stats(batch_t* batch, RiscyVM* vm)
+{
+	if (batch->stats != NULL)
+		stats_add(batch->stats, vm->stats->counts, vm->stats->taken);
+}
+
+/* Writes the words in `filename` over the data segment of `vm`. If that
+ * fails, the instance is stopped with the reason in vm->error, and runs no
+ * further. */
+static void load_data(RiscyVM* vm, char filename[])
+{
+	FILE*		file;
+	char		buffer[WORD_SIZE + 1 + 1];
+	uint16_t	address	= vm->metadata.data_start;
+	uint16_t	end	= address + vm->metadata.data_size;
+
+	file = fopen(filename, "r");
+	if (file == NULL) {
+		vm->error	= VM_ERROR_OPEN;
+		vm->is_running	= false;
+		return;
+	}
+
+	while (fgets(buffer, sizeof buffer, file)) {
+		if (address == end) {
+			vm->error	= VM_ERROR_FORMAT;
+			vm->is_running	= false;
+			break;
+		}
+		if (!mem_write(vm, address++,
+				(uint16_t) strtol(buffer, NULL, 16))) {
+			vm->is_running = false;
+			break;
+		}
+	}
+
+	fclose(file);
+}
+
+static void print_error(RiscyVM* vm)
+{
+	if (VM_error(vm) != VM_OK)
+		printf("Stopped: %s\n", VM_strerror(VM_error(vm)));
+}
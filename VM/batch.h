@@ -0,0 +1,53 @@
+/*
+ * batch.h
+ *
+ * Batch mode: runs one program against many data segments in one process.
+ * The program is loaded once, and every instance is a VM_clone of it with its
+ * own data written over the data segment. The text therefore stays shared,
+ * and an instance only gets its own copy of the pages it writes to (its data
+ * and stack). The instances are spread over a fixed pool of worker threads.
+ *
+ * With a quantum, the instances are time-sliced by a scheduler (see
+ * scheduler.h) instead of each being run to the end in turn, so that a long
+ * one does not hold up the others. Each is then reported as soon as it halts,
+ * along with the CPU it used, and its memory freed.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "vm.h"
+
+#include <stdint.h>
+
+/* How the instances are run */
+typedef enum {
+	BATCH_INTERP,		/* VM_run, one instance at a time */
+	BATCH_JIT,		/* JIT_run, one instance at a time */
+	BATCH_LOCKSTEP,		/* lockstep_run, LOCKSTEP_LANES at a time */
+} batch_engine_t;
+
+/**
+ * batch_run
+ * 	Runs `program` once per file in `inputs`, on `nbr_threads` threads,
+ * 	then prints the final registers and data of each instance in order.
+ * 	Each input file holds the data words, one hexadecimal word per line
+ * 	like the legacy program format, and may not hold more words than the
+ * 	program has data. An instance whose input cannot be loaded, or which
+ * 	stops on an error (see VM_error), is reported with the error. A
+ * 	`quantum` other than 0 time-slices the instances, that many
+ * 	instructions at a time; it does not go with BATCH_LOCKSTEP. With a
+ * 	`stats_filename`, every instance keeps stats (see stats.h), and those
+ * 	of all of them are added up and written there at the end. Fails only
+ * 	if the program cannot be loaded, the instances set up or the stats
+ * 	written.
+ */
+vm_error_t	batch_run	(char		program[],
+				 char*		inputs[],
+				 int		nbr_inputs,
+				 int		nbr_threads,
+				 batch_engine_t	engine,
+				 uint64_t	quantum,
+				 char		stats_filename[]);
+
+#endif
@@ -0,0 +1,55 @@
+/* disasm.c */
+
+#include "disasm.h"
+#include "vm_internal.h"
+
+#include <stdio.h>
+
+static const char* mnemonics[] = {
+	[ADD]	= "add",	[ADDI]	= "addi",
+	[NAND]	= "nand",	[LUI]	= "lui",
+	[SW]	= "sw",		[LW]	= "lw",
+	[BEQ]	= "beq",	[JALR]	= "jalr",
+};
+
+static const char* extensions[] = {
+	[EXT_MUL]	= "mul",	[EXT_MULH]	= "mulh",
+	[EXT_DIVU]	= "divu",	[EXT_REMU]	= "remu",
+	[EXT_SLL]	= "sll",	[EXT_SRL]	= "srl",
+	[EXT_SRA]	= "sra",
+};
+
+char* disassemble(char* buf, size_t size, uint16_t word)
+{
+	unsigned	opcode	= (word & MASK_OPCODE) >> (16 - 3);
+	unsigned	regA	= (word & MASK_REG_A)  >> (16 - 6);
+	unsigned	regB	= (word & MASK_REG_B)  >> (16 - 9);
+	unsigned	regC	= (word & MASK_REG_C);
+	int		simm	= (word & MASK_SIMM) - (word & 0x40 ? 0x80 : 0);
+	unsigned	uimm	= (word & MASK_UIMM);
+
+	switch (opcode) {
+	case ADD:
+	case NAND:
+		snprintf(buf, size, "%s r%u, r%u, r%u",
+				mnemonics[opcode], regA, regB, regC);
+		break;
+	case LUI:
+		snprintf(buf, size, "lui r%u, 0x%04x", regA, uimm << 6);
+		break;
+	case JALR:
+		if (IS_EXTENSION(word))
+			snprintf(buf, size, "%s r%u, r%u, r%u",
+					extensions[EXT_OPERATION(word)],
+					regA, regB, regC);
+		else
+			snprintf(buf, size, "jalr r%u, r%u", regA, regB);
+		break;
+	default:
+		snprintf(buf, size, "%s r%u, r%u, %d",
+				mnemonics[opcode], regA, regB, simm);
+		break;
+	}
+
+	return buf;
+}
@@ -0,0 +1,13 @@
+/* disasm.h */
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Writes the assembly language form of `word`, e.g. "addi r1, r0, -2", to
+ * `buf` and returns `buf`. */
+char*	disassemble	(char* buf, size_t size, uint16_t word);
+
+#endif
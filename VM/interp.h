@@ -0,0 +1,393 @@
+/*
+ * interp.h
+ *
+ * The interpreter loop, as a template. vm.c includes this file once per
+ * variant of the loop, after defining:
+ *
+ * 	RUN_NAME	name of the static function to define
+ * 	RUN_FUSE	1 to run superinstructions
+ * 	RUN_PROFILE	1 to count into vm->profile
+ * 	RUN_TRACE	1 to append records to vm->tracer
+ * 	RUN_STATS	1 to count for vm->stats, if attached
+ * 	RUN_VERBOSE	1 to print every instruction, as --verbose does
+ * 	RUN_STEP	1 to show the registers and data after every
+ * 			instruction and wait for ENTER, as --step does
+ *
+ * Features that are off cost nothing at all in the instance, so the plain
+ * loop does no more than execute instructions. VM_run picks the instance for
+ * what is attached to the VM. The parameters are undefined again at the end.
+ */
+
+/* Runs the program until it halts or `max_steps` instructions have been
+ * executed, whichever comes first, and returns the number of instructions
+ * executed. pc and the registers are kept in locals. A store that fails
+ * stops the program at that store; see VM_error. */
+static uint64_t RUN_NAME(RiscyVM* vm, uint64_t max_steps)
+{
+	const instruction_t*	decoded		= vm->decoded;
+	const instruction_t*	in;
+	instruction_t		raw;		/* Words outside of text */
+	uint16_t		regs[NUM_REGISTERS];
+	uint16_t		pc		= vm->pc;
+	uint16_t		text_start	= vm->metadata.text_start;
+	uint16_t		text_size	= vm->metadata.text_size;
+	uint16_t		last		= vm->metadata.text_header
+						+ text_size;
+	uint16_t		address;
+	uint64_t		steps		= 0;
+	uint64_t		limit		= max_steps;
+	bool			halt		= !vm->is_running;
+#if RUN_FUSE
+	uint16_t		mask;		/* Of handlers, for this phase */
+#endif
+#if RUN_PROFILE
+	profile_t*		profile		= vm->profile;
+#endif
+#if RUN_TRACE
+	tracer_t*		tracer		= vm->tracer;
+	trace_record_t		record;
+#endif
+#if RUN_STATS
+	uint64_t		counts[STATS_NUM_OPCODES] = { 0 };
+	uint64_t		taken		= 0;	/* BEQs */
+#endif
+#if RUN_VERBOSE
+	char			binbuf[17];
+#endif
+
+	memcpy(regs, vm->regs, sizeof regs);
+
+	/* Superinstructions count as several steps, so they are only run
+	 * while there is room for the longest of them in the budget */
+#if RUN_FUSE
+	mask	= NUM_HANDLERS - 1;
+	limit	= max_steps > FUSE_MAX_LENGTH - 1
+		? max_steps - (FUSE_MAX_LENGTH - 1) : 0;
+#define HANDLER()	(in->handler & mask)
+#else
+#define HANDLER()	(in->opcode)
+#endif
+
+#if RUN_PROFILE
+#define PROFILE(counter, index)	(profile->counter[index] += 1)
+#else
+#define PROFILE(counter, index)	((void) 0)
+#endif
+
+#if RUN_STATS
+#define COUNT()		(counts[in->opcode] += 1)
+#define TAKEN()		(taken += 1)
+#else
+#define COUNT()		((void) 0)
+#define TAKEN()		((void) 0)
+#endif
+
+#if RUN_VERBOSE
+#define VERBOSE(...)	printf(__VA_ARGS__)
+#else
+#define VERBOSE(...)	((void) 0)
+#endif
+
+	/* Shows the state the instruction just executed left behind */
+#if RUN_STEP
+#define PAUSE()								\
+	do {								\
+		if (steps > 0) {					\
+			memcpy(vm->regs, regs, sizeof regs);		\
+			vm->pc = pc;					\
+			VM_print_regs(vm);				\
+			VM_print_data(vm);				\
+			printf("[Press ENTER]");			\
+			getchar();					\
+			printf("\n");					\
+		}							\
+	} while (0)
+#else
+#define PAUSE()		((void) 0)
+#endif
+
+	/* Same as VM_fetch followed by VM_decode */
+#define FETCH()								\
+	do {								\
+		PAUSE();						\
+		if (halt || steps >= limit)				\
+			goto stop;					\
+		halt = pc >= last;					\
+		if ((uint16_t) (pc - text_start) < text_size) {		\
+			in = &decoded[pc - text_start];			\
+		} else {						\
+			raw = decode_word(mem_read(vm, pc));		\
+			in = &raw;					\
+		}							\
+		COUNT();						\
+		PROFILE(hits, pc);					\
+		FETCH_TRACE();						\
+		VERBOSE("%s\n", dec_to_bin(binbuf, mem_read(vm, pc),	\
+						16));			\
+		pc += 1;						\
+		steps += 1;						\
+		regs[0] = 0;						\
+	} while (0)
+
+	/* Starts, then appends, the record of the instruction */
+#if RUN_TRACE
+#define FETCH_TRACE()							\
+	do {								\
+		record.pc	= pc;					\
+		record.word	= mem_read(vm, pc);			\
+	} while (0)
+#define TRACE(flags_, value_, address_, data_)				\
+	do {								\
+		record.flags	= (flags_);				\
+		record.value	= (value_);				\
+		record.address	= (address_);				\
+		record.data	= (data_);				\
+		tracer_push(tracer, &record);				\
+	} while (0)
+#else
+#define FETCH_TRACE()				((void) 0)
+#define TRACE(flags_, value_, address_, data_)	((void) 0)
+#endif
+#define TRACE_REG()	TRACE(in->regA ? TRACE_FLAG_REG | in->regA : 0,	\
+				regs[in->regA], 0, 0)
+
+	/* mem_write, which leaves the reason in vm->error if it fails */
+#define STORE(address_, value_)						\
+	do {								\
+		if (!mem_write(vm, (address_), (value_)))		\
+			goto fault;					\
+	} while (0)
+
+	/* The rest of a superinstruction, after its first instruction. As
+	 * with FETCH, r0 is cleared before each instruction. */
+#define FUSED_NEXT()							\
+	do {								\
+		in	+= 1;						\
+		pc	+= 1;						\
+		steps	+= 1;						\
+		regs[0]	= 0;						\
+		COUNT();						\
+	} while (0)
+
+#if THREADED_DISPATCH
+	__extension__ static void* const handlers[NUM_HANDLERS] = {
+		[ADD]	= &&op_add,	[ADDI]	= &&op_addi,
+		[NAND]	= &&op_nand,	[LUI]	= &&op_lui,
+		[SW]	= &&op_sw,	[LW]	= &&op_lw,
+		[BEQ]	= &&op_beq,	[JALR]	= &&op_jalr,
+		[EXT]	= &&op_ext,
+#if RUN_FUSE
+		[FUSED(FUSE_LUI_ADDI, LUI)]	= &&op_lui_addi,
+		[FUSED(FUSE_NAND_NAND, NAND)]	= &&op_nand_nand,
+		[FUSED(FUSE_NAND3, NAND)]	= &&op_nand3,
+		[FUSED(FUSE_ADDI_BEQ, ADDI)]	= &&op_addi_beq,
+		[FUSED(FUSE_SW_SW, SW)]		= &&op_sw_sw,
+		[FUSED(FUSE_LW_LW, LW)]		= &&op_lw_lw,
+#endif
+	};
+#define DISPATCH()	do { FETCH(); __extension__ ({ goto *handlers[HANDLER()]; }); } while (0)
+#define CASE(label, op)	label:
+#define NEXT()		DISPATCH()
+
+#if RUN_FUSE
+run:
+#endif
+	DISPATCH();
+#else
+#define CASE(label, op)	case op:
+#define NEXT()		continue
+
+#if RUN_FUSE
+run:
+#endif
+	for (;;) {
+		FETCH();
+		switch (HANDLER()) {
+#endif
+
+	CASE(op_add, ADD)
+		regs[in->regA] = regs[in->regB] + regs[in->regC];
+		TRACE_REG();
+		VERBOSE("add r%d, r%d, r%d\n", in->regA, in->regB, in->regC);
+		NEXT();
+
+	CASE(op_addi, ADDI)
+		regs[in->regA] = regs[in->regB] + in->simm;
+		TRACE_REG();
+		VERBOSE("addi r%d, r%d, "PRINT_FORMAT"\n",
+				in->regA, in->regB, in->simm);
+		NEXT();
+
+	CASE(op_nand, NAND)
+		regs[in->regA] = ~(regs[in->regB] & regs[in->regC]);
+		TRACE_REG();
+		VERBOSE("nand r%d, r%d, r%d\n", in->regA, in->regB, in->regC);
+		NEXT();
+
+	CASE(op_lui, LUI)
+		regs[in->regA] = in->uimm << 6;
+		TRACE_REG();
+		VERBOSE("lui r%d, "PRINT_FORMAT"\n", in->regA, in->uimm);
+		NEXT();
+
+	CASE(op_sw, SW)
+		address = regs[in->regB] + in->simm;
+		STORE(address, regs[in->regA]);
+		TRACE(TRACE_FLAG_MEM, 0, address, regs[in->regA]);
+		redecode_if_text(vm, address);
+		VERBOSE("sw r%d, r%d, "PRINT_FORMAT"\n",
+				in->regA, in->regB, in->simm);
+		NEXT();
+
+	CASE(op_lw, LW)
+		VERBOSE("lw r%d, r%d, "PRINT_FORMAT"\n",
+				in->regA, in->regB, in->simm);
+		address = regs[in->regB] + in->simm;
+		regs[in->regA] = mem_read(vm, address);
+		TRACE_REG();
+		NEXT();
+
+	CASE(op_beq, BEQ)
+		if (regs[in->regA] == regs[in->regB]) {
+			PROFILE(taken, (uint16_t) (pc - 1));
+			TAKEN();
+			pc += in->simm;
+			VERBOSE("<< Equal contents >>\n");
+		}
+		TRACE(0, 0, 0, 0);
+		VERBOSE("beq r%d, r%d, "PRINT_FORMAT"\n",
+				in->regA, in->regB, in->simm);
+		NEXT();
+
+	CASE(op_jalr, JALR)
+		regs[in->regA] = pc;
+		pc = regs[in->regB];
+		PROFILE(calls, pc);
+		TRACE_REG();
+		VERBOSE("jalr r%d, r%d\n", in->regA, in->regB);
+		NEXT();
+
+	CASE(op_ext, EXT)
+		regs[in->regA] = extension_result(in->operation,
+					regs[in->regB], regs[in->regC]);
+		TRACE_REG();
+		VERBOSE("%s r%d, r%d, r%d\n", extension_names[in->operation],
+				in->regA, in->regB, in->regC);
+		NEXT();
+
+#if RUN_FUSE
+	CASE(op_lui_addi, FUSED(FUSE_LUI_ADDI, LUI))
+		regs[in->regA] = in->uimm << 6;
+		FUSED_NEXT();
+		regs[in->regA] = regs[in->regB] + in->simm;
+		NEXT();
+
+	CASE(op_nand_nand, FUSED(FUSE_NAND_NAND, NAND))
+		regs[in->regA] = ~(regs[in->regB] & regs[in->regC]);
+		FUSED_NEXT();
+		regs[in->regA] = ~(regs[in->regB] & regs[in->regC]);
+		NEXT();
+
+	CASE(op_nand3, FUSED(FUSE_NAND3, NAND))
+		regs[in->regA] = ~(regs[in->regB] & regs[in->regC]);
+		FUSED_NEXT();
+		regs[in->regA] = ~(regs[in->regB] & regs[in->regC]);
+		FUSED_NEXT();
+		regs[in->regA] = ~(regs[in->regB] & regs[in->regC]);
+		NEXT();
+
+	CASE(op_addi_beq, FUSED(FUSE_ADDI_BEQ, ADDI))
+		regs[in->regA] = regs[in->regB] + in->simm;
+		FUSED_NEXT();
+		if (regs[in->regA] == regs[in->regB]) {
+			TAKEN();
+			pc += in->simm;
+		}
+		NEXT();
+
+	CASE(op_sw_sw, FUSED(FUSE_SW_SW, SW))
+		address = regs[in->regB] + in->simm;
+		STORE(address, regs[in->regA]);
+		if ((uint16_t) (address - text_start) < text_size) {
+			/* The next instruction may just have changed */
+			redecode_if_text(vm, address);
+			NEXT();
+		}
+		FUSED_NEXT();
+		address = regs[in->regB] + in->simm;
+		STORE(address, regs[in->regA]);
+		redecode_if_text(vm, address);
+		NEXT();
+
+	CASE(op_lw_lw, FUSED(FUSE_LW_LW, LW))
+		address = regs[in->regB] + in->simm;
+		regs[in->regA] = mem_read(vm, address);
+		FUSED_NEXT();
+		address = regs[in->regB] + in->simm;
+		regs[in->regA] = mem_read(vm, address);
+		NEXT();
+#endif
+
+#if !THREADED_DISPATCH
+		}
+	}
+#endif
+
+	/* Take back the store that failed, which is where the VM stops */
+fault:
+	pc	-= 1;
+	steps	-= 1;
+	halt	= true;
+#if RUN_STATS
+	counts[SW] -= 1;
+#endif
+#if RUN_PROFILE
+	profile->hits[pc] -= 1;
+#endif
+
+stop:
+#if RUN_FUSE
+	/* Finish the budget one instruction at a time */
+	if (!halt && steps < max_steps) {
+		mask	= HANDLER_OPCODE;
+		limit	= max_steps;
+		goto run;
+	}
+#endif
+
+#undef HANDLER
+#undef COUNT
+#undef TAKEN
+#undef PROFILE
+#undef VERBOSE
+#undef PAUSE
+#undef FETCH
+#undef FETCH_TRACE
+#undef FUSED_NEXT
+#undef TRACE
+#undef TRACE_REG
+#undef STORE
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+
+#if RUN_STATS
+	if (vm->stats != NULL)
+		stats_add(vm->stats, counts, taken);
+#endif
+
+	regs[0] = 0;
+	memcpy(vm->regs, regs, sizeof regs);
+	vm->pc		= pc;
+	vm->is_running	= !halt;
+
+	return steps;
+}
+
+#undef RUN_NAME
+#undef RUN_FUSE
+#undef RUN_PROFILE
+#undef RUN_TRACE
+#undef RUN_STATS
+#undef RUN_VERBOSE
+#undef RUN_STEP
@@ -0,0 +1,76 @@
+/* io.c */
+
+#include "io.h"
+#include "memory.h"
+#include "vm_internal.h"
+
+#define IO_PAGE		(IO_BASE >> PAGE_BITS)
+
+static uint16_t*	io_page		(RiscyVM* vm);
+
+vm_error_t io_attach(RiscyVM* vm)
+{
+	/* Get the page now, so that attaching cannot fail halfway */
+	if (io_page(vm) == NULL)
+		return vm->error;
+
+	vm->io = true;
+
+	/* The first push goes just below the registers */
+	if (vm->regs[7] == STACK_BOTTOM)
+		vm->regs[7] = IO_BASE;
+	if (vm->origin != NULL && vm->origin->regs[7] == STACK_BOTTOM)
+		vm->origin->regs[7] = IO_BASE;
+
+	return VM_OK;
+}
+
+bool io_store(RiscyVM* vm, uint16_t address, uint16_t value)
+{
+	if (io_page(vm) == NULL)
+		return false;
+
+	if (vm->output != NULL && address >= OUTPUT_BYTE
+			&& address <= OUTPUT_STATUS) {
+		if (!output_store(vm->output, address, value)) {
+			vm->error = VM_ERROR_WRITE;
+			return false;
+		}
+	} else if (vm->xmem != NULL && address == XMEM_BANK) {
+		xmem_select(vm, value);
+	}
+
+	return io_refresh(vm) == VM_OK;
+}
+
+vm_error_t io_refresh(RiscyVM* vm)
+{
+	uint16_t* page;
+
+	if (!vm->io)
+		return VM_OK;
+
+	page = io_page(vm);
+	if (page == NULL)
+		return vm->error;
+
+	if (vm->output != NULL)
+		page[OUTPUT_STATUS & PAGE_MASK] = output_space(vm->output);
+	if (vm->xmem != NULL) {
+		page[XMEM_BANK & PAGE_MASK]	= vm->xmem->bank;
+		page[XMEM_BANKS & PAGE_MASK]	= vm->xmem->nbr_banks;
+	}
+
+	return VM_OK;
+}
+
+/* The page is made private, like for any store, but stores keep coming to
+ * io_store rather than going to it. Once private, it stays so until VM_reset
+ * or VM_clone share it again. */
+static uint16_t* io_page(RiscyVM* vm)
+{
+	uint16_t* page = memory_fault(vm, IO_PAGE);
+
+	vm->wpages[IO_PAGE] = NULL;
+	return page;
+}
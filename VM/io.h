@@ -0,0 +1,51 @@
+/*
+ * io.h
+ *
+ * Memory-mapped devices. The top page of memory, from IO_BASE, holds the
+ * registers of the devices a VM may have attached: the output port (see
+ * output.h) and extended memory (see xmem.h). Once a device is attached, the
+ * page belongs to the devices rather than to the program, and the stack
+ * starts below it instead of at the top of memory.
+ *
+ * The page is never writable in place, so every store into it takes the
+ * slow path of mem_write, which hands it to io_store. This works the same
+ * from the interpreters, lockstep, the JIT and aot code, which all leave
+ * stores into such pages to mem_write. Loads need no help: the registers
+ * that can be read are kept up to date in the page itself. Stores to a word
+ * no device uses are dropped.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IO_BASE		(0xff00)		/* The top page of memory */
+
+/**
+ * io_attach
+ * 	Called by a device about to be attached to `vm`, which then sets its
+ * 	pointer in the VM and calls io_refresh. If r7 is still at the top of
+ * 	memory, the stack is moved below the page of registers, also for
+ * 	VM_reset. Nothing changes if this fails.
+ */
+vm_error_t	io_attach	(RiscyVM* vm);
+
+/**
+ * io_store
+ * 	Called by mem_write for a store into the page of registers. Returns
+ * 	false, with vm->error set, if the store fails.
+ */
+bool		io_store	(RiscyVM* vm, uint16_t address, uint16_t value);
+
+/**
+ * io_refresh
+ * 	Writes the registers that can be read into the page, e.g. after
+ * 	VM_reset gave the VM its memory as loaded.
+ */
+vm_error_t	io_refresh	(RiscyVM* vm);
+
+#endif
@@ -0,0 +1,724 @@
+/* jit.c */
+
+#define _DEFAULT_SOURCE		/* MAP_ANONYMOUS */
+
+#include "jit.h"
+#include "vm_internal.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_SUPPORTED	1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED	0
+#endif
+
+#define JIT_CODE_SIZE		(1 << 20)	/* Bytes of executable memory */
+#define JIT_MAX_BLOCK		(64)		/* Instructions per block */
+#define JIT_MAX_INSN_BYTES	(128)		/* Upper bound per instruction */
+#define JIT_MAX_EXITS		(2 * JIT_MAX_BLOCK + 2)	/* Per block: two for
+							   each store, and a
+							   jump's two */
+
+/* A translated block is called as  r = block(vm->regs, vm->pages, budget)
+ * and keeps running, chaining directly from block to block, until it reaches
+ * a jump it cannot follow or `budget` would not cover the next block. On
+ * return, r.budget is the budget left and r.exit holds the next pc in bits
+ * 0-15 along with the EXIT_ flags below.
+ */
+#define EXIT_PC(r)	((uint16_t) ((r) & 0xffff))
+#define EXIT_SLOW	(UINT32_C(1) << 16)	/* Stopped in front of an
+						   instruction (a store into
+						   text) the interpreter has
+						   to execute */
+#define EXIT_HALT	(UINT32_C(1) << 17)	/* Executed the last
+						   instruction of the text */
+
+typedef struct	block_result	block_result;
+typedef struct	patch_t		patch_t;
+typedef struct	jit_exit_t	jit_exit_t;
+
+struct block_result {
+	uint64_t	exit;
+	int64_t		budget;
+};
+
+typedef block_result	(*block_fn)	(uint16_t* regs, uint16_t** pages,
+					 int64_t budget);
+
+/* An exit of a block with a known target that is not yet translated. Once
+ * the target is, the exit is patched into a direct jump. */
+struct patch_t {
+	uint8_t*	site;		/* Start of the patchable bytes */
+	int32_t		next;		/* Next patch with the same target */
+};
+
+/* With stats attached, every exit of a block counts the times it is taken.
+ * What the block executed on the way there is known when it is translated,
+ * so the stats are the hits of each exit times its tallies. */
+struct jit_exit_t {
+	uint64_t	hits;
+	uint8_t		counts[STATS_NUM_OPCODES];	/* Executed before the
+							   exit, by opcode */
+	bool		taken;		/* The taken side of a BEQ */
+};
+
+struct jit_t {
+	uint8_t*	code;		/* mmap'd buffer of native code */
+	size_t		used;		/* Bytes of `code` in use */
+	uint8_t**	entry;		/* Block starting at each word of text,
+					   or NULL if not yet translated */
+	uint16_t*	length;		/* Instructions in each block */
+	int32_t*	pending;	/* First patch waiting for each word */
+	patch_t*	patches;	/* All patches, linked by target */
+	int32_t		nbr_patches;
+	int32_t		max_patches;
+	jit_exit_t*	exits;		/* Exits that count, if `counting` */
+	int32_t		nbr_exits;
+	int32_t		max_exits;
+	uint64_t	text_writes;	/* vm->text_writes at creation */
+	bool		disabled;	/* Text was modified; interpret */
+	bool		counting;	/* Blocks count for vm->stats */
+};
+
+#if JIT_SUPPORTED
+
+static jit_t*	jit_create	(RiscyVM* vm);
+static uint8_t*	jit_lookup	(RiscyVM* vm, jit_t* jit, uint16_t pc);
+static uint8_t*	jit_compile	(RiscyVM* vm, jit_t* jit, uint16_t pc);
+static void	jit_flush	(RiscyVM* vm, jit_t* jit);
+static bool	jit_count	(RiscyVM* vm, jit_t* jit);
+static void	jit_fold	(RiscyVM* vm, jit_t* jit);
+
+uint64_t JIT_run(RiscyVM* vm, uint64_t max_steps)
+{
+	jit_t*		jit;
+	uint8_t*	code;
+	block_fn	block;
+	block_result	result;
+	int64_t		budget;
+	uint64_t	steps	= 0;
+
+	if (vm->jit == NULL)
+		vm->jit = jit_create(vm);
+
+	jit = vm->jit;
+	if (jit == NULL || !jit_count(vm, jit))
+		return VM_run(vm, max_steps);
+
+	while (vm->is_running && steps < max_steps) {
+
+		/* Self-modifying code is left to the interpreter */
+		if (jit->disabled || vm->text_writes != jit->text_writes) {
+			jit->disabled = true;
+			steps += VM_run(vm, max_steps - steps);
+			break;
+		}
+
+		code	= jit_lookup(vm, jit, vm->pc);
+		budget	= max_steps - steps > INT64_MAX ? INT64_MAX
+						: (int64_t) (max_steps - steps);
+
+		/* Outside of text, or too close to the step budget */
+		if (code == NULL || jit->length[vm->pc
+				- vm->metadata.text_start] > budget) {
+			steps += VM_run(vm, 1);
+			continue;
+		}
+
+		memcpy(&block, &code, sizeof block);
+		vm->regs[0]	= 0;
+		result		= block(vm->regs, vm->pages, budget);
+
+		vm->pc	= EXIT_PC(result.exit);
+		steps	+= budget - result.budget;
+
+		if (result.exit & EXIT_HALT)
+			vm->is_running = false;
+
+		if (result.exit & EXIT_SLOW && steps < max_steps)
+			steps += VM_run(vm, 1);
+	}
+
+	jit_fold(vm, jit);
+	return steps;
+}
+
+void JIT_free(jit_t* jit)
+{
+	if (jit == NULL)
+		return;
+
+	if (jit->code != NULL)
+		munmap(jit->code, JIT_CODE_SIZE);
+	free(jit->entry);
+	free(jit->length);
+	free(jit->pending);
+	free(jit->patches);
+	free(jit->exits);
+	free(jit);
+}
+
+static jit_t* jit_create(RiscyVM* vm)
+{
+	jit_t*		jit;
+	uint16_t	text_size = vm->metadata.text_size;
+
+	jit = calloc(1, sizeof *jit);
+	if (jit == NULL)
+		return NULL;
+
+	jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED)
+		jit->code = NULL;
+
+	jit->entry	= calloc(text_size + 1, sizeof *jit->entry);
+	jit->length	= calloc(text_size + 1, sizeof *jit->length);
+	jit->pending	= malloc((text_size + 1) * sizeof *jit->pending);
+	jit->text_writes = vm->text_writes;
+
+	/* Each block has at most two exits, and no more than one block can
+	 * start at each word of text. */
+	jit->max_patches = 2 * text_size + 2;
+	jit->patches	 = malloc(jit->max_patches * sizeof *jit->patches);
+
+	if (jit->code == NULL || jit->entry == NULL || jit->length == NULL
+	|| jit->pending == NULL || jit->patches == NULL) {
+		JIT_free(jit);
+		return NULL;
+	}
+
+	jit_flush(vm, jit);
+
+	return jit;
+}
+
+static uint8_t* jit_lookup(RiscyVM* vm, jit_t* jit, uint16_t pc)
+{
+	uint16_t offset = pc - vm->metadata.text_start;
+
+	if (offset >= vm->metadata.text_size)
+		return NULL;
+
+	if (jit->entry[offset] == NULL)
+		jit->entry[offset] = jit_compile(vm, jit, pc);
+
+	return jit->entry[offset];
+}
+
+/* Throws away every translated block, e.g. when the code buffer is full,
+ * after adding up what they counted */
+static void jit_flush(RiscyVM* vm, jit_t* jit)
+{
+	uint16_t text_size = vm->metadata.text_size;
+
+	jit_fold(vm, jit);
+	jit->nbr_exits = 0;
+
+	memset(jit->entry, 0, text_size * sizeof *jit->entry);
+	memset(jit->length, 0, text_size * sizeof *jit->length);
+	for (int i = 0; i < text_size; ++i)
+		jit->pending[i] = -1;
+
+	jit->used	 = 0;
+	jit->nbr_patches = 0;
+}
+
+/* Makes the blocks count if stats are attached, and stop if they are not,
+ * translating them again if that changes. Returns false if out of memory. */
+static bool jit_count(RiscyVM* vm, jit_t* jit)
+{
+	bool counting = vm->stats != NULL;
+
+	if (counting == jit->counting)
+		return true;
+
+	if (counting && jit->exits == NULL) {
+		jit->max_exits	= 2 * jit->max_patches + JIT_MAX_EXITS;
+		jit->exits	= malloc(jit->max_exits * sizeof *jit->exits);
+		if (jit->exits == NULL)
+			return false;
+	}
+
+	jit_flush(vm, jit);
+	jit->counting = counting;
+	return true;
+}
+
+/* Adds what the exits counted to vm->stats, and starts them over */
+static void jit_fold(RiscyVM* vm, jit_t* jit)
+{
+	uint64_t	counts[STATS_NUM_OPCODES] = { 0 };
+	uint64_t	taken	= 0;
+	jit_exit_t*	exit;
+
+	for (int32_t i = 0; i < jit->nbr_exits; ++i) {
+		exit = &jit->exits[i];
+		for (int k = 0; k < STATS_NUM_OPCODES; ++k)
+			counts[k] += exit->hits * exit->counts[k];
+		if (exit->taken)
+			taken += exit->hits;
+		exit->hits = 0;
+	}
+
+	if (vm->stats != NULL && jit->nbr_exits > 0)
+		stats_add(vm->stats, counts, taken);
+}
+
+/*
+ * Code emission.
+ *
+ * 	rdi	= vm->regs	(register rX lives at [rdi + 2 * X])
+ * 	rsi	= vm->pages	(vm->wpages follows at WPAGES bytes)
+ * 	rdx	= budget	(instructions left to execute)
+ * 	eax, ecx, r9d	scratch
+ *
+ * r0 is never written, so it reads as 0 for the whole run. All 16-bit
+ * results are stored with 16-bit moves, which gives the same wraparound as
+ * the uint16_t arithmetic in the interpreter.
+ */
+
+#define REG(x)		((uint8_t) (2 * (x)))
+#define WPAGES		((uint32_t) (offsetof(RiscyVM, wpages) \
+				- offsetof(RiscyVM, pages)))
+#define CHAIN_SIZE	(11)	/* Bytes of a patchable chain */
+
+static uint8_t* emit8(uint8_t* p, uint8_t b)
+{
+	*p++ = b;
+	return p;
+}
+
+static uint8_t* emit16(uint8_t* p, uint16_t w)
+{
+	*p++ = w & 0xff;
+	*p++ = w >> 8;
+	return p;
+}
+
+static uint8_t* emit32(uint8_t* p, uint32_t d)
+{
+	p = emit16(p, d & 0xffff);
+	return emit16(p, d >> 16);
+}
+
+/* movzx eax, word [rdi + REG(r)] */
+static uint8_t* load_eax(uint8_t* p, uint16_t r)
+{
+	p = emit8(p, 0x0f); p = emit8(p, 0xb7);
+	p = emit8(p, 0x47); return emit8(p, REG(r));
+}
+
+/* mov word [rdi + REG(r)], ax */
+static uint8_t* store_ax(uint8_t* p, uint16_t r)
+{
+	p = emit8(p, 0x66); p = emit8(p, 0x89);
+	p = emit8(p, 0x47); return emit8(p, REG(r));
+}
+
+/* <op> ax, word [rdi + REG(r)]		(0x03 add, 0x23 and, 0x3b cmp) */
+static uint8_t* op_ax_reg(uint8_t* p, uint8_t op, uint16_t r)
+{
+	p = emit8(p, 0x66); p = emit8(p, op);
+	p = emit8(p, 0x47); return emit8(p, REG(r));
+}
+
+/* mov word [rdi + REG(r)], imm16 */
+static uint8_t* store_imm(uint8_t* p, uint16_t r, uint16_t imm)
+{
+	p = emit8(p, 0x66); p = emit8(p, 0xc7);
+	p = emit8(p, 0x47); p = emit8(p, REG(r));
+	return emit16(p, imm);
+}
+
+/* eax = (uint16_t) (regs[r] + simm), i.e. a memory address */
+static uint8_t* address_eax(uint8_t* p, uint16_t r, uint16_t simm)
+{
+	p = load_eax(p, r);
+	p = emit8(p, 0x05); p = emit32(p, simm);		/* add eax, imm32 */
+	p = emit8(p, 0x0f); p = emit8(p, 0xb7);
+	return emit8(p, 0xc0);				/* movzx eax, ax */
+}
+
+/* eax = extension_result(in->operation, regs[B], regs[C]). Division needs
+ * edx, so the budget is kept in r9 around it. */
+static uint8_t* extension_eax(uint8_t* p, const instruction_t* in)
+{
+	if (in->operation == EXT_SRA) {
+		p = emit8(p, 0x0f); p = emit8(p, 0xbf);
+		p = emit8(p, 0x47); p = emit8(p, REG(in->regB));
+						/* movsx eax, word [rdi + ..] */
+	} else {
+		p = load_eax(p, in->regB);
+	}
+	p = emit8(p, 0x0f); p = emit8(p, 0xb7);
+	p = emit8(p, 0x4f); p = emit8(p, REG(in->regC));
+						/* movzx ecx, word [rdi + ..] */
+
+	switch (in->operation) {
+	case EXT_MUL:
+	case EXT_MULH:
+		p = emit8(p, 0x0f); p = emit8(p, 0xaf);
+		p = emit8(p, 0xc1);			/* imul eax, ecx */
+		if (in->operation == EXT_MULH) {
+			p = emit8(p, 0xc1); p = emit8(p, 0xe8);
+			p = emit8(p, 16);		/* shr eax, 16 */
+		}
+		break;
+
+	case EXT_DIVU:
+	case EXT_REMU:
+		p = emit8(p, 0x85); p = emit8(p, 0xc9);	/* test ecx, ecx */
+		p = emit8(p, 0x74); p = emit8(p, 12);	/* jz +12 */
+		p = emit8(p, 0x49); p = emit8(p, 0x89);
+		p = emit8(p, 0xd1);			/* mov r9, rdx */
+		p = emit8(p, 0x31); p = emit8(p, 0xd2);	/* xor edx, edx */
+		p = emit8(p, 0xf7); p = emit8(p, 0xf1);	/* div ecx */
+		if (in->operation == EXT_REMU) {
+			p = emit8(p, 0x89); p = emit8(p, 0xd0);
+		}					/* mov eax, edx */
+		p = emit8(p, 0x4c); p = emit8(p, 0x89);
+		p = emit8(p, 0xca);			/* mov rdx, r9 */
+		if (in->operation == EXT_DIVU) {
+			p = emit8(p, 0xeb); p = emit8(p, 5);	/* jmp +5 */
+			p = emit8(p, 0xb8);
+			p = emit32(p, 0xffff);		/* mov eax, 0xffff */
+		}
+		break;
+
+	default:
+		p = emit8(p, 0x83); p = emit8(p, 0xe1);
+		p = emit8(p, 15);			/* and ecx, 15 */
+		p = emit8(p, 0xd3);			/* shl/shr/sar eax, cl */
+		p = emit8(p, in->operation == EXT_SLL ? 0xe0
+				: in->operation == EXT_SRL ? 0xe8 : 0xf8);
+		break;
+	}
+
+	return p;
+}
+
+/* rcx = pages[eax >> PAGE_BITS], or wpages[...] for `writable`;
+ * eax = eax & PAGE_MASK */
+static uint8_t* page_rcx(uint8_t* p, bool writable)
+{
+	p = emit8(p, 0x89); p = emit8(p, 0xc1);		/* mov ecx, eax */
+	p = emit8(p, 0xc1); p = emit8(p, 0xe9);
+	p = emit8(p, PAGE_BITS);				/* shr ecx, .. */
+	p = emit8(p, 0x48); p = emit8(p, 0x8b);
+	if (writable) {				/* mov rcx, [rsi + rcx*8 + ..] */
+		p = emit8(p, 0x8c); p = emit8(p, 0xce);
+		p = emit32(p, WPAGES);
+	} else {				/* mov rcx, [rsi + rcx*8] */
+		p = emit8(p, 0x0c); p = emit8(p, 0xce);
+	}
+	return p;
+}
+
+/* movzx eax, al */
+static uint8_t* page_offset_eax(uint8_t* p)
+{
+	p = emit8(p, 0x0f); p = emit8(p, 0xb6);
+	return emit8(p, 0xc0);
+}
+
+/* sub rdx, count */
+static uint8_t* charge(uint8_t* p, uint16_t count)
+{
+	p = emit8(p, 0x48); p = emit8(p, 0x83);
+	p = emit8(p, 0xea); return emit8(p, (uint8_t) count);
+}
+
+/* mov eax, imm32; ret */
+static uint8_t* exit_imm(uint8_t* p, uint32_t exit)
+{
+	p = emit8(p, 0xb8); p = emit32(p, exit);
+	return emit8(p, 0xc3);
+}
+
+/* When counting, adds an exit after the instructions in `counts`, and
+ * counts it:  mov rcx, &exit->hits;  inc qword [rcx] */
+static uint8_t* count_exit(jit_t* jit, uint8_t* p, const uint8_t counts[],
+				bool taken)
+{
+	jit_exit_t* exit;
+
+	if (!jit->counting || jit->nbr_exits == jit->max_exits)
+		return p;
+
+	exit		= &jit->exits[jit->nbr_exits++];
+	exit->hits	= 0;
+	exit->taken	= taken;
+	memcpy(exit->counts, counts, sizeof exit->counts);
+
+	p = emit8(p, 0x48); p = emit8(p, 0xb9);
+	p = emit32(p, (uint32_t) (uintptr_t) &exit->hits);
+	p = emit32(p, (uint32_t) ((uint64_t) (uintptr_t) &exit->hits >> 32));
+	p = emit8(p, 0x48); p = emit8(p, 0xff);
+	return emit8(p, 0x01);
+}
+
+/* Leaves the block for the interpreter in front of the store at `at`, after
+ * the `count` instructions before it */
+static uint8_t* exit_slow(jit_t* jit, uint8_t* p, uint16_t at, uint16_t count,
+				const uint8_t counts[])
+{
+	uint8_t before[STATS_NUM_OPCODES];
+
+	memcpy(before, counts, sizeof before);
+	before[SW] -= 1;
+
+	p = count_exit(jit, p, before, false);
+	p = charge(p, count);
+	return exit_imm(p, at | EXIT_SLOW);
+}
+
+/* Writes a chain into the block at `target`, of `length` instructions, over
+ * the CHAIN_SIZE bytes at `site`:
+ * 	cmp rdx, length;  jl +5;  jmp target
+ */
+static void write_chain(uint8_t* site, uint8_t* target, uint16_t length)
+{
+	uint8_t* p = site;
+
+	p = emit8(p, 0x48); p = emit8(p, 0x83);
+	p = emit8(p, 0xfa); p = emit8(p, (uint8_t) length);
+	p = emit8(p, 0x7c); p = emit8(p, 5);
+	p = emit8(p, 0xe9);
+	emit32(p, (uint32_t) (target - (p + 4)));
+}
+
+/* Leaves the block for `target`, after `count` of its instructions. When
+ * the target is another word of text, this is a chain (patched later if the
+ * target is not yet translated), followed by a plain exit to JIT_run for
+ * when the budget runs short.
+ */
+static uint8_t* exit_to(RiscyVM* vm, jit_t* jit, uint8_t* p,
+				uint16_t target, uint16_t count, bool halt)
+{
+	uint16_t offset = target - vm->metadata.text_start;
+
+	p = charge(p, count);
+
+	if (halt)
+		return exit_imm(p, target | EXIT_HALT);
+
+	if (offset < vm->metadata.text_size) {
+		if (jit->entry[offset] != NULL) {
+			write_chain(p, jit->entry[offset],
+					jit->length[offset]);
+		} else {
+			if (jit->nbr_patches < jit->max_patches) {
+				patch_t* patch =
+					&jit->patches[jit->nbr_patches];
+				patch->site	= p;
+				patch->next	= jit->pending[offset];
+				jit->pending[offset] = jit->nbr_patches++;
+			}
+
+			/* jmp over the chain, until it is patched */
+			emit8(p, 0xeb);	emit8(p + 1, CHAIN_SIZE - 2);
+		}
+		p += CHAIN_SIZE;
+	}
+
+	return exit_imm(p, target);
+}
+
+/* Points every exit waiting for the block at `pc` straight at it */
+static void apply_patches(RiscyVM* vm, jit_t* jit, uint16_t pc)
+{
+	uint16_t	offset	= pc - vm->metadata.text_start;
+	int32_t		i	= jit->pending[offset];
+
+	while (i >= 0) {
+		write_chain(jit->patches[i].site, jit->entry[offset],
+				jit->length[offset]);
+		i = jit->patches[i].next;
+	}
+	jit->pending[offset] = -1;
+}
+
+/* Translates the block starting at `pc`. Returns NULL if it could not. */
+static uint8_t* jit_compile(RiscyVM* vm, jit_t* jit, uint16_t pc)
+{
+	metadata_t*		md	= &vm->metadata;
+	const instruction_t*	in;
+	uint8_t*		start;
+	uint8_t*		p;
+	uint8_t*		skip;
+	uint16_t		at	= pc;
+	uint16_t		last	= md->text_header + md->text_size;
+	uint16_t		count	= 0;
+	uint8_t			counts[STATS_NUM_OPCODES] = { 0 };
+	bool			ended	= false;
+
+	if (JIT_CODE_SIZE - jit->used < JIT_MAX_BLOCK * JIT_MAX_INSN_BYTES
+			|| (jit->counting && jit->max_exits - jit->nbr_exits
+						< JIT_MAX_EXITS))
+		jit_flush(vm, jit);
+
+	start	= jit->code + jit->used;
+	p	= start;
+
+	if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0)
+		return NULL;
+
+	while (!ended) {
+		in	= &vm->decoded[at - md->text_start];
+		count	+= 1;
+		counts[in->opcode] += 1;
+
+		switch (in->opcode) {
+		case ADD:
+		case NAND:
+			if (in->regA == 0)
+				break;
+			p = load_eax(p, in->regB);
+			p = op_ax_reg(p, in->opcode == ADD ? 0x03 : 0x23,
+					in->regC);
+			if (in->opcode == NAND) {
+				p = emit8(p, 0xf7); p = emit8(p, 0xd0);
+			}					/* not eax */
+			p = store_ax(p, in->regA);
+			break;
+
+		case ADDI:
+			if (in->regA == 0)
+				break;
+			p = load_eax(p, in->regB);
+			p = emit8(p, 0x05); p = emit32(p, in->simm);
+			p = store_ax(p, in->regA);
+			break;
+
+		case LUI:
+			if (in->regA != 0)
+				p = store_imm(p, in->regA, in->uimm << 6);
+			break;
+
+		case LW:
+			if (in->regA == 0)
+				break;
+			p = address_eax(p, in->regB, in->simm);
+			p = page_rcx(p, false);
+			p = page_offset_eax(p);
+			p = emit8(p, 0x0f); p = emit8(p, 0xb7);
+			p = emit8(p, 0x04); p = emit8(p, 0x41);
+						/* movzx eax, [rcx + rax*2] */
+			p = store_ax(p, in->regA);
+			break;
+
+		case SW:
+			p = address_eax(p, in->regB, in->simm);
+
+			/* Stores into text, and into pages that have to be
+			 * copied first, go through the interpreter. */
+			p = emit8(p, 0x89); p = emit8(p, 0xc1);	/* mov ecx,eax*/
+			p = emit8(p, 0x81); p = emit8(p, 0xe9);
+			p = emit32(p, md->text_start);		/* sub ecx, .. */
+			p = emit8(p, 0x81); p = emit8(p, 0xf9);
+			p = emit32(p, md->text_size);		/* cmp ecx, .. */
+			p = emit8(p, 0x73); p = emit8(p, 0);	/* jae over   */
+			skip = p;
+			p = exit_slow(jit, p, at, count - 1, counts);
+			skip[-1] = (uint8_t) (p - skip);
+
+			p = page_rcx(p, true);
+			p = emit8(p, 0x48); p = emit8(p, 0x85);
+			p = emit8(p, 0xc9);			/* test rcx,rcx*/
+			p = emit8(p, 0x75); p = emit8(p, 0);	/* jnz over   */
+			skip = p;
+			p = exit_slow(jit, p, at, count - 1, counts);
+			skip[-1] = (uint8_t) (p - skip);
+
+			p = page_offset_eax(p);
+			p = emit8(p, 0x44); p = emit8(p, 0x0f);
+			p = emit8(p, 0xb7); p = emit8(p, 0x4f);
+			p = emit8(p, REG(in->regA));	/* movzx r9d, [rdi+..] */
+			p = emit8(p, 0x66); p = emit8(p, 0x44);
+			p = emit8(p, 0x89); p = emit8(p, 0x0c);
+			p = emit8(p, 0x41);	/* mov [rcx + rax*2], r9w */
+			break;
+
+		case BEQ:
+			p = load_eax(p, in->regA);
+			p = op_ax_reg(p, 0x3b, in->regB);
+			p = emit8(p, 0x74); p = emit8(p, 0);	/* je taken */
+			skip = p;
+			p = count_exit(jit, p, counts, false);
+			p = exit_to(vm, jit, p, at + 1, count, at == last);
+			skip[-1] = (uint8_t) (p - skip);
+			p = count_exit(jit, p, counts, true);
+			p = exit_to(vm, jit, p, at + 1 + in->simm, count,
+					at == last);
+			ended = true;
+			break;
+
+		case JALR:
+			/* regs[A] = pc; pc = regs[B]; when A == B, the jump
+			 * goes to the value just written. */
+			if (in->regA != 0)
+				p = store_imm(p, in->regA, at + 1);
+
+			p = count_exit(jit, p, counts, false);
+			if (in->regA == in->regB) {
+				p = exit_to(vm, jit, p, at + 1, count,
+						at == last);
+			} else {
+				p = charge(p, count);
+				p = load_eax(p, in->regB);
+				if (at == last) {		/* or eax, .. */
+					p = emit8(p, 0x0d);
+					p = emit32(p, EXIT_HALT);
+				}
+				p = emit8(p, 0xc3);		/* ret */
+			}
+			ended = true;
+			break;
+
+		case EXT:
+			if (in->regA == 0)
+				break;
+			p = extension_eax(p, in);
+			p = store_ax(p, in->regA);
+			break;
+		}
+
+		if (!ended && (at == last || count == JIT_MAX_BLOCK)) {
+			p = count_exit(jit, p, counts, false);
+			p = exit_to(vm, jit, p, at + 1, count, at == last);
+			ended = true;
+		}
+
+		at += 1;
+	}
+
+	jit->length[pc - md->text_start]	= count;
+	jit->entry[pc - md->text_start]		= start;
+	jit->used				+= p - start;
+
+	apply_patches(vm, jit, pc);
+
+	if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0)
+		return NULL;
+
+	return start;
+}
+
+#else /* !JIT_SUPPORTED */
+
+uint64_t JIT_run(RiscyVM* vm, uint64_t max_steps)
+{
+	return VM_run(vm, max_steps);
+}
+
+void JIT_free(jit_t* jit)
+{
+	(void) jit;
+}
+
+#endif
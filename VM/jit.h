@@ -0,0 +1,34 @@
+/*
+ * jit.h
+ *
+ * Optional just-in-time compiler that translates straight-line runs of
+ * RiSC-16 instructions (basic blocks) to native x86-64 code. On any other
+ * host, JIT_run simply falls back to the interpreter.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "vm.h"
+
+#include <stdint.h>
+
+typedef struct	jit_t	jit_t;
+
+/**
+ * JIT_run
+ * 	Same contract as VM_run: runs the program until it halts or
+ * 	`max_steps` instructions have been executed, and returns the number of
+ * 	instructions executed. Blocks are translated the first time they are
+ * 	reached. Once the program stores into its own text, the rest of the
+ * 	run is left to the interpreter.
+ */
+uint64_t	JIT_run		(RiscyVM* vm, uint64_t max_steps);
+
+/**
+ * JIT_free
+ * 	Releases the translated code of a VM. Called by VM_shutdown.
+ */
+void		JIT_free	(jit_t* jit);
+
+#endif
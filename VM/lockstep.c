@@ -0,0 +1,297 @@
+/* lockstep.c */
+
+#include "lockstep.h"
+#include "memory.h"
+#include "vm_internal.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* One 16-bit field per lane. The arithmetic on these is plain GNU C vector
+ * code; the compiler maps it to whatever the target has (two SSE2 registers,
+ * or one AVX2 register). */
+typedef uint16_t	lane_t __attribute__((vector_size(LOCKSTEP_LANES
+						      * sizeof (uint16_t))));
+
+/* On x86-64, run_group is also built for AVX2 and picked at load time */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define VECTOR_TARGETS	__attribute__((target_clones("avx2", "default")))
+#else
+#define VECTOR_TARGETS
+#endif
+
+static int	run_group	(RiscyVM* vms[], int nbr_lanes);
+static void	detach		(RiscyVM* vm, const lane_t regs[], uint16_t pc,
+				 int lane);
+static void	stop		(RiscyVM* vm, const lane_t regs[], uint16_t pc,
+				 int lane);
+static void	tally		(RiscyVM* vms[], int nbr_lanes,
+				 lane_t counts[], lane_t* taken);
+
+int lockstep_run(RiscyVM* vms[], int nbr_vms)
+{
+	int detached = 0;
+
+	for (int i = 0; i < nbr_vms; i += LOCKSTEP_LANES) {
+		detached += run_group(&vms[i], nbr_vms - i < LOCKSTEP_LANES
+				? nbr_vms - i : LOCKSTEP_LANES);
+	}
+	return detached;
+}
+
+/* Lanes whose pc is the lowest of the group execute the next instruction,
+ * the others wait. A lane is in `running` until it halts, stops or is
+ * detached; a detached lane is in `parked`, and is left running for the
+ * caller. Returns the number of lanes detached. */
+VECTOR_TARGETS
+static int run_group(RiscyVM* vms[], int nbr_lanes)
+{
+	metadata_t*		md	= &vms[0]->metadata;
+	uint16_t		last	= md->text_header + md->text_size;
+	instruction_t		in;
+	lane_t			regs[NUM_REGISTERS];
+	lane_t			pcs;
+	lane_t			running;
+	lane_t			active;
+	lane_t			taken;
+	lane_t			parked	= { 0 };
+	uint16_t		address;
+	uint16_t		pc	= 0;
+	int			lead	= -1;	/* A lane at `pc`, attached */
+	bool			together = false;	/* All lanes at `pc` */
+	bool			counting = vms[0]->stats != NULL;
+	lane_t			counts[STATS_NUM_OPCODES] = { { 0 } };
+	lane_t			taken_counts	= { 0 };
+	uint16_t		uncounted	= 0;	/* Steps not tallied */
+
+	for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+		bool used = lane < nbr_lanes;
+
+		for (int r = 0; r < NUM_REGISTERS; ++r) {
+			regs[r][lane] = used && r != 0
+				? vms[lane]->regs[r] : 0;
+		}
+		pcs[lane]	= used ? vms[lane]->pc : 0;
+		running[lane]	= used && vms[lane]->is_running ? 0xffff : 0;
+	}
+
+	for (;;) {
+		/* Lanes that are together stay so until the next jump */
+		if (!together) {
+			lead = -1;
+			for (int lane = 0; lane < nbr_lanes; ++lane) {
+				if (running[lane] && (lead < 0
+						|| pcs[lane] < pc)) {
+					lead	= lane;
+					pc	= pcs[lane];
+				}
+			}
+			if (lead < 0)
+				break;
+
+			together = true;
+			for (int lane = 0; lane < nbr_lanes; ++lane) {
+				if (running[lane] && pcs[lane] != pc)
+					together = false;
+			}
+		}
+
+		active = (lane_t) (pcs == pc) & running;
+
+		/* Data is executed by the interpreter, one lane at a time */
+		if ((uint16_t) (pc - md->text_start) >= md->text_size) {
+			for (int lane = 0; lane < nbr_lanes; ++lane) {
+				if (active[lane]) {
+					detach(vms[lane], regs, pc, lane);
+					running[lane]	= 0;
+					parked[lane]	= 0xffff;
+				}
+			}
+			together = false;
+			continue;
+		}
+
+		/* Lanes with modified text are detached, so the text of any
+		 * attached lane is the original one. The instruction is
+		 * copied, since a lane detached by a store into the text
+		 * rewrites its own table while the others are still at it. */
+		in = vms[lead]->decoded[pc - md->text_start];
+
+		switch (in.opcode) {
+		case ADD:
+			if (in.regA != 0)
+				regs[in.regA] = ((regs[in.regB]
+						+ regs[in.regC]) & active)
+					| (regs[in.regA] & ~active);
+			pcs += active & 1;
+			break;
+
+		case ADDI:
+			if (in.regA != 0)
+				regs[in.regA] = ((regs[in.regB] + in.simm)
+						& active)
+					| (regs[in.regA] & ~active);
+			pcs += active & 1;
+			break;
+
+		case NAND:
+			if (in.regA != 0)
+				regs[in.regA] = (~(regs[in.regB]
+						& regs[in.regC]) & active)
+					| (regs[in.regA] & ~active);
+			pcs += active & 1;
+			break;
+
+		case LUI:
+			if (in.regA != 0)
+				regs[in.regA] = ((uint16_t) (in.uimm << 6)
+						& active)
+					| (regs[in.regA] & ~active);
+			pcs += active & 1;
+			break;
+
+		/* Each lane has its own memory, so loads and stores are done
+		 * lane by lane: a gather would need the host address of every
+		 * lane's page first, which costs as much as the load itself.
+		 * A program heavy in LW and SW therefore gains little here. */
+		case LW:
+			for (int lane = 0; lane < nbr_lanes; ++lane) {
+				if (!active[lane] || in.regA == 0)
+					continue;
+				address = regs[in.regB][lane] + in.simm;
+				regs[in.regA][lane] = mem_read(vms[lane],
+								address);
+			}
+			pcs += active & 1;
+			break;
+
+		case SW:
+			for (int lane = 0; lane < nbr_lanes; ++lane) {
+				if (!active[lane])
+					continue;
+				address = regs[in.regB][lane] + in.simm;
+				if ((uint16_t) (address - md->text_start)
+						< md->text_size) {
+					detach(vms[lane], regs, pc, lane);
+					running[lane]	= 0;
+					active[lane]	= 0;
+					parked[lane]	= 0xffff;
+					continue;
+				}
+				if (!mem_write(vms[lane], address,
+						regs[in.regA][lane])) {
+					stop(vms[lane], regs, pc, lane);
+					running[lane]	= 0;
+					active[lane]	= 0;
+				}
+			}
+			pcs += active & 1;
+			break;
+
+		case BEQ:
+			taken = (lane_t) (regs[in.regA] == regs[in.regB]);
+			pcs += active & (1 + (taken & in.simm));
+			break;
+
+		case JALR:
+			/* regs[A] = pc + 1, pc = regs[B]; when A == B (even
+			 * r0), the jump goes to the value just written */
+			if (in.regA != 0)
+				regs[in.regA] = ((uint16_t) (pc + 1) & active)
+					| (regs[in.regA] & ~active);
+			if (in.regA == in.regB)
+				pcs += active & 1;
+			else
+				pcs = (regs[in.regB] & active)
+					| (pcs & ~active);
+			break;
+
+		/* Division has no vector form, so these go lane by lane */
+		case EXT:
+			for (int lane = 0; lane < nbr_lanes; ++lane) {
+				if (!active[lane] || in.regA == 0)
+					continue;
+				regs[in.regA][lane] = extension_result(
+						in.operation, regs[in.regB][lane],
+						regs[in.regC][lane]);
+			}
+			pcs += active & 1;
+			break;
+		}
+
+		/* The counts are per lane, 16 bits each, and are tallied
+		 * before they can wrap */
+		if (counting) {
+			counts[in.opcode] += active & 1;
+			if (in.opcode == BEQ)
+				taken_counts += active & taken & 1;
+			if (++uncounted == UINT16_MAX) {
+				tally(vms, nbr_lanes, counts, &taken_counts);
+				uncounted = 0;
+			}
+		}
+
+		if (pc == last)
+			running &= ~active;
+
+		together = together && running[lead] && in.opcode != BEQ
+			&& in.opcode != JALR;
+		pc += 1;
+	}
+
+	if (counting)
+		tally(vms, nbr_lanes, counts, &taken_counts);
+
+	int detached = 0;
+
+	for (int lane = 0; lane < nbr_lanes; ++lane) {
+		RiscyVM* vm = vms[lane];
+
+		if (parked[lane])
+			detached += 1;
+		if (!vm->is_running || parked[lane])
+			continue;
+		for (int r = 0; r < NUM_REGISTERS; ++r)
+			vm->regs[r] = regs[r][lane];
+		vm->pc		= pcs[lane];
+		vm->is_running	= false;
+	}
+	return detached;
+}
+
+/* Takes a lane that is about to execute the instruction at `pc` out of its
+ * group. The VM keeps running, at `pc`, for the caller to finish; finishing
+ * it here would hold up the rest of the group. */
+static void detach(RiscyVM* vm, const lane_t regs[], uint16_t pc, int lane)
+{
+	for (int r = 0; r < NUM_REGISTERS; ++r)
+		vm->regs[r] = regs[r][lane];
+	vm->pc = pc;
+}
+
+/* Leaves a lane whose store at `pc` failed stopped there, as VM_run would */
+static void stop(RiscyVM* vm, const lane_t regs[], uint16_t pc, int lane)
+{
+	for (int r = 0; r < NUM_REGISTERS; ++r)
+		vm->regs[r] = regs[r][lane];
+	vm->pc		= pc;
+	vm->is_running	= false;
+}
+
+/* Adds the counts of each lane to the stats of its VM, and clears them */
+static void tally(RiscyVM* vms[], int nbr_lanes, lane_t counts[],
+		lane_t* taken)
+{
+	uint64_t lane_counts[STATS_NUM_OPCODES];
+
+	for (int lane = 0; lane < nbr_lanes; ++lane) {
+		if (vms[lane]->stats == NULL)
+			continue;
+		for (int op = 0; op < STATS_NUM_OPCODES; ++op)
+			lane_counts[op] = counts[op][lane];
+		stats_add(vms[lane]->stats, lane_counts, (*taken)[lane]);
+	}
+	for (int op = 0; op < STATS_NUM_OPCODES; ++op)
+		counts[op] = (lane_t) { 0 };
+	*taken = (lane_t) { 0 };
+}
@@ -0,0 +1,34 @@
+/*
+ * lockstep.h
+ *
+ * Runs many instances of one program in lockstep. Groups of LOCKSTEP_LANES
+ * instances keep their registers and pcs side by side, one vector per
+ * register, and each instruction is executed once for every instance (lane)
+ * that has reached it. Lanes that take different branches run one path after
+ * the other, lowest pc first, until they meet again.
+ *
+ * Only register arithmetic and branches are vectorized. Every lane has its
+ * own memory, so LW and SW (and the EXT instructions) are done lane by lane,
+ * and a program that spends most of its time in memory runs little faster
+ * than under VM_run.
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "vm.h"
+
+#define LOCKSTEP_LANES	(16)	/* 16 bits each, 256 bits in all */
+
+/**
+ * lockstep_run
+ * 	Runs each of the `nbr_vms` VMs until it halts. They must all be
+ * 	clones of the same program. An instance that stores into the text, or
+ * 	jumps out of it, leaves its group there: it is left running, at the
+ * 	instruction it stopped at, for the caller to finish with VM_run (or
+ * 	JIT_run), so that it does not hold up the rest of its group. Returns
+ * 	the number of instances left that way.
+ */
+int	lockstep_run	(RiscyVM* vms[], int nbr_vms);
+
+#endif
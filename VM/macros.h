@@ -10,6 +10,18 @@
 
 
 
+/*
+ * If THREADED_DISPATCH != 0, VM_run dispatches instructions with computed goto
+ * (a GNU C extension) instead of a switch statement.
+ */
+#if defined(__GNUC__)
+#define THREADED_DISPATCH	1
+#else
+#define THREADED_DISPATCH	0
+#endif
+
+
+
 /* Format for printing. Only one of each should be active at a time.
  * 	- HEX	prints as "0x1234"
  * 	- DECS	prints as "   xyz"	where xyz is a signed 16-bit integer
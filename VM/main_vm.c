@@ -1,16 +1,44 @@
+#define _POSIX_C_SOURCE	200809L	/* sysconf */
+
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "vm.h"
+#include "batch.h"
+#include "jit.h"
+#include "native.h"
+#include "output.h"
+#include "profile.h"
+#include "stats.h"
+#include "tracer.h"
+#include "xmem.h"
 
 #define VERSION		"0.9.1"
 #define WELCOME		"\n~~~~~ RiscyVM ~~~~~\n~~~~~ v."VERSION" ~~~~~\n\n"
 #define EXIT_MESSAGE	"Program exited successfully.\n"
 
-bool print_verbose_output;	/* Variables that are set */
-bool step_through_program;	/* from program arguments */
+bool step_through_program;	/* Variables that are set */
+bool use_jit;			/* from program arguments */
+bool use_lockstep;
+bool use_profile;
+
+/* Exits if `error` is one, saying what failed, with what file if any */
+static void check(vm_error_t error, const char what[], const char filename[])
+{
+	if (error == VM_OK)
+		return;
+
+	if (filename != NULL)
+		printf("Error: %s \"%s\": %s.\n", what, filename,
+				VM_strerror(error));
+	else
+		printf("Error: %s: %s.\n", what, VM_strerror(error));
+	exit(EXIT_FAILURE);
+}
 
 int main(int argc, char* argv[])
 {
@@ -20,17 +48,93 @@ int main(int argc, char* argv[])
 	}
 
 	char* progname = argv[1];	/* Name of input file */
+	char* trace_filename = NULL;	/* Binary trace output, if any */
+	char* snapshot_filename = NULL;	/* State saved at the end, if any */
+	char* aot_filename = NULL;	/* Code built by aot, if any */
+	char* output_filename = NULL;	/* For the output port, if any */
+	char* xmem_filename = NULL;	/* Extended memory, if any */
+	char* stats_filename = NULL;	/* JSON run statistics, if any */
+	uint64_t max_steps = UINT64_MAX;
+	uint64_t quantum = 0;		/* Of time slices, in batch mode */
+	char** batch_inputs = NULL;	/* Data files, in batch mode */
+	int nbr_batch_inputs = 0;
+	int nbr_threads = sysconf(_SC_NPROCESSORS_ONLN);
 
 	for (int i = 2; i < argc; ++i) {
 		if (!strcmp(argv[i], "--step"))
 			step_through_program = true;
 		else if (!strcmp(argv[i], "--verbose"))
 			print_verbose_output = true;
+		else if (!strcmp(argv[i], "--strict"))
+			strict_risc16 = true;
+		else if (!strcmp(argv[i], "--jit"))
+			use_jit = true;
+		else if (!strcmp(argv[i], "--lockstep"))
+			use_lockstep = true;
+		else if (!strcmp(argv[i], "--profile"))
+			use_profile = true;
+		else if (!strncmp(argv[i], "--trace=", 8))
+			trace_filename = argv[i] + 8;
+		else if (!strncmp(argv[i], "--steps=", 8))
+			max_steps = strtoull(argv[i] + 8, NULL, 0);
+		else if (!strncmp(argv[i], "--aot=", 6))
+			aot_filename = argv[i] + 6;
+		else if (!strncmp(argv[i], "--output=", 9))
+			output_filename = argv[i] + 9;
+		else if (!strncmp(argv[i], "--xmem=", 7))
+			xmem_filename = argv[i] + 7;
+		else if (!strncmp(argv[i], "--stats=", 8))
+			stats_filename = argv[i] + 8;
+		else if (!strncmp(argv[i], "--snapshot=", 11))
+			snapshot_filename = argv[i] + 11;
+		else if (!strncmp(argv[i], "--threads=", 10))
+			nbr_threads = atoi(argv[i] + 10);
+		else if (!strncmp(argv[i], "--quantum=", 10))
+			quantum = strtoull(argv[i] + 10, NULL, 0);
+		else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+			batch_inputs = &argv[i + 1];
+			nbr_batch_inputs = argc - (i + 1);
+			break;
+		}
 		else {
 			printf("Error: Unknown option \"%s\". Available "
 				"options are:\n"
 				"    --step      Step through the program.\n"
-				"    --verbose   Print more information.\n",
+				"    --verbose   Print more information.\n"
+				"    --strict    Reject the extension "
+				"instructions.\n"
+				"    --jit       Translate the program to "
+				"native code.\n"
+				"    --aot=FILE  Run the native code built by "
+				"aot into FILE.\n"
+				"    --profile   Count instructions per pc and "
+				"report the hot spots.\n"
+				"    --trace=FILE\n"
+				"                Write a binary trace of every "
+				"instruction to FILE.\n"
+				"    --steps=N   Stop after N instructions.\n"
+				"    --stats=FILE\n"
+				"                Write instruction counts and "
+				"speed to FILE as JSON.\n"
+				"    --output=FILE\n"
+				"                Write what the program stores to "
+				"the output port to FILE\n"
+				"                (- for stdout).\n"
+				"    --xmem=FILE Map FILE into the extended "
+				"memory window.\n"
+				"    --snapshot=FILE\n"
+				"                Save the state of the VM to FILE "
+				"when it stops.\n"
+				"    --threads=N Number of threads in batch "
+				"mode.\n"
+				"    --batch <data files>\n"
+				"                Run the program once per data "
+				"file.\n"
+				"    --lockstep  In batch mode, run the instances "
+				"in lockstep.\n"
+				"    --quantum=N In batch mode, time-slice the "
+				"instances, N instructions\n"
+				"                at a time.\n",
 				argv[i]);
 			exit(EXIT_FAILURE);
 		}
@@ -38,32 +142,117 @@ int main(int argc, char* argv[])
 
 	printf(WELCOME);
 
+	if (batch_inputs != NULL) {
+		if (output_filename != NULL || xmem_filename != NULL) {
+			printf("Error: --output and --xmem are for a "
+				"single program, not --batch.\n");
+			exit(EXIT_FAILURE);
+		}
+		if (use_lockstep && quantum > 0) {
+			printf("Error: --lockstep runs the instances to the "
+				"end, so it does not go with --quantum.\n");
+			exit(EXIT_FAILURE);
+		}
+		check(batch_run(progname, batch_inputs, nbr_batch_inputs,
+				nbr_threads, use_lockstep ? BATCH_LOCKSTEP
+				: use_jit ? BATCH_JIT : BATCH_INTERP, quantum,
+				stats_filename),
+				"Could not run", progname);
+		printf(EXIT_MESSAGE);
+		return EXIT_SUCCESS;
+	}
+
+	if (snapshot_filename != NULL && (output_filename != NULL
+				|| xmem_filename != NULL)) {
+		printf("Error: --snapshot does not save the state of --output "
+			"and --xmem, so it does not go with them.\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* Start the virtual machine */
 	RiscyVM* vm = VM_init(progname);
 
-	while (VM_is_running(vm)) {
+	if (output_filename != NULL)
+		check(output_start(vm, output_filename),
+				"Could not attach the output port to",
+				output_filename);
+	if (xmem_filename != NULL)
+		check(xmem_start(vm, xmem_filename),
+				"Could not attach extended memory",
+				xmem_filename);
 
-		VM_fetch(vm);
-		VM_decode(vm);
-		VM_execute(vm);
+	if (use_profile)
+		check(profile_start(vm), "Could not start the profile", NULL);
+	if (trace_filename != NULL)
+		check(tracer_start(vm, trace_filename),
+				"Could not start the trace", trace_filename);
 
-		if (step_through_program) {
-			VM_print_regs(vm);
-			VM_print_data(vm);
+	/* The profile, the trace, stepping and verbose output are all done by
+	 * the interpreter, so they win over --aot and --jit. The stats are
+	 * kept by every engine. If the native code cannot be loaded, the
+	 * program is interpreted. */
+	native_t* native = NULL;
+	bool interpret_only = use_profile || trace_filename != NULL
+			|| step_through_program || print_verbose_output;
+	if (aot_filename != NULL && !interpret_only)
+		native = AOT_load(vm, aot_filename);
 
-			printf("[Press ENTER]");
-			getchar();
-			printf("\n");
-		}
-	}
+	VM_set_debug(vm, print_verbose_output, step_through_program);
+	if (stats_filename != NULL)
+		check(stats_start(vm), "Could not start the stats", NULL);
+
+	uint64_t steps;
+	if (native != NULL)
+		steps = AOT_run(vm, native, max_steps);
+	else if (use_jit && !interpret_only)
+		steps = JIT_run(vm, max_steps);
+	else
+		steps = VM_run(vm, max_steps);
+
+	if (stats_filename != NULL)
+		check(stats_write(vm, stats_filename),
+				"Could not write the stats", stats_filename);
+	if (output_filename != NULL)
+		check(output_flush(vm), "Could not write the output",
+				output_filename);
 
 	if (!step_through_program) {
 		VM_print_regs(vm);
 		VM_print_data(vm);
 	}
+	if (print_verbose_output)
+		VM_print_memory(vm);
+
+	if (VM_is_running(vm))
+		printf("Stopped after %"PRIu64" instructions.\n", steps);
+
+	/* The program could not go on; say why, but save what there is */
+	vm_error_t error = VM_error(vm);
+	if (error != VM_OK)
+		printf("Error: The program stopped at a store: %s.\n",
+				VM_strerror(error));
+
+	if (snapshot_filename != NULL)
+		check(VM_snapshot(vm, snapshot_filename),
+				"Could not save the snapshot",
+				snapshot_filename);
+
+	if (use_profile) {
+		char symbol_filename[strlen(progname) + sizeof ".sym"];
+		sprintf(symbol_filename, "%s.sym", progname);
+		check(profile_report(vm, stdout, symbol_filename),
+				"Could not write the profile", NULL);
+	}
+	if (trace_filename != NULL)
+		check(tracer_stop(vm), "Could not write the trace",
+				trace_filename);
 
 	VM_shutdown(vm);
 	vm = NULL;
+	AOT_close(native);
+
+	if (error != VM_OK)
+		return EXIT_FAILURE;
 
 	printf(EXIT_MESSAGE);
 	return EXIT_SUCCESS;
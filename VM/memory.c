@@ -0,0 +1,307 @@
+/* memory.c */
+
+#include "memory.h"
+#include "image.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct page_t page_t;
+
+/* The words of a page are what the page tables point to. The reference
+ * count is updated atomically, as VMs sharing pages may run on different
+ * threads. */
+struct page_t {
+	uint32_t	refs;		/* Number of VMs using the page */
+	uint16_t	words[PAGE_SIZE];
+};
+
+/* Every page that holds nothing but zeros when a VM is set up is this one.
+ * It is never written, and its reference count is never touched: the first
+ * store into it gives the VM a zeroed page of its own. */
+static page_t zero_page;
+
+static page_t* page_of(uint16_t* words)
+{
+	return (page_t*) ((char*) words - offsetof(page_t, words));
+}
+
+/* Returns NULL if out of memory */
+static page_t* page_alloc(void)
+{
+	page_t* page = malloc(sizeof *page);
+	if (page != NULL)
+		page->refs = 1;
+	return page;
+}
+
+static void page_retain(uint16_t* words)
+{
+	if (words != zero_page.words)
+		__atomic_add_fetch(&page_of(words)->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void page_release(page_t* page)
+{
+	if (page == &zero_page)
+		return;
+	if (__atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(page);
+}
+
+/* Whether page `index` of `vm` is in the window of its extended memory,
+ * which is none of our business */
+static bool is_mapped(const RiscyVM* vm, int index)
+{
+	return vm->xmem != NULL && index >= (XMEM_BASE >> PAGE_BITS)
+		&& index < ((XMEM_BASE + XMEM_WINDOW_SIZE) >> PAGE_BITS);
+}
+
+/* Copies `count` little-endian words from `bytes` into `words`, byte for
+ * byte on a little-endian host */
+static void copy_words(uint16_t* words, const uint8_t* bytes, uint32_t count)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(words, bytes, 2 * count);
+#else
+	for (uint32_t i = 0; i < count; ++i)
+		words[i] = image_get16(bytes + 2 * i);
+#endif
+}
+
+static void origin_release(origin_t* origin)
+{
+	if (origin == NULL || __atomic_sub_fetch(&origin->refs, 1,
+						__ATOMIC_ACQ_REL) != 0)
+		return;
+
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		if (origin->pages[i] != NULL)
+			page_release(page_of(origin->pages[i]));
+	}
+	free(origin);
+}
+
+/* Makes `origin` the origin of `vm`, which starts out sharing every page
+ * with it */
+static void set_origin(RiscyVM* vm, origin_t* origin)
+{
+	memory_free(vm);
+	vm->origin = origin;
+	memory_reset(vm);
+}
+
+bool memory_init(RiscyVM* vm, const uint16_t words[], uint32_t size)
+{
+	origin_t*	origin;
+	page_t*		page;
+	uint32_t	start;
+	uint32_t	count;	/* Words of the page in `words` */
+
+	origin = calloc(1, sizeof *origin);
+	if (origin == NULL)
+		return false;
+	origin->refs = 1;
+
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		start	= (uint32_t) i * PAGE_SIZE;
+		count	= start < size ? size - start : 0;
+		if (count > PAGE_SIZE)
+			count = PAGE_SIZE;
+
+		if (count == 0 || !memcmp(&words[start], zero_page.words,
+								2 * count)) {
+			origin->pages[i] = zero_page.words;
+			continue;
+		}
+
+		page = page_alloc();
+		if (page == NULL) {
+			origin_release(origin);
+			return false;
+		}
+		memset(page->words, 0, sizeof page->words);
+		memcpy(page->words, &words[start], 2 * count);
+
+		origin->pages[i] = page->words;
+	}
+
+	set_origin(vm, origin);
+	return true;
+}
+
+bool memory_init_segments(RiscyVM* vm, const memory_segment_t segments[],
+		int nbr_segments)
+{
+	const memory_segment_t*	segment;
+	origin_t*		origin;
+	page_t*			page;
+	uint32_t		start;	/* Words of the page in `segment`, from
+					   `start` to `end` */
+	uint32_t		end;
+	uint32_t		count;
+
+	origin = calloc(1, sizeof *origin);
+	if (origin == NULL)
+		return false;
+	origin->refs = 1;
+
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		origin->pages[i] = zero_page.words;
+
+		for (int k = 0; k < nbr_segments; ++k) {
+			segment	= &segments[k];
+			start	= (uint32_t) i * PAGE_SIZE;
+			end	= start + PAGE_SIZE;
+			if (start < segment->address)
+				start = segment->address;
+			if (end > (uint32_t) segment->address + segment->size)
+				end = (uint32_t) segment->address
+					+ segment->size;
+			if (start >= end)
+				continue;
+
+			count = end - start;
+			start -= segment->address;
+			if (!memcmp(segment->bytes + 2 * start,
+					zero_page.words, 2 * count))
+				continue;
+
+			if (origin->pages[i] == zero_page.words) {
+				page = page_alloc();
+				if (page == NULL) {
+					origin_release(origin);
+					return false;
+				}
+				memset(page->words, 0, sizeof page->words);
+				origin->pages[i] = page->words;
+			}
+			copy_words(&origin->pages[i][(segment->address + start)
+						& PAGE_MASK],
+					segment->bytes + 2 * start, count);
+		}
+	}
+
+	set_origin(vm, origin);
+	return true;
+}
+
+void memory_share(RiscyVM* dest, RiscyVM* src)
+{
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		/* `dest` gets the memory as loaded under the window */
+		if (is_mapped(src, i)) {
+			page_retain(src->origin->pages[i]);
+			dest->pages[i]	= src->origin->pages[i];
+			dest->wpages[i]	= NULL;
+			continue;
+		}
+
+		page_retain(src->pages[i]);
+		dest->pages[i]	= src->pages[i];
+		dest->wpages[i]	= NULL;
+		src->wpages[i]	= NULL;
+	}
+
+	dest->origin = src->origin;
+	if (dest->origin != NULL)
+		__atomic_add_fetch(&dest->origin->refs, 1, __ATOMIC_RELAXED);
+}
+
+void memory_reset(RiscyVM* vm)
+{
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		if (is_mapped(vm, i))
+			continue;
+		if (vm->pages[i] != NULL)
+			page_release(page_of(vm->pages[i]));
+		page_retain(vm->origin->pages[i]);
+		vm->pages[i]	= vm->origin->pages[i];
+		vm->wpages[i]	= NULL;
+	}
+}
+
+void memory_free(RiscyVM* vm)
+{
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		if (is_mapped(vm, i))
+			continue;
+		if (vm->pages[i] != NULL)
+			page_release(page_of(vm->pages[i]));
+		vm->pages[i]	= NULL;
+		vm->wpages[i]	= NULL;
+	}
+
+	origin_release(vm->origin);
+	vm->origin = NULL;
+}
+
+void memory_map(RiscyVM* vm, uint16_t index, uint16_t* words)
+{
+	if (vm->pages[index] != NULL && !is_mapped(vm, index))
+		page_release(page_of(vm->pages[index]));
+
+	vm->pages[index]	= words;
+	vm->wpages[index]	= words;
+}
+
+uint16_t* memory_fault(RiscyVM* vm, uint16_t index)
+{
+	page_t* shared	= page_of(vm->pages[index]);
+	page_t* page;
+
+	/* Everybody else has let go of the page already */
+	if (shared != &zero_page
+	&& __atomic_load_n(&shared->refs, __ATOMIC_ACQUIRE) == 1) {
+		vm->wpages[index] = vm->pages[index];
+		return vm->wpages[index];
+	}
+
+	page = page_alloc();
+	if (page == NULL) {
+		vm->error = VM_ERROR_MEMORY;
+		return NULL;
+	}
+
+	/* The first store into a page of zeros has nothing to copy */
+	if (shared == &zero_page) {
+		memset(page->words, 0, sizeof page->words);
+	} else {
+		memcpy(page->words, shared->words, sizeof page->words);
+		page_release(shared);
+	}
+
+	vm->pages[index]	= page->words;
+	vm->wpages[index]	= page->words;
+
+	return page->words;
+}
+
+void memory_stats(const RiscyVM* vm, memory_stats_t* stats)
+{
+	uint32_t refs;
+
+	stats->private	= 0;
+	stats->shared	= 0;
+	stats->zero	= 0;
+
+	for (int i = 0; i < NUM_PAGES; ++i) {
+		if (is_mapped(vm, i))
+			continue;
+		if (vm->pages[i] == zero_page.words) {
+			stats->zero += 1;
+			continue;
+		}
+
+		refs = __atomic_load_n(&page_of(vm->pages[i])->refs,
+				__ATOMIC_RELAXED);
+		if (refs == 1)
+			stats->private += 1;
+		else
+			stats->shared += 1;
+	}
+
+	stats->bytes = stats->private * sizeof (page_t);
+}
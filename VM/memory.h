@@ -0,0 +1,137 @@
+/*
+ * memory.h
+ *
+ * The memory of a VM is a table of NUM_PAGES pages of PAGE_SIZE words each.
+ * A page can be shared by several VMs (see VM_clone), in which case none of
+ * them may write to it in place: the first store into a shared page gives the
+ * writing VM a private copy of it. Reads always go straight through `pages`;
+ * stores go through `wpages`, which is NULL for pages that must be copied
+ * first.
+ *
+ * Pages that hold nothing but zeros when a VM is set up are not allocated:
+ * they all map to one page of zeros, shared by every VM, and a VM only gets a
+ * page of its own on its first store into one. A typical program thus keeps
+ * a few pages resident (data, text and the top of the stack), not 128 KiB.
+ *
+ * The pages a program is loaded with are also kept by the VM's origin (see
+ * vm_internal.h), shared with the VM like any other, so that VM_reset only
+ * has to point the VM back at them.
+ */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "vm_internal.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct	memory_stats_t	memory_stats_t;
+typedef struct	memory_segment_t memory_segment_t;
+
+struct memory_stats_t {
+	int		private;	/* Pages used by this VM only */
+	int		shared;		/* Pages shared with other VMs, or
+					   unchanged since loading */
+	int		zero;		/* Pages never written */
+	size_t		bytes;		/* Memory held by private pages */
+};
+
+/* Words to load at `address`, little-endian, as they are in an image */
+struct memory_segment_t {
+	uint16_t	address;	/* Of the first word */
+	uint16_t	size;		/* Number of words */
+	const uint8_t*	bytes;		/* 2 * size bytes */
+};
+
+/**
+ * memory_init
+ * 	Replaces the memory of `vm` with the first `size` words of `words`,
+ * 	followed by zeros, and makes that its origin. Returns false, leaving
+ * 	`vm` as it was, if out of memory.
+ */
+bool		memory_init	(RiscyVM* vm, const uint16_t words[],
+				 uint32_t size);
+
+/**
+ * memory_init_segments
+ * 	Like memory_init, but with memory that is all zeros apart from the
+ * 	`nbr_segments` segments, which must not overlap. Each page is filled
+ * 	straight from the segments, so a mapped image is copied only once.
+ */
+bool		memory_init_segments(RiscyVM* vm,
+				 const memory_segment_t segments[],
+				 int nbr_segments);
+
+/**
+ * memory_share
+ * 	Makes `dest` use the same pages as `src`. From then on, both VMs copy a
+ * 	page before their first store into it.
+ */
+void		memory_share	(RiscyVM* dest, RiscyVM* src);
+
+/**
+ * memory_reset
+ * 	Gives `vm` back the memory of its origin.
+ */
+void		memory_reset	(RiscyVM* vm);
+
+/**
+ * memory_free
+ * 	Drops the VM's references to its pages and its origin, freeing those
+ * 	no other VM uses.
+ */
+void		memory_free	(RiscyVM* vm);
+
+/**
+ * memory_stats
+ * 	Counts the pages of `vm` by kind. Pages are shared between clones
+ * 	until one of them writes, so the counts of a clone change as the
+ * 	other VMs run or are shut down.
+ */
+void		memory_stats	(const RiscyVM* vm, memory_stats_t* stats);
+
+/**
+ * memory_map
+ * 	Makes page `index` of `vm` the PAGE_SIZE words at `words`, which the
+ * 	VM reads and writes in place from then on, letting go of the page it
+ * 	had. Used for the window of extended memory (see xmem.h); the other
+ * 	functions here leave the pages of the window alone once vm->xmem is
+ * 	set.
+ */
+void		memory_map	(RiscyVM* vm, uint16_t index, uint16_t* words);
+
+/**
+ * memory_fault
+ * 	Called for a store into a page that may not be written in place.
+ * 	Returns the page after making it private to `vm`, or NULL with
+ * 	vm->error set if out of memory.
+ */
+uint16_t*	memory_fault	(RiscyVM* vm, uint16_t page);
+
+static inline uint16_t mem_read(const RiscyVM* vm, uint16_t address)
+{
+	return vm->pages[address >> PAGE_BITS][address & PAGE_MASK];
+}
+
+/* Returns false, with vm->error set and nothing stored, if the store fails */
+static inline bool mem_write(RiscyVM* vm, uint16_t address, uint16_t value)
+{
+	uint16_t* page = vm->wpages[address >> PAGE_BITS];
+
+	if (page == NULL) {
+		/* The page of device registers is never writable in place */
+		if (vm->io && address >= IO_BASE)
+			return io_store(vm, address, value);
+
+		page = memory_fault(vm, address >> PAGE_BITS);
+		if (page == NULL)
+			return false;
+	}
+
+	page[address & PAGE_MASK] = value;
+	return true;
+}
+
+#endif
@@ -0,0 +1,179 @@
+/* native.c */
+
+#include "native.h"
+#include "vm_internal.h"
+#include "aot.h"
+#include "image.h"
+#include "macros.h"
+#include "memory.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct native_t {
+	void*		handle;		/* From dlopen */
+	aot_run_fn	run;		/* AOT_SYMBOL_RUN */
+	const uint8_t*	blocks;		/* AOT_SYMBOL_BLOCKS */
+	uint64_t	text_writes;	/* vm->text_writes when loaded */
+};
+
+static const void*	lookup		(void* handle, const char* symbol,
+					 char filename[]);
+static bool		starts_block	(RiscyVM* vm, native_t* native);
+
+native_t* AOT_load(RiscyVM* vm, char filename[])
+{
+	metadata_t*	md	= &vm->metadata;
+	const void*	version;
+	const void*	text_start;
+	const void*	text_size;
+	const void*	checksum;
+	const void*	blocks;
+	const void*	run;
+	native_t*	native;
+	void*		handle;
+
+	/* dlopen only searches the library path for names without a '/' */
+	char path[strlen(filename) + sizeof "./"];
+	sprintf(path, "%s%s", strchr(filename, '/') != NULL ? "" : "./",
+			filename);
+
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		fprintf(stderr, "Could not load \"%s\": %s\n", filename,
+				dlerror());
+		return NULL;
+	}
+
+	/* The version first, since the other symbols depend on it */
+	version = lookup(handle, AOT_SYMBOL_VERSION, filename);
+	if (version == NULL) {
+		dlclose(handle);
+		return NULL;
+	}
+	if (*(const uint32_t*) version != AOT_VERSION) {
+		fprintf(stderr, "\"%s\" was built by another version of aot.\n",
+				filename);
+		dlclose(handle);
+		return NULL;
+	}
+
+	text_start	= lookup(handle, AOT_SYMBOL_TEXT_START, filename);
+	text_size	= lookup(handle, AOT_SYMBOL_TEXT_SIZE, filename);
+	checksum	= lookup(handle, AOT_SYMBOL_CHECKSUM, filename);
+	blocks		= lookup(handle, AOT_SYMBOL_BLOCKS, filename);
+	run		= lookup(handle, AOT_SYMBOL_RUN, filename);
+
+	if (text_start == NULL || text_size == NULL || checksum == NULL
+			|| blocks == NULL || run == NULL) {
+		dlclose(handle);
+		return NULL;
+	}
+
+	if (*(const uint16_t*) text_start != md->text_start
+			|| *(const uint16_t*) text_size != md->text_size
+			|| *(const uint32_t*) checksum
+				!= text_checksum(vm->pages, PAGE_BITS,
+					md->text_start, md->text_size)) {
+		fprintf(stderr, "\"%s\" was built from another program.\n",
+				filename);
+		dlclose(handle);
+		return NULL;
+	}
+
+	native = malloc(sizeof *native);
+	if (native == NULL) {
+		fputs(OUT_OF_MEMORY, stderr);
+		dlclose(handle);
+		return NULL;
+	}
+
+	native->handle		= handle;
+	native->blocks		= blocks;
+	native->text_writes	= vm->text_writes;
+
+	/* ISO C has no conversion from void* to a function pointer */
+	memcpy(&native->run, &run, sizeof native->run);
+
+	return native;
+}
+
+uint64_t AOT_run(RiscyVM* vm, native_t* native, uint64_t max_steps)
+{
+	aot_context_t	context;
+	uint64_t	counts[AOT_NUM_COUNTS] = { 0 };
+	uint32_t	exit;
+	int64_t		budget;
+	uint64_t	steps	= 0;
+
+	context.regs	= vm->regs;
+	context.pages	= vm->pages;
+	context.wpages	= vm->wpages;
+	context.counts	= vm->stats != NULL ? counts : NULL;
+
+	while (vm->is_running && steps < max_steps) {
+
+		/* Self-modifying code is left to the interpreter */
+		if (vm->text_writes != native->text_writes) {
+			steps += VM_run(vm, max_steps - steps);
+			break;
+		}
+
+		/* Code that no block covers is interpreted up to the next
+		 * block, rather than calling into the object for each word */
+		if (!starts_block(vm, native)) {
+			steps += VM_run(vm, 1);
+			continue;
+		}
+
+		budget	= max_steps - steps > INT64_MAX ? INT64_MAX
+						: (int64_t) (max_steps - steps);
+
+		vm->regs[0]	= 0;
+		context.budget	= budget;
+		exit		= native->run(&context, vm->pc);
+
+		vm->pc	= AOT_EXIT_PC(exit);
+		steps	+= budget - context.budget;
+
+		if (exit & AOT_EXIT_HALT)
+			vm->is_running = false;
+		else if (steps < max_steps)
+			steps += VM_run(vm, 1);
+	}
+
+	/* The opcodes are numbered alike, and the taken BEQs come after */
+	if (vm->stats != NULL)
+		stats_add(vm->stats, counts, counts[AOT_COUNT_TAKEN]);
+
+	return steps;
+}
+
+void AOT_close(native_t* native)
+{
+	if (native == NULL)
+		return;
+
+	dlclose(native->handle);
+	free(native);
+}
+
+static const void* lookup(void* handle, const char* symbol, char filename[])
+{
+	const void* address = dlsym(handle, symbol);
+
+	if (address == NULL)
+		fprintf(stderr, "\"%s\" has no symbol \"%s\".\n", filename,
+				symbol);
+	return address;
+}
+
+static bool starts_block(RiscyVM* vm, native_t* native)
+{
+	uint16_t offset = vm->pc - vm->metadata.text_start;
+
+	return offset < vm->metadata.text_size
+		&& native->blocks[offset / 8] >> (offset % 8) & 1;
+}
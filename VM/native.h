@@ -0,0 +1,41 @@
+/*
+ * native.h
+ *
+ * Runs programs translated ahead of time by the aot tool. The shared object
+ * it builds holds native code for the text of one image, and is only used
+ * with that image; see Common/aot.h.
+ */
+
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "vm.h"
+
+#include <stdint.h>
+
+typedef struct	native_t	native_t;
+
+/**
+ * AOT_load
+ * 	Loads the shared object `filename` for the program loaded in `vm`.
+ * 	Returns NULL, after saying why, if it cannot be loaded or was built
+ * 	from another program. The object can be used by any clone of `vm`.
+ */
+native_t*	AOT_load	(RiscyVM* vm, char filename[]);
+
+/**
+ * AOT_run
+ * 	Same contract as VM_run, running the translated code wherever it
+ * 	can and the interpreter elsewhere. Once the program stores into its
+ * 	own text, the rest of the run is left to the interpreter.
+ */
+uint64_t	AOT_run		(RiscyVM* vm, native_t* native,
+				 uint64_t max_steps);
+
+/**
+ * AOT_close
+ * 	Unloads the shared object.
+ */
+void		AOT_close	(native_t* native);
+
+#endif
@@ -0,0 +1,114 @@
+/* output.c */
+
+#include "output.h"
+#include "vm_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool	reserve		(output_t* output, size_t bytes);
+static bool	write_buffer	(output_t* output);
+
+vm_error_t output_start(RiscyVM* vm, char filename[])
+{
+	output_t*	output;
+	vm_error_t	error;
+
+	output = malloc(sizeof *output);
+	if (output == NULL)
+		return VM_ERROR_MEMORY;
+	output->used = 0;
+
+	if (strcmp(filename, "-") == 0) {
+		output->file = stdout;
+	} else {
+		output->file = fopen(filename, "wb");
+		if (output->file == NULL) {
+			free(output);
+			return VM_ERROR_WRITE;
+		}
+	}
+
+	error = io_attach(vm);
+	if (error != VM_OK) {
+		if (output->file != stdout)
+			fclose(output->file);
+		free(output);
+		return error;
+	}
+
+	output_close(vm->output);
+	vm->output = output;
+	return io_refresh(vm);
+}
+
+vm_error_t output_flush(RiscyVM* vm)
+{
+	bool written;
+
+	if (vm->output == NULL)
+		return VM_OK;
+
+	written = write_buffer(vm->output)
+		&& fflush(vm->output->file) == 0;
+	if (io_refresh(vm) != VM_OK)
+		return vm->error;
+
+	return written ? VM_OK : VM_ERROR_WRITE;
+}
+
+bool output_store(output_t* output, uint16_t address, uint16_t value)
+{
+	switch (address) {
+	case OUTPUT_BYTE:
+		if (!reserve(output, 1))
+			return false;
+		output->buffer[output->used++] = value & 0xff;
+		break;
+	case OUTPUT_WORD:
+		if (!reserve(output, 2))
+			return false;
+		output->buffer[output->used++] = value & 0xff;
+		output->buffer[output->used++] = value >> 8;
+		break;
+	case OUTPUT_STATUS:
+		return write_buffer(output) && fflush(output->file) == 0;
+	}
+	return true;
+}
+
+uint16_t output_space(const output_t* output)
+{
+	return OUTPUT_BUFFER_SIZE - output->used;
+}
+
+void output_close(output_t* output)
+{
+	if (output == NULL)
+		return;
+
+	write_buffer(output);
+	if (output->file == stdout)
+		fflush(stdout);
+	else if (fclose(output->file) != 0)
+		fprintf(stderr, "Could not write the output file.\n");
+
+	free(output);
+}
+
+/* Makes room for `bytes` more bytes in the buffer */
+static bool reserve(output_t* output, size_t bytes)
+{
+	if (output->used + bytes > OUTPUT_BUFFER_SIZE)
+		return write_buffer(output);
+	return true;
+}
+
+static bool write_buffer(output_t* output)
+{
+	size_t used = output->used;
+
+	output->used = 0;
+	return used == 0 || fwrite(output->buffer, 1, used, output->file)
+				== used;
+}
@@ -0,0 +1,77 @@
+/*
+ * output.h
+ *
+ * Memory-mapped output port, a device (see io.h). A store to OUTPUT_BYTE or
+ * OUTPUT_WORD appends to an output buffer, which is written to the output
+ * file in large writes, and OUTPUT_STATUS reads as the space left in the
+ * buffer.
+ *
+ * 	address		load			store
+ * 	-------		----			-----
+ * 	OUTPUT_BYTE	0			appends the low 8 bits
+ * 	OUTPUT_WORD	0			appends both bytes, low first
+ * 	OUTPUT_STATUS	free bytes in buffer	writes the buffer out now
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "io.h"
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define OUTPUT_BUFFER_SIZE	(1 << 15)	/* Bytes; fits the status */
+
+#define OUTPUT_BYTE		(IO_BASE + 0)
+#define OUTPUT_WORD		(IO_BASE + 1)
+#define OUTPUT_STATUS		(IO_BASE + 2)
+
+typedef struct	output_t	output_t;
+
+struct output_t {
+	FILE*		file;
+	size_t		used;		/* Bytes of `buffer` to write */
+	uint8_t		buffer[OUTPUT_BUFFER_SIZE];
+};
+
+/**
+ * output_start
+ * 	Attaches an output port to `vm`, which must hold a program, in place
+ * 	of the one it has, if any. It writes to `filename`, or to stdout for
+ * 	"-". It is closed by VM_shutdown.
+ */
+vm_error_t	output_start	(RiscyVM* vm, char filename[]);
+
+/**
+ * output_flush
+ * 	Writes out what the program has stored to the port of `vm` so far,
+ * 	if it has one.
+ */
+vm_error_t	output_flush	(RiscyVM* vm);
+
+/**
+ * output_store
+ * 	Called by io_store for a store to one of the port's registers.
+ * 	Returns false if the buffer had to be written out and could not be;
+ * 	what it held is dropped.
+ */
+bool		output_store	(output_t* output, uint16_t address,
+				 uint16_t value);
+
+/**
+ * output_space
+ * 	Returns the value of OUTPUT_STATUS.
+ */
+uint16_t	output_space	(const output_t* output);
+
+/**
+ * output_close
+ * 	Writes out the buffer, closes the file unless it is stdout and
+ * 	releases the port. Called by VM_shutdown.
+ */
+void		output_close	(output_t* output);
+
+#endif
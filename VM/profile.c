@@ -0,0 +1,257 @@
+/* profile.c */
+
+#include "profile.h"
+#include "disasm.h"
+#include "memory.h"
+#include "vm_internal.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LABEL_LENGTH	(80)
+#define MAX_HOT_SPOTS		(20)
+
+typedef struct	symbol_t	symbol_t;
+typedef struct	symbols_t	symbols_t;
+
+struct symbol_t {
+	uint16_t	address;
+	char		name[MAX_LABEL_LENGTH + 1];
+};
+
+struct symbols_t {
+	symbol_t*	entries;	/* Sorted by address */
+	int		nbr_entries;
+	uint16_t	text_start;	/* Labels do not reach across it */
+};
+
+static void	load_symbols	(symbols_t* symbols, char filename[]);
+static char*	label_of	(char* buf, size_t size, symbols_t* symbols,
+				 uint16_t pc);
+static int	by_address	(const void* a, const void* b);
+static int	by_count_desc	(const void* a, const void* b);
+
+/* Global, as qsort has no way to pass it to the comparison function */
+static const uint64_t* sort_counts;
+
+vm_error_t profile_start(RiscyVM* vm)
+{
+	profile_t* profile = calloc(1, sizeof *profile);
+
+	if (profile == NULL)
+		return VM_ERROR_MEMORY;
+
+	profile_free(vm->profile);
+	vm->profile = profile;
+	return VM_OK;
+}
+
+void profile_free(profile_t* profile)
+{
+	free(profile);
+}
+
+vm_error_t profile_report(RiscyVM* vm, FILE* output, char symbol_filename[])
+{
+	profile_t*	profile	= vm->profile;
+	symbols_t	symbols	= { NULL, 0, vm->metadata.text_start };
+	uint16_t*	order;
+	uint64_t	total	= 0;
+	uint64_t	taken;
+	uint64_t	count;
+	uint32_t	nbr_pcs	= 0;
+	uint16_t	target;
+	char		label[MAX_LABEL_LENGTH + 16];
+	char		text[32];
+
+	if (profile == NULL)
+		return VM_OK;
+
+	order = malloc((MEMORY_SIZE + 1) * sizeof *order);
+	if (order == NULL)
+		return VM_ERROR_MEMORY;
+
+	load_symbols(&symbols, symbol_filename);
+
+	for (uint32_t pc = 0; pc <= MEMORY_SIZE; ++pc) {
+		total += profile->hits[pc];
+		if (profile->hits[pc] > 0)
+			order[nbr_pcs++] = pc;
+	}
+
+	fprintf(output, "Profile: %"PRIu64" instructions executed\n\n",
+			total);
+	if (total == 0) {
+		free(order);
+		free(symbols.entries);
+		return ferror(output) ? VM_ERROR_WRITE : VM_OK;
+	}
+
+	/* Hot spots */
+	sort_counts = profile->hits;
+	qsort(order, nbr_pcs, sizeof *order, by_count_desc);
+
+	fprintf(output, "Hot spots:\n");
+	fprintf(output, "%14s %7s %7s  %-20s %s\n",
+			"count", "%", "pc", "label", "instruction");
+	for (uint32_t i = 0; i < nbr_pcs && i < MAX_HOT_SPOTS; ++i) {
+		count = profile->hits[order[i]];
+		fprintf(output, "%14"PRIu64" %6.2f%%  0x%04x  %-20s %s\n",
+			count, 100.0 * count / total, order[i],
+			label_of(label, sizeof label, &symbols, order[i]),
+			disassemble(text, sizeof text, mem_read(vm, order[i])));
+	}
+
+	/* Every BEQ that was executed, and the loops they close */
+	fprintf(output, "\nBranches:\n");
+	fprintf(output, "%7s  %-20s %14s %14s %8s\n",
+			"pc", "label", "taken", "not taken", "taken %");
+	for (uint32_t i = 0; i < nbr_pcs; ++i) {
+		if ((mem_read(vm, order[i]) & MASK_OPCODE) >> 13 != BEQ)
+			continue;
+
+		count	= profile->hits[order[i]];
+		taken	= profile->taken[order[i]];
+		fprintf(output, "0x%04x  %-20s %14"PRIu64" %14"PRIu64
+			" %7.2f%%\n", order[i],
+			label_of(label, sizeof label, &symbols, order[i]),
+			taken, count - taken, 100.0 * taken / count);
+	}
+
+	fprintf(output, "\nHot loops (backward branches):\n");
+	fprintf(output, "%-20s %7s %7s %14s %14s %7s\n", "head", "from",
+			"to", "iterations", "instructions", "%");
+	for (uint32_t i = 0; i < nbr_pcs; ++i) {
+		uint16_t word = mem_read(vm, order[i]);
+		int	 simm = (word & MASK_SIMM) - (word & 0x40 ? 0x80 : 0);
+
+		if ((word & MASK_OPCODE) >> 13 != BEQ || simm >= 0)
+			continue;
+		if (profile->taken[order[i]] == 0)
+			continue;
+
+		target	= order[i] + 1 + simm;
+		count	= 0;
+		for (uint16_t pc = target; pc != (uint16_t) (order[i] + 1);
+								++pc)
+			count += profile->hits[pc];
+
+		fprintf(output, "%-20s 0x%04x 0x%04x %14"PRIu64" %14"PRIu64
+			" %6.2f%%\n",
+			label_of(label, sizeof label, &symbols, target),
+			target, order[i], profile->taken[order[i]], count,
+			100.0 * count / total);
+	}
+
+	/* Calls, by JALR target */
+	nbr_pcs = 0;
+	for (uint32_t pc = 0; pc <= MEMORY_SIZE; ++pc) {
+		if (profile->calls[pc] > 0)
+			order[nbr_pcs++] = pc;
+	}
+	sort_counts = profile->calls;
+	qsort(order, nbr_pcs, sizeof *order, by_count_desc);
+
+	fprintf(output, "\nCalls (JALR targets):\n");
+	fprintf(output, "%7s  %-20s %14s\n", "target", "label", "calls");
+	for (uint32_t i = 0; i < nbr_pcs; ++i) {
+		fprintf(output, "0x%04x  %-20s %14"PRIu64"\n", order[i],
+			label_of(label, sizeof label, &symbols, order[i]),
+			profile->calls[order[i]]);
+	}
+	fprintf(output, "\n");
+
+	free(order);
+	free(symbols.entries);
+	return ferror(output) ? VM_ERROR_WRITE : VM_OK;
+}
+
+/* Reads the "0x1234 name" lines written by the assembler. A missing file
+ * just means that there are no labels, and running out of memory that there
+ * are no more. */
+static void load_symbols(symbols_t* symbols, char filename[])
+{
+	FILE*		file;
+	symbol_t	symbol;
+	symbol_t*	entries;
+	unsigned	address;
+	int		max	= 0;
+	char		buffer[MAX_LABEL_LENGTH + 16];
+
+	file = filename != NULL ? fopen(filename, "r") : NULL;
+	if (file == NULL)
+		return;
+
+	while (fgets(buffer, sizeof buffer, file)) {
+		if (sscanf(buffer, "%x %80s", &address, symbol.name) != 2)
+			continue;
+		symbol.address = address;
+
+		if (symbols->nbr_entries == max) {
+			max	= max == 0 ? 64 : 2 * max;
+			entries	= realloc(symbols->entries,
+					max * sizeof *entries);
+			if (entries == NULL)
+				break;
+			symbols->entries = entries;
+		}
+		symbols->entries[symbols->nbr_entries++] = symbol;
+	}
+	fclose(file);
+
+	qsort(symbols->entries, symbols->nbr_entries, sizeof(symbol_t),
+			by_address);
+}
+
+/* Names `pc` after the closest label at or before it, e.g. "loop+2" */
+static char* label_of(char* buf, size_t size, symbols_t* symbols,
+		uint16_t pc)
+{
+	int low		= 0;
+	int high	= symbols->nbr_entries - 1;
+	int found	= -1;
+
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		if (symbols->entries[mid].address <= pc) {
+			found	= mid;
+			low	= mid + 1;
+		} else {
+			high	= mid - 1;
+		}
+	}
+
+	if (found >= 0 && symbols->entries[found].address < symbols->text_start
+			&& pc >= symbols->text_start)
+		found = -1;
+
+	if (found < 0)
+		snprintf(buf, size, "-");
+	else if (symbols->entries[found].address == pc)
+		snprintf(buf, size, "%s", symbols->entries[found].name);
+	else
+		snprintf(buf, size, "%s+%d", symbols->entries[found].name,
+				pc - symbols->entries[found].address);
+
+	return buf;
+}
+
+static int by_address(const void* a, const void* b)
+{
+	const symbol_t* x = a;
+	const symbol_t* y = b;
+
+	return (x->address > y->address) - (x->address < y->address);
+}
+
+static int by_count_desc(const void* a, const void* b)
+{
+	uint64_t x = sort_counts[*(const uint16_t*) a];
+	uint64_t y = sort_counts[*(const uint16_t*) b];
+
+	if (x != y)
+		return x < y ? 1 : -1;
+	return (*(const uint16_t*) a > *(const uint16_t*) b)
+		- (*(const uint16_t*) a < *(const uint16_t*) b);
+}
@@ -0,0 +1,42 @@
+/*
+ * profile.h
+ *
+ * Instruction-level profiler. While a profile is attached to a VM, VM_run
+ * counts how many times each pc is executed, how often each BEQ is taken and
+ * how many calls each JALR target receives. The report lists the hot spots
+ * and loops, with labels taken from the ".sym" file that the assembler
+ * writes next to the program.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "vm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct	profile_t	profile_t;
+
+/**
+ * profile_start
+ * 	Attaches a new, empty profile to `vm`, in place of the one it has, if
+ * 	any. It is freed by VM_shutdown.
+ */
+vm_error_t	profile_start	(RiscyVM* vm);
+
+/**
+ * profile_report
+ * 	Writes the report for the profile attached to `vm` to `output`.
+ * 	Labels are read from `symbol_filename` if it can be opened.
+ */
+vm_error_t	profile_report	(RiscyVM* vm, FILE* output,
+				 char symbol_filename[]);
+
+/**
+ * profile_free
+ * 	Releases a profile. Called by VM_shutdown.
+ */
+void		profile_free	(profile_t* profile);
+
+#endif
@@ -0,0 +1,378 @@
+/* scheduler.c */
+
+#define _POSIX_C_SOURCE	200809L	/* clock_gettime */
+
+#include "scheduler.h"
+#include "jit.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define QUEUE_MIN_CAPACITY	(16)
+
+typedef struct	guest_t		guest_t;
+typedef struct	queue_t		queue_t;
+
+struct guest_t {
+	RiscyVM*	vm;
+	int		id;
+	int		worker;		/* Whose queue it was last in */
+	guest_stats_t	stats;
+};
+
+/* A ring of guests. The worker it belongs to takes them from the front and
+ * puts them back at the end; other workers steal from the end. */
+struct queue_t {
+	pthread_mutex_t	lock;
+	guest_t**	ring;
+	int		head;		/* Index of the front */
+	int		count;
+	int		capacity;
+};
+
+struct sched_t {
+	queue_t*	queues;		/* One per worker */
+	int		nbr_workers;
+	int		started;	/* Workers started so far, for ids */
+	int		next_id;	/* Of the next guest added */
+	int		live;		/* Guests not retired yet */
+	int		queued;		/* Guests in the queues */
+	int		sleeping;	/* Workers waiting on idle_cond */
+	pthread_mutex_t	idle_lock;
+	pthread_cond_t	idle_cond;	/* A guest was queued, or none is
+					   live any more */
+	uint64_t	quantum;
+	bool		use_jit;
+	sched_retire_fn	retire;
+	void*		user;
+};
+
+static void*	worker		(void* arg);
+static void	run_slice	(sched_t* sched, guest_t* guest, int self);
+static void	retire		(sched_t* sched, guest_t* guest);
+static guest_t*	steal		(sched_t* sched, int self);
+static void	enqueue		(sched_t* sched, int index, guest_t* guest,
+				 bool wake);
+static void	idle		(sched_t* sched);
+static bool	reserve		(queue_t* queue, int capacity);
+static int	push_back	(queue_t* queue, guest_t* guest);
+static guest_t*	pop_front	(queue_t* queue);
+static guest_t*	pop_back	(queue_t* queue);
+
+sched_t* sched_create(int nbr_workers, uint64_t quantum, bool use_jit,
+		sched_retire_fn retire, void* user)
+{
+	sched_t* sched;
+
+	if (nbr_workers < 1)
+		nbr_workers = 1;
+	if (quantum < 1)
+		quantum = 1;
+
+	sched = calloc(1, sizeof *sched);
+	if (sched == NULL)
+		return NULL;
+	sched->queues = calloc(nbr_workers, sizeof *sched->queues);
+	if (sched->queues == NULL) {
+		free(sched);
+		return NULL;
+	}
+
+	for (int i = 0; i < nbr_workers; ++i)
+		pthread_mutex_init(&sched->queues[i].lock, NULL);
+	pthread_mutex_init(&sched->idle_lock, NULL);
+	pthread_cond_init(&sched->idle_cond, NULL);
+
+	sched->nbr_workers	= nbr_workers;
+	sched->quantum		= quantum;
+	sched->use_jit		= use_jit;
+	sched->retire		= retire;
+	sched->user		= user;
+
+	return sched;
+}
+
+int sched_add(sched_t* sched, RiscyVM* vm)
+{
+	guest_t*	guest	= calloc(1, sizeof *guest);
+	int		live;
+
+	if (guest == NULL)
+		return -1;
+
+	/* Counted before it is queued, so that no worker sees it run and
+	 * retire before it is live. Any guest may end up in any queue, so
+	 * each has to have room for all of them, this one included. */
+	live = __atomic_add_fetch(&sched->live, 1, __ATOMIC_ACQ_REL);
+	for (int i = 0; i < sched->nbr_workers; ++i) {
+		if (!reserve(&sched->queues[i], live)) {
+			free(guest);
+			retire(sched, NULL);
+			return -1;
+		}
+	}
+
+	guest->vm	= vm;
+	guest->id	= __atomic_fetch_add(&sched->next_id, 1,
+					__ATOMIC_RELAXED);
+	guest->worker	= guest->id % sched->nbr_workers;
+	enqueue(sched, guest->worker, guest, true);
+
+	return guest->id;
+}
+
+vm_error_t sched_run(sched_t* sched)
+{
+	pthread_t*	threads;
+	int		nbr_threads	= 0;
+
+	threads = malloc(sched->nbr_workers * sizeof *threads);
+	if (threads == NULL)
+		return VM_ERROR_MEMORY;
+
+	/* Workers steal from every queue, also from those of workers that
+	 * could not be started */
+	sched->started = 0;
+	while (nbr_threads < sched->nbr_workers && pthread_create(
+			&threads[nbr_threads], NULL, worker, sched) == 0)
+		nbr_threads += 1;
+
+	for (int i = 0; i < nbr_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return nbr_threads > 0 ? VM_OK : VM_ERROR_THREAD;
+}
+
+void sched_free(sched_t* sched)
+{
+	if (sched == NULL)
+		return;
+
+	for (int i = 0; i < sched->nbr_workers; ++i) {
+		queue_t* queue = &sched->queues[i];
+
+		/* Guests that never got to halt */
+		for (int k = 0; k < queue->count; ++k) {
+			guest_t* guest = queue->ring[(queue->head + k)
+							% queue->capacity];
+			VM_shutdown(guest->vm);
+			free(guest);
+		}
+		free(queue->ring);
+		pthread_mutex_destroy(&queue->lock);
+	}
+	pthread_mutex_destroy(&sched->idle_lock);
+	pthread_cond_destroy(&sched->idle_cond);
+	free(sched->queues);
+	free(sched);
+}
+
+/* Runs guests from its own queue, or stolen ones, until every guest has
+ * halted. A worker with nothing to do sleeps until the others finish or
+ * queue a guest it can steal. */
+static void* worker(void* arg)
+{
+	sched_t*	sched	= arg;
+	guest_t*	guest;
+	int		self;
+
+	self = __atomic_fetch_add(&sched->started, 1, __ATOMIC_RELAXED);
+
+	for (;;) {
+		guest = pop_front(&sched->queues[self]);
+		if (guest == NULL)
+			guest = steal(sched, self);
+
+		if (guest != NULL) {
+			__atomic_sub_fetch(&sched->queued, 1,
+					__ATOMIC_RELAXED);
+			run_slice(sched, guest, self);
+		} else if (__atomic_load_n(&sched->live, __ATOMIC_ACQUIRE)
+				== 0) {
+			break;
+		} else {
+			idle(sched);
+		}
+	}
+
+	return NULL;
+}
+
+/* Runs `guest` for one quantum and queues it again, unless it halted */
+static void run_slice(sched_t* sched, guest_t* guest, int self)
+{
+	struct timespec	start;
+	struct timespec	end;
+	uint64_t	steps;
+
+	if (guest->worker != self) {
+		guest->worker		= self;
+		guest->stats.steals	+= 1;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	steps = sched->use_jit ? JIT_run(guest->vm, sched->quantum)
+			       : VM_run(guest->vm, sched->quantum);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	guest->stats.steps	+= steps;
+	guest->stats.slices	+= 1;
+	guest->stats.cpu_ns	+= (uint64_t) (end.tv_sec - start.tv_sec)
+					* 1000000000 + end.tv_nsec
+					- start.tv_nsec;
+
+	/* This worker takes the guest again itself, unless there are others
+	 * in its queue, which a sleeping worker had better take */
+	if (VM_is_running(guest->vm))
+		enqueue(sched, self, guest, false);
+	else
+		retire(sched, guest);
+}
+
+/* Also called with no guest by sched_add, to take back the one it counted */
+static void retire(sched_t* sched, guest_t* guest)
+{
+	if (guest != NULL) {
+		if (sched->retire != NULL)
+			sched->retire(guest->vm, guest->id, &guest->stats,
+					sched->user);
+
+		VM_shutdown(guest->vm);
+		free(guest);
+	}
+
+	/* The workers asleep have nothing left to wait for */
+	if (__atomic_sub_fetch(&sched->live, 1, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_lock(&sched->idle_lock);
+		pthread_cond_broadcast(&sched->idle_cond);
+		pthread_mutex_unlock(&sched->idle_lock);
+	}
+}
+
+/* Takes a guest from the end of the first other queue that has one */
+static guest_t* steal(sched_t* sched, int self)
+{
+	guest_t* guest;
+
+	for (int i = 1; i < sched->nbr_workers; ++i) {
+		guest = pop_back(&sched->queues[(self + i)
+						% sched->nbr_workers]);
+		if (guest != NULL)
+			return guest;
+	}
+	return NULL;
+}
+
+/* Puts `guest` at the end of queue `index`, and wakes a sleeping worker if
+ * `wake` is set or the guest is not alone in the queue. `queued` and
+ * `sleeping` are sequentially consistent, so that either this sees the
+ * worker that is going to sleep, or that worker sees the guest. */
+static void enqueue(sched_t* sched, int index, guest_t* guest, bool wake)
+{
+	int count = push_back(&sched->queues[index], guest);
+
+	__atomic_add_fetch(&sched->queued, 1, __ATOMIC_SEQ_CST);
+	if ((wake || count > 1)
+	&& __atomic_load_n(&sched->sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&sched->idle_lock);
+		pthread_cond_signal(&sched->idle_cond);
+		pthread_mutex_unlock(&sched->idle_lock);
+	}
+}
+
+/* Sleeps until a guest is queued or none is live. The lock is held from
+ * the count of sleepers on, so a signal cannot come before the wait. */
+static void idle(sched_t* sched)
+{
+	pthread_mutex_lock(&sched->idle_lock);
+	__atomic_add_fetch(&sched->sleeping, 1, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&sched->queued, __ATOMIC_SEQ_CST) == 0
+	&& __atomic_load_n(&sched->live, __ATOMIC_ACQUIRE) > 0)
+		pthread_cond_wait(&sched->idle_cond, &sched->idle_lock);
+
+	__atomic_sub_fetch(&sched->sleeping, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&sched->idle_lock);
+}
+
+/* Makes room in the ring for `capacity` guests, at least */
+static bool reserve(queue_t* queue, int capacity)
+{
+	guest_t**	ring;
+	bool		reserved = true;
+
+	pthread_mutex_lock(&queue->lock);
+
+	/* Grow the ring, and unwrap it while at it */
+	if (queue->capacity < capacity) {
+		if (capacity < 2 * queue->capacity)
+			capacity = 2 * queue->capacity;
+		if (capacity < QUEUE_MIN_CAPACITY)
+			capacity = QUEUE_MIN_CAPACITY;
+
+		ring = malloc(capacity * sizeof *ring);
+		if (ring != NULL) {
+			for (int k = 0; k < queue->count; ++k)
+				ring[k] = queue->ring[(queue->head + k)
+							% queue->capacity];
+			free(queue->ring);
+			queue->ring	= ring;
+			queue->head	= 0;
+			queue->capacity	= capacity;
+		} else {
+			reserved = false;
+		}
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+	return reserved;
+}
+
+/* Returns the number of guests in the queue, this one included. There is
+ * always room, see sched_add. */
+static int push_back(queue_t* queue, guest_t* guest)
+{
+	int count;
+
+	pthread_mutex_lock(&queue->lock);
+
+	queue->ring[(queue->head + queue->count) % queue->capacity] = guest;
+	queue->count += 1;
+	count = queue->count;
+
+	pthread_mutex_unlock(&queue->lock);
+	return count;
+}
+
+static guest_t* pop_front(queue_t* queue)
+{
+	guest_t* guest = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count > 0) {
+		guest		= queue->ring[queue->head];
+		queue->head	= (queue->head + 1) % queue->capacity;
+		queue->count	-= 1;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return guest;
+}
+
+static guest_t* pop_back(queue_t* queue)
+{
+	guest_t* guest = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count > 0) {
+		queue->count	-= 1;
+		guest		= queue->ring[(queue->head + queue->count)
+						% queue->capacity];
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return guest;
+}
@@ -0,0 +1,76 @@
+/*
+ * scheduler.h
+ *
+ * A cooperative scheduler: runs many VMs (guests) on a few worker threads,
+ * each for a quantum of instructions at a time, so that long-running guests
+ * share the workers fairly without an OS thread apiece. A guest is preempted
+ * when its quantum runs out, which VM_run and JIT_run only do between two
+ * instructions, and goes to the back of its worker's ready queue.
+ *
+ * Every worker has a ready queue of its own. A worker whose queue is empty
+ * steals the guest at the back of another worker's queue, i.e. the one that
+ * would otherwise wait the longest, and sleeps if no queue has one, until a
+ * guest is queued or the last one retires. A guest that halts is retired: the
+ * retire callback is given its final state and accounting, and the VM is
+ * then shut down, which frees its private pages.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct	sched_t		sched_t;
+typedef struct	guest_stats_t	guest_stats_t;
+
+/* CPU accounting of one guest */
+struct guest_stats_t {
+	uint64_t	steps;		/* Instructions executed */
+	uint64_t	slices;		/* Quanta it was given */
+	uint64_t	cpu_ns;		/* Worker CPU time spent running it */
+	uint32_t	steals;		/* Times it moved to another worker */
+};
+
+/* Called on a worker thread when guest `id` halts, before `vm` is shut
+ * down. Calls may come from several workers at once. */
+typedef void	(*sched_retire_fn)	(RiscyVM* vm, int id,
+					 const guest_stats_t* stats,
+					 void* user);
+
+/**
+ * sched_create
+ * 	Makes a scheduler with `nbr_workers` threads, which runs each guest
+ * 	for `quantum` instructions at a time, with JIT_run if `use_jit` is
+ * 	set or else VM_run. `retire` may be NULL. Returns NULL if out of
+ * 	memory.
+ */
+sched_t*	sched_create	(int nbr_workers, uint64_t quantum,
+				 bool use_jit, sched_retire_fn retire,
+				 void* user);
+
+/**
+ * sched_add
+ * 	Hands `vm` over to the scheduler as a new guest and returns its id,
+ * 	counting from 0. Guests are spread over the workers' queues in turn.
+ * 	May be called before sched_run, or from the retire callback. Returns
+ * 	-1, leaving `vm` to the caller, if out of memory. Every queue is
+ * 	made large enough for all live guests here, so that running them
+ * 	never has to allocate.
+ */
+int		sched_add	(sched_t* sched, RiscyVM* vm);
+
+/**
+ * sched_run
+ * 	Runs the guests on the workers until all of them have halted. If
+ * 	some worker threads cannot be started, the others run every guest;
+ * 	if none can, this fails with VM_ERROR_THREAD and the guests are left
+ * 	to sched_free.
+ */
+vm_error_t	sched_run	(sched_t* sched);
+
+void		sched_free	(sched_t* sched);
+
+#endif
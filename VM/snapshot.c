@@ -0,0 +1,275 @@
+/* snapshot.c */
+
+#include "snapshot.h"
+#include "image.h"
+#include "memory.h"
+#include "vm.h"
+#include "vm_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADDRESS_SPACE	((uint32_t) NUM_PAGES * PAGE_SIZE)
+#define MAX_RUN		(0xffff)
+
+/* A literal run ends at the first run of this many zero words */
+#define MIN_ZERO_RUN	(3)
+
+static vm_error_t	read_file	(char filename[], uint8_t** bytes,
+					 size_t* size);
+static vm_error_t	restore		(RiscyVM* vm, const uint8_t* bytes,
+					 size_t size);
+static uint32_t		compress	(uint8_t* stream, const RiscyVM* vm);
+static bool		decompress	(uint16_t words[],
+					 const uint8_t* stream, uint32_t size);
+
+vm_error_t VM_snapshot(RiscyVM* vm, char filename[])
+{
+	uint8_t		header[SNAPSHOT_HEADER_SIZE] = { 0 };
+	uint8_t*	stream;
+	uint32_t	size;
+	FILE*		file;
+	bool		written;
+
+	/* The page of registers and the window of extended memory hold what
+	 * the devices show, which restoring could not give back */
+	if (vm->io)
+		return VM_ERROR_DEVICE;
+
+	/* Worst case: one run per literal word */
+	stream = malloc(6 * ADDRESS_SPACE);
+	if (stream == NULL)
+		return VM_ERROR_MEMORY;
+	size = compress(stream, vm);
+
+	memcpy(header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+	image_put16(header + 4, SNAPSHOT_VERSION);
+	image_put16(header + 6, vm->is_running ? SNAPSHOT_FLAG_RUNNING : 0);
+	image_put16(header + 8, vm->pc);
+	image_put16(header + 10, vm->metadata.data_size);
+	image_put16(header + 12, vm->metadata.text_size);
+	for (int i = 0; i < NUM_REGISTERS; ++i)
+		image_put16(header + 16 + 2 * i, vm->regs[i]);
+	image_put32(header + 32, vm->text_writes & 0xffffffff);
+	image_put32(header + 36, vm->text_writes >> 32);
+	image_put32(header + 40, image_checksum(IMAGE_CHECKSUM_INIT,
+							stream, size));
+	image_put32(header + 44, size);
+
+	file = fopen(filename, "wb");
+	if (file == NULL) {
+		free(stream);
+		return VM_ERROR_WRITE;
+	}
+	written = fwrite(header, 1, sizeof header, file) == sizeof header
+		&& fwrite(stream, 1, size, file) == size;
+	if (fclose(file) != 0)
+		written = false;
+
+	free(stream);
+	return written ? VM_OK : VM_ERROR_WRITE;
+}
+
+RiscyVM* VM_restore(char filename[], vm_error_t* error)
+{
+	RiscyVM*	vm	= NULL;
+	uint8_t*	bytes;
+	size_t		size;
+	vm_error_t	result;
+
+	result = read_file(filename, &bytes, &size);
+	if (result == VM_OK) {
+		vm = calloc(1, sizeof *vm);
+		result = vm != NULL ? restore(vm, bytes, size)
+				    : VM_ERROR_MEMORY;
+		free(bytes);
+	}
+
+	if (result != VM_OK) {
+		VM_shutdown(vm);
+		vm = NULL;
+	}
+	if (error != NULL)
+		*error = result;
+
+	return vm;
+}
+
+bool snapshot_detect(char filename[])
+{
+	char	magic[SNAPSHOT_MAGIC_SIZE];
+	bool	found	= false;
+	FILE*	file	= fopen(filename, "rb");
+
+	if (file != NULL) {
+		found = fread(magic, 1, sizeof magic, file) == sizeof magic
+			&& !memcmp(magic, SNAPSHOT_MAGIC, sizeof magic);
+		fclose(file);
+	}
+
+	return found;
+}
+
+static vm_error_t read_file(char filename[], uint8_t** bytes, size_t* size)
+{
+	long	length;
+	FILE*	file	= fopen(filename, "rb");
+
+	if (file == NULL)
+		return VM_ERROR_OPEN;
+
+	if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0
+			|| fseek(file, 0, SEEK_SET) != 0) {
+		fclose(file);
+		return VM_ERROR_OPEN;
+	}
+
+	*bytes = malloc(length > 0 ? length : 1);
+	if (*bytes == NULL) {
+		fclose(file);
+		return VM_ERROR_MEMORY;
+	}
+	if (fread(*bytes, 1, length, file) != (size_t) length) {
+		fclose(file);
+		free(*bytes);
+		return VM_ERROR_OPEN;
+	}
+	fclose(file);
+
+	*size = length;
+	return VM_OK;
+}
+
+/* Sets up `vm`, fresh from calloc, as the snapshot in `bytes` describes */
+static vm_error_t restore(RiscyVM* vm, const uint8_t* bytes, size_t size)
+{
+	uint16_t*	words;
+	uint32_t	stream_size;
+	metadata_t*	md;
+	vm_error_t	error;
+
+	if (size < SNAPSHOT_HEADER_SIZE
+			|| memcmp(bytes, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE))
+		return VM_ERROR_FORMAT;
+	if (image_get16(bytes + 4) != SNAPSHOT_VERSION)
+		return VM_ERROR_VERSION;
+
+	/* The headers and segments have to fit, as for a program */
+	if (1 + (uint32_t) image_get16(bytes + 10) + 1
+			+ image_get16(bytes + 12) > ADDRESS_SPACE)
+		return VM_ERROR_FORMAT;
+
+	/* Truncated */
+	stream_size = image_get32(bytes + 44);
+	if (stream_size != size - SNAPSHOT_HEADER_SIZE)
+		return VM_ERROR_FORMAT;
+	if (image_checksum(IMAGE_CHECKSUM_INIT, bytes + SNAPSHOT_HEADER_SIZE,
+				stream_size) != image_get32(bytes + 40))
+		return VM_ERROR_CHECKSUM;
+
+	words = malloc(ADDRESS_SPACE * sizeof *words);
+	if (words == NULL)
+		return VM_ERROR_MEMORY;
+
+	error = VM_OK;
+	if (!decompress(words, bytes + SNAPSHOT_HEADER_SIZE, stream_size))
+		error = VM_ERROR_FORMAT;
+	else if (!memory_init(vm, words, ADDRESS_SPACE))
+		error = VM_ERROR_MEMORY;
+	free(words);
+	if (error != VM_OK)
+		return error;
+
+	md		= &vm->metadata;
+	md->data_size	= image_get16(bytes + 10);
+	md->data_start	= 1;
+	md->text_size	= image_get16(bytes + 12);
+	md->text_header	= md->data_start + md->data_size;
+	md->text_start	= md->text_header + 1;
+
+	for (int i = 0; i < NUM_REGISTERS; ++i)
+		vm->regs[i] = image_get16(bytes + 16 + 2 * i);
+	vm->pc		= image_get16(bytes + 8);
+	vm->text_writes	= image_get32(bytes + 32)
+			| (uint64_t) image_get32(bytes + 36) << 32;
+	vm->is_running	= image_get16(bytes + 6) & SNAPSHOT_FLAG_RUNNING;
+
+	/* The text may have been written to, so decode what is there now */
+	error = decode_text(vm);
+	if (error != VM_OK)
+		return error;
+
+	/* VM_reset goes back to where the snapshot was taken */
+	save_origin(vm);
+
+	return VM_OK;
+}
+
+static uint32_t compress(uint8_t* stream, const RiscyVM* vm)
+{
+	uint8_t*	out	= stream;
+	uint32_t	address	= 0;
+	uint32_t	zeros;
+	uint32_t	literals;
+	uint32_t	run;
+
+	while (address < ADDRESS_SPACE) {
+		for (zeros = 0; zeros < MAX_RUN && address + zeros
+				< ADDRESS_SPACE; ++zeros) {
+			if (mem_read(vm, address + zeros) != 0)
+				break;
+		}
+		address += zeros;
+
+		/* Take words up to the next long enough run of zeros */
+		for (literals = 0; literals < MAX_RUN && address + literals
+				< ADDRESS_SPACE; ++literals) {
+			for (run = 0; run < MIN_ZERO_RUN && address + literals
+					+ run < ADDRESS_SPACE; ++run) {
+				if (mem_read(vm, address + literals + run))
+					break;
+			}
+			if (run == MIN_ZERO_RUN || address + literals + run
+					== ADDRESS_SPACE)
+				break;
+		}
+
+		image_put16(out, zeros);
+		image_put16(out + 2, literals);
+		out += 4;
+		for (uint32_t i = 0; i < literals; ++i, out += 2)
+			image_put16(out, mem_read(vm, address + i));
+		address += literals;
+	}
+
+	return out - stream;
+}
+
+/* Returns false if the stream does not cover memory exactly */
+static bool decompress(uint16_t words[], const uint8_t* stream, uint32_t size)
+{
+	const uint8_t*	end	= stream + size;
+	uint32_t	address	= 0;
+	uint32_t	zeros;
+	uint32_t	literals;
+
+	while (address < ADDRESS_SPACE) {
+		if (end - stream < 4)
+			return false;
+		zeros		= image_get16(stream);
+		literals	= image_get16(stream + 2);
+		stream		+= 4;
+
+		if (address + zeros + literals > ADDRESS_SPACE
+				|| (uint32_t) (end - stream) < 2 * literals)
+			return false;
+
+		memset(&words[address], 0, zeros * sizeof *words);
+		address += zeros;
+		for (uint32_t i = 0; i < literals; ++i, stream += 2)
+			words[address++] = image_get16(stream);
+	}
+
+	return stream == end;
+}
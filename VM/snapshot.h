@@ -0,0 +1,51 @@
+/*
+ * snapshot.h
+ *
+ * The file written by VM_snapshot and read by VM_restore. It holds the whole
+ * state of a VM, so that a long computation can be resumed later from where
+ * it stopped. All multi-byte fields are little-endian.
+ *
+ * 	offset	size	field
+ * 	------	----	-----------------------------------------------
+ * 	0	4	magic, "RSCS"
+ * 	4	2	format version (SNAPSHOT_VERSION)
+ * 	6	2	flags (SNAPSHOT_FLAG_*)
+ * 	8	2	pc
+ * 	10	2	size of the data segment, as loaded
+ * 	12	2	size of the text segment, as loaded
+ * 	14	2	reserved, 0
+ * 	16	16	registers r0 to r7
+ * 	32	8	number of stores into the text segment so far
+ * 	40	4	checksum of the memory stream (image_checksum)
+ * 	44	4	size of the memory stream in bytes
+ * 	48	...	memory stream
+ *
+ * The memory stream covers all of memory, from address 0 up. It is a
+ * sequence of runs, each of which is
+ *
+ * 	0	2	number of zero words
+ * 	2	2	number of literal words that follow
+ * 	4	2 * n	the literal words
+ *
+ * so that the mostly empty memory of a typical program takes up little space.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+
+#define SNAPSHOT_MAGIC		"RSCS"
+#define SNAPSHOT_MAGIC_SIZE	(4)
+#define SNAPSHOT_VERSION	(1)
+#define SNAPSHOT_HEADER_SIZE	(48)
+
+#define SNAPSHOT_FLAG_RUNNING	(0x0001)
+
+/**
+ * snapshot_detect
+ * 	Returns true if `filename` starts like a snapshot.
+ */
+bool	snapshot_detect	(char filename[]);
+
+#endif
@@ -0,0 +1,140 @@
+/* stats.c */
+
+#define _POSIX_C_SOURCE	200809L	/* clock_gettime */
+
+#include "stats.h"
+#include "vm_internal.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Names in the JSON, by opcode */
+static const char* opcode_names[STATS_NUM_OPCODES] = {
+	[ADD]	= "add",	[ADDI]	= "addi",
+	[NAND]	= "nand",	[LUI]	= "lui",
+	[SW]	= "sw",		[LW]	= "lw",
+	[BEQ]	= "beq",	[JALR]	= "jalr",
+	[EXT]	= "ext",
+};
+
+static uint64_t	now_ns		(void);
+static bool	host_cycles	(uint64_t* cycles);
+
+stats_t* stats_create(void)
+{
+	stats_t* stats = calloc(1, sizeof *stats);
+
+	if (stats != NULL) {
+		stats->start_ns = now_ns();
+		host_cycles(&stats->start_cycles);
+	}
+	return stats;
+}
+
+vm_error_t stats_start(RiscyVM* vm)
+{
+	stats_t* stats = stats_create();
+
+	if (stats == NULL)
+		return VM_ERROR_MEMORY;
+
+	stats_free(vm->stats);
+	vm->stats = stats;
+	return VM_OK;
+}
+
+void stats_add(stats_t* stats, const uint64_t counts[], uint64_t taken)
+{
+	for (int i = 0; i < STATS_NUM_OPCODES; ++i)
+		stats->counts[i] += counts[i];
+	stats->taken += taken;
+}
+
+vm_error_t stats_write(RiscyVM* vm, char filename[])
+{
+	if (vm->stats == NULL)
+		return VM_OK;
+
+	return stats_save(vm->stats, filename);
+}
+
+vm_error_t stats_save(stats_t* stats, char filename[])
+{
+	uint64_t	ns;
+	uint64_t	instructions	= 0;
+	uint64_t	cycles;
+	double		seconds;
+	FILE*		file;
+	bool		written;
+
+	ns	= now_ns() - stats->start_ns;
+	seconds	= ns / 1e9;
+	for (int i = 0; i < STATS_NUM_OPCODES; ++i)
+		instructions += stats->counts[i];
+
+	file = fopen(filename, "w");
+	if (file == NULL)
+		return VM_ERROR_WRITE;
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"instructions\": %"PRIu64",\n", instructions);
+	fprintf(file, "  \"opcodes\": {");
+	for (int i = 0; i < STATS_NUM_OPCODES; ++i) {
+		fprintf(file, "%s\"%s\": %"PRIu64, i > 0 ? ", " : " ",
+				opcode_names[i], stats->counts[i]);
+	}
+	fprintf(file, " },\n");
+	fprintf(file, "  \"loads\": %"PRIu64",\n", stats->counts[LW]);
+	fprintf(file, "  \"stores\": %"PRIu64",\n", stats->counts[SW]);
+	fprintf(file, "  \"jalr\": %"PRIu64",\n", stats->counts[JALR]);
+	fprintf(file, "  \"beq_taken\": %"PRIu64",\n", stats->taken);
+	fprintf(file, "  \"beq_taken_ratio\": %.6f,\n",
+			stats->counts[BEQ] > 0
+			? (double) stats->taken / stats->counts[BEQ] : 0.0);
+	fprintf(file, "  \"wall_seconds\": %.9f,\n", seconds);
+	if (host_cycles(&cycles))
+		fprintf(file, "  \"host_cycles\": %"PRIu64",\n",
+				cycles - stats->start_cycles);
+	else
+		fprintf(file, "  \"host_cycles\": null,\n");
+	fprintf(file, "  \"mips\": %.2f\n", seconds > 0
+			? instructions / seconds / 1e6 : 0.0);
+	fprintf(file, "}\n");
+
+	written = !ferror(file);
+	if (fclose(file) != 0)
+		written = false;
+
+	return written ? VM_OK : VM_ERROR_WRITE;
+}
+
+void stats_free(stats_t* stats)
+{
+	free(stats);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The time stamp counter, on hosts that have one */
+static bool host_cycles(uint64_t* cycles)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	uint32_t lo;
+	uint32_t hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	*cycles = (uint64_t) hi << 32 | lo;
+	return true;
+#else
+	*cycles = 0;
+	return false;
+#endif
+}
@@ -0,0 +1,75 @@
+/*
+ * stats.h
+ *
+ * Run statistics. While stats are attached to a VM, every engine counts how
+ * many times each opcode is executed and how many BEQs are taken, and adds
+ * the counts up when it returns. The interpreter keeps them in locals of its
+ * loop, at an increment per instruction. Translated code (JIT_run, AOT_run)
+ * counts a block's opcodes once per exit of the block, and lockstep_run
+ * counts for all lanes of a group at once.
+ *
+ * The plain interpreter loop and translated code do not count when no stats
+ * are attached. The loops used for --profile, --trace, --step and --verbose
+ * always count, and drop the counts if there are no stats to add them to.
+ * stats_write adds the time taken and writes it all as JSON.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "vm.h"
+
+#include <stdint.h>
+
+#define STATS_NUM_OPCODES	(9)	/* The eight of RiSC-16, and EXT */
+
+typedef struct	stats_t		stats_t;
+
+struct stats_t {
+	uint64_t	counts[STATS_NUM_OPCODES];	/* Per opcode */
+	uint64_t	taken;				/* Taken BEQs */
+	uint64_t	start_ns;			/* Wall clock */
+	uint64_t	start_cycles;			/* Host cycles */
+};
+
+/**
+ * stats_create
+ * 	Returns new stats, with the clock started, or NULL if out of memory.
+ * 	Used on their own to add up the stats of many VMs.
+ */
+stats_t*	stats_create	(void);
+
+/**
+ * stats_start
+ * 	Attaches new stats to `vm`, in place of those it has, if any, and
+ * 	starts the clock. They are freed by VM_shutdown.
+ */
+vm_error_t	stats_start	(RiscyVM* vm);
+
+/**
+ * stats_add
+ * 	Adds the counts of one run, or of another VM's stats.
+ */
+void		stats_add	(stats_t* stats, const uint64_t counts[],
+				 uint64_t taken);
+
+/**
+ * stats_write
+ * 	Stops the clock and writes the stats attached to `vm`, if any, to
+ * 	`filename` as one JSON object.
+ */
+vm_error_t	stats_write	(RiscyVM* vm, char filename[]);
+
+/**
+ * stats_save
+ * 	Same as stats_write, for stats of their own.
+ */
+vm_error_t	stats_save	(stats_t* stats, char filename[]);
+
+/**
+ * stats_free
+ * 	Releases stats. Called by VM_shutdown.
+ */
+void		stats_free	(stats_t* stats);
+
+#endif
@@ -0,0 +1,125 @@
+/* tracer.c */
+
+#define _POSIX_C_SOURCE	200809L	/* nanosleep */
+
+#include "tracer.h"
+#include "vm_internal.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WRITER_SLEEP_NS	(100 * 1000)	/* When the ring is empty */
+
+static void*	writer	(void* arg);
+
+vm_error_t tracer_start(RiscyVM* vm, char filename[])
+{
+	uint8_t		header[TRACE_HEADER_SIZE] = { 0 };
+	uint16_t	fields[3] = {
+		TRACE_VERSION, TRACE_BYTE_ORDER, TRACE_RECORD_SIZE
+	};
+	tracer_t*	tracer;
+	vm_error_t	error	= VM_OK;
+
+	tracer = calloc(1, sizeof *tracer);
+	if (tracer == NULL)
+		return VM_ERROR_MEMORY;
+
+	tracer->file = fopen(filename, "wb");
+	if (tracer->file == NULL) {
+		free(tracer);
+		return VM_ERROR_WRITE;
+	}
+
+	memcpy(header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+	memcpy(header + TRACE_MAGIC_SIZE, fields, sizeof fields);
+	if (fwrite(header, 1, sizeof header, tracer->file) != sizeof header)
+		error = VM_ERROR_WRITE;
+	else if (pthread_create(&tracer->thread, NULL, writer, tracer) != 0)
+		error = VM_ERROR_THREAD;
+
+	if (error != VM_OK) {
+		fclose(tracer->file);
+		free(tracer);
+		return error;
+	}
+
+	tracer_close(vm->tracer);
+	vm->tracer = tracer;
+	return VM_OK;
+}
+
+vm_error_t tracer_stop(RiscyVM* vm)
+{
+	bool written = tracer_close(vm->tracer);
+
+	vm->tracer = NULL;
+	return written ? VM_OK : VM_ERROR_WRITE;
+}
+
+bool tracer_close(tracer_t* tracer)
+{
+	bool written;
+
+	if (tracer == NULL)
+		return true;
+
+	__atomic_store_n(&tracer->done, true, __ATOMIC_RELEASE);
+	pthread_join(tracer->thread, NULL);
+
+	written = !tracer->failed;
+	if (fclose(tracer->file) != 0)
+		written = false;
+
+	free(tracer);
+	return written;
+}
+
+void tracer_wait(void)
+{
+	sched_yield();
+}
+
+/* Drains the ring to the file until the VM is done with it. Records are
+ * written straight from the ring, in at most two runs per pass when the
+ * filled part wraps around the end. */
+static void* writer(void* arg)
+{
+	tracer_t*	tracer	= arg;
+	uint64_t	tail	= tracer->tail;
+	uint64_t	head;
+	uint64_t	start;
+	uint64_t	count;
+	bool		done;
+	struct timespec	sleep	= { 0, WRITER_SLEEP_NS };
+
+	for (;;) {
+		/* Read `done` first: once it is set, `head` is final */
+		done = __atomic_load_n(&tracer->done, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&tracer->head, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			if (done)
+				break;
+			nanosleep(&sleep, NULL);
+			continue;
+		}
+
+		start	= tail & (TRACER_RING_SIZE - 1);
+		count	= head - tail;
+		if (count > TRACER_RING_SIZE - start)
+			count = TRACER_RING_SIZE - start;
+
+		/* After a failure, the records are only dropped */
+		if (!tracer->failed && fwrite(&tracer->ring[start],
+				TRACE_RECORD_SIZE, count, tracer->file) != count)
+			tracer->failed = true;
+
+		tail += count;
+		__atomic_store_n(&tracer->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,88 @@
+/*
+ * tracer.h
+ *
+ * Binary execution tracer. While a tracer is attached to a VM, VM_run appends
+ * one trace_record_t (see Common/trace.h) per instruction to a ring buffer,
+ * and a background thread drains the buffer to the trace file. The ring is a
+ * single-producer, single-consumer queue without locks: the VM only ever
+ * advances `head` and the writer thread only ever advances `tail`. The VM
+ * waits when the ring is full, so no records are lost. If a write fails, the
+ * writer keeps emptying the ring, so that the VM never waits for good, and
+ * the failure is reported when the tracer is closed.
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "vm.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACER_RING_SIZE	(1 << 16)	/* Records, a power of two */
+#define TRACER_LINE_SIZE	(64)		/* Keeps head and tail apart */
+
+typedef struct	tracer_t	tracer_t;
+
+struct tracer_t {
+	uint64_t	head;		/* Next record to write, VM only */
+	uint64_t	cached_tail;	/* Last tail seen by the VM */
+	char		pad1[TRACER_LINE_SIZE - 2 * sizeof(uint64_t)];
+	uint64_t	tail;		/* Next record to flush, writer only */
+	bool		done;		/* Set when the VM is finished */
+	bool		failed;		/* A write failed, writer only */
+	char		pad2[TRACER_LINE_SIZE - sizeof(uint64_t)
+				- 2 * sizeof(bool)];
+	FILE*		file;
+	pthread_t	thread;
+	trace_record_t	ring[TRACER_RING_SIZE];
+};
+
+/**
+ * tracer_start
+ * 	Creates `filename`, writes the trace header to it and attaches a new
+ * 	tracer to `vm`, in place of the one it has, if any. It is closed by
+ * 	tracer_stop or VM_shutdown.
+ */
+vm_error_t	tracer_start	(RiscyVM* vm, char filename[]);
+
+/**
+ * tracer_stop
+ * 	Closes the tracer of `vm`, if it has one, and detaches it. Fails with
+ * 	VM_ERROR_WRITE if any part of the trace could not be written.
+ */
+vm_error_t	tracer_stop	(RiscyVM* vm);
+
+/**
+ * tracer_close
+ * 	Waits until every record has been written, then closes the file and
+ * 	releases the tracer. Returns false if the trace is incomplete. Called
+ * 	by tracer_stop and VM_shutdown.
+ */
+bool		tracer_close	(tracer_t* tracer);
+
+/**
+ * tracer_wait
+ * 	Called by tracer_push when the ring is full.
+ */
+void		tracer_wait	(void);
+
+static inline void tracer_push(tracer_t* tracer, const trace_record_t* record)
+{
+	uint64_t head = tracer->head;
+
+	while (head - tracer->cached_tail == TRACER_RING_SIZE) {
+		tracer->cached_tail = __atomic_load_n(&tracer->tail,
+							__ATOMIC_ACQUIRE);
+		if (head - tracer->cached_tail == TRACER_RING_SIZE)
+			tracer_wait();
+	}
+
+	tracer->ring[head & (TRACER_RING_SIZE - 1)] = *record;
+	__atomic_store_n(&tracer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
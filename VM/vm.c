@@ -1,137 +1,326 @@
+#define _POSIX_C_SOURCE	200809L	/* fdopen, mmap */
+
 #include "vm.h"
+#include "vm_internal.h"
+#include "jit.h"
 #include "macros.h"
+#include "memory.h"
+#include "image.h"
+#include "snapshot.h"
 
+#include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-/* Constants  */
-#define MEMORY_SIZE		(0xffff)	/* 2^16 - 1 */
-#define STACK_BOTTOM		(MEMORY_SIZE)
-#define WORD_SIZE		(16)		/* bits */
-#define NUM_REGISTERS		(8)
-
-/* Instructions */
-#define ADD	(0x000)
-#define ADDI	(0x001)
-#define NAND	(0x002)
-#define LUI	(0x003)
-#define SW	(0x004)
-#define LW	(0x005)
-#define BEQ	(0x006)
-#define JALR	(0x007)
-
-/* Instruction masks */
-#define MASK_OPCODE	(0xe000)	/* 1110 0000 0000 0000 */
-#define MASK_REG_A	(0x1c00)	/* 0001 1100 0000 0000 */
-#define MASK_REG_B	(0x0380)	/* 0000 0011 1000 0000 */
-#define MASK_REG_C	(0x0007)	/* 0000 0000 0000 0111 */
-#define MASK_SIMM	(0x007f)	/* 0000 0000 0111 1111 */
-#define MASK_UIMM	(0x03ff)	/* 0000 0011 1111 1111 */
-
-/* If true, more information will be printed. Defined in vm_main.c. */
-extern bool print_verbose_output;
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* If true, more information will be printed. Set by run's --verbose. */
+bool print_verbose_output;
+
+/* If true, the extension instructions are rejected. Set by run's --strict. */
+bool strict_risc16;
+
+/* For --verbose */
+static const char* extension_names[] = {
+	[EXT_MUL]	= "mul",	[EXT_MULH]	= "mulh",
+	[EXT_DIVU]	= "divu",	[EXT_REMU]	= "remu",
+	[EXT_SLL]	= "sll",	[EXT_SRL]	= "srl",
+	[EXT_SRA]	= "sra",
+};
 
 /* Utility functions */
-static uint16_t	load_to_array_from_file	(uint16_t array[], FILE* file);
+static vm_error_t load_program		(RiscyVM* vm, const char filename[],
+					 uint32_t* size);
+static vm_error_t load_from_file	(RiscyVM* vm, FILE* file,
+					 uint32_t* size);
+static vm_error_t load_from_image	(RiscyVM* vm, const uint8_t* image,
+					 size_t size);
+static vm_error_t start_program		(RiscyVM* vm, const metadata_t* md);
+static void	print_loaded		(RiscyVM* vm, uint32_t num_lines);
 static char*	dec_to_bin		(char* bin, int dec, int nbr_bits);
 static void	sign_n_bits		(uint16_t* s, unsigned int n);
 
-typedef struct	metadata_t	metadata_t;
-typedef struct	instruction_t	instruction_t;
+static instruction_t	decode_word	(uint16_t instruction);
+static void		redecode_if_text(RiscyVM* vm, uint16_t address);
+static void		fuse		(RiscyVM* vm, uint16_t offset);
 
-struct metadata_t {
-	uint16_t	data_size;	/* Number of lines of data */
-	uint16_t	data_start;     /* Start address of data */
-	uint16_t	text_header;    /* The address of the text header */
-	uint16_t	text_size;      /* Number of lines of text */
-	uint16_t	text_start;     /* Start address of text */
-};
+RiscyVM* VM_init(char filename[])
+{
+	RiscyVM*	vm;
+	vm_error_t	error;
 
-struct instruction_t {
-	uint16_t	opcode;		/* Operation code */
-	uint16_t	regA;		/* Register A */
-	uint16_t	regB;		/* Register B */
-	uint16_t	regC;		/* Register C */
-	uint16_t	simm;		/* Signed immediate */
-	uint16_t	uimm;		/* Unsigned immediate */
-};
+	vm = VM_open(filename, &error);
+	if (vm == NULL) {
+		ERROR("\tCould not load \"%s\": %s\n", filename,
+				VM_strerror(error));
+	}
 
-struct RiscyVM {
-	uint16_t	regs[NUM_REGISTERS];	/* Registers */
-	uint16_t	program[MEMORY_SIZE];	/* Integer instructions */
-	uint16_t	pc;			/* Program counter */
+	return vm;
+}
 
-	metadata_t	metadata;		/* Information about program */
-	instruction_t	current_instruction;	/* Instruction executed during
-						   the current cycle */
+RiscyVM* VM_open(char filename[], vm_error_t* error)
+{
+	RiscyVM*	vm;
+	vm_error_t	result;
+
+	/* Resume a snapshot where it left off */
+	if (snapshot_detect(filename))
+		return VM_restore(filename, error);
+
+	vm	= VM_create();
+	result	= vm != NULL ? VM_load_file(vm, filename) : VM_ERROR_MEMORY;
+	if (result != VM_OK) {
+		VM_shutdown(vm);
+		vm = NULL;
+	}
+	if (error != NULL)
+		*error = result;
 
-	bool		is_running;		/* PC != last instruction */
-};
+	return vm;
+}
 
-RiscyVM* VM_init(char filename[])
+RiscyVM* VM_create(void)
 {
-	FILE* file = fopen(filename, "r");
-	if (file == NULL) {
-		ERROR("\tCould not open file \"%s\".\n", filename);
-	}
+	RiscyVM* vm = calloc(1, sizeof *vm);
 
-	RiscyVM* vm = malloc(sizeof *vm);
-	if (vm == NULL) {
-		ERROR("\t%s", OUT_OF_MEMORY);
+	/* Until a program is loaded, memory is all zeros and nothing runs */
+	if (vm != NULL && !memory_init(vm, NULL, 0)) {
+		free(vm);
+		vm = NULL;
 	}
 
-	/* Initialize all registers to hold the value 0 */
-	memset(vm->regs, 0, sizeof vm->regs);
+	return vm;
+}
 
-	/* Set r7 (stack pointer) to point to the top of the stack. */
-	vm->regs[7] = STACK_BOTTOM;
-	DEBUG_VAR("", vm->regs[7], "\t(Stack Pointer)\n", "0x%04x");
+vm_error_t VM_load_file(RiscyVM* vm, const char filename[])
+{
+	vm_error_t	error;
+	uint32_t	num_lines;
 
-	/* Load each line of the binary program into the VM's program array */
 	if (print_verbose_output)
 		printf("Loading values from file \"%s\" ... ", filename);
-	int num_lines = load_to_array_from_file(vm->program, file);
-	if (print_verbose_output)
-		printf("%d lines loaded from \"%s\".\n\n", num_lines, filename);
 
-	/* Close the file; we don't need it anymore */
-	rewind(file);
-	fclose(file);
+	error = load_program(vm, filename, &num_lines);
+	if (error == VM_OK && print_verbose_output) {
+		print_loaded(vm, num_lines);
+		printf("%"PRIu32" lines loaded from \"%s\".\n\n", num_lines,
+				filename);
+	}
+
+	return error;
+}
+
+vm_error_t VM_load_image(RiscyVM* vm, const void* image, size_t size)
+{
+	if (size < IMAGE_HEADER_SIZE
+			|| memcmp(image, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) != 0)
+		return VM_ERROR_FORMAT;
+
+	return load_from_image(vm, image, size);
+}
+
+/* `words` is the program as laid out in memory: the data header, the data,
+ * the text header and the text. */
+vm_error_t VM_load_buffer(RiscyVM* vm, const uint16_t words[],
+				uint32_t nbr_words)
+{
+	metadata_t	md;
 
 	/* _size is the value in the address of the header.
 	 * _start is the address of the first line of the data/text.
 	 */
-	metadata_t* md	= &vm->metadata;
-	md->data_size	= vm->program[0];
-	md->data_start	= 1;
-	md->text_size	= vm->program[md->data_start + md->data_size];
-	md->text_header = md->data_start + md->data_size;
-	md->text_start	= md->text_header + 1;
+	if (nbr_words < 2 || nbr_words > MEMORY_SIZE + 1
+			|| (uint32_t) words[0] + 2 > nbr_words)
+		return VM_ERROR_FORMAT;
+
+	md.data_size	= words[0];
+	md.data_start	= 1;
+	md.text_header	= md.data_start + md.data_size;
+	md.text_size	= words[md.text_header];
+	md.text_start	= md.text_header + 1;
+
+	if ((uint32_t) md.text_start + md.text_size > MEMORY_SIZE + 1)
+		return VM_ERROR_FORMAT;
+
+	if (!memory_init(vm, words, nbr_words))
+		return VM_ERROR_MEMORY;
+
+	return start_program(vm, &md);
+}
+
+/* Sets up a VM whose memory has just been loaded with a program laid out as
+ * `md` describes */
+static vm_error_t start_program(RiscyVM* vm, const metadata_t* md)
+{
+	vm_error_t error;
+
+	vm->metadata = *md;
 
 	/* Debug metadata */
 	DEBUG_VAR("", md->data_start	, "\n", PRINT_FORMAT);
 	DEBUG_VAR("", md->data_size	, "\n", PRINT_FORMAT);
 	DEBUG_VAR("", md->text_header	, "\n", PRINT_FORMAT);
-	DEBUG_VAR("", md->data_start	, "\n", PRINT_FORMAT);
-	DEBUG_VAR("", md->data_start	, "\n", PRINT_FORMAT);
+	DEBUG_VAR("", md->text_size	, "\n", PRINT_FORMAT);
+	DEBUG_VAR("", md->text_start	, "\n", PRINT_FORMAT);
+
+	/* Decode the text segment once, up front */
+	error = decode_text(vm);
+	if (error != VM_OK) {
+		vm->is_running = false;
+		return error;
+	}
+
+	/* Code translated for the previous program is of no use */
+	JIT_free(vm->jit);
+	vm->jit		= NULL;
+	vm->text_writes	= 0;
+
+	/* Initialize all registers to hold the value 0, except for r7 (stack
+	 * pointer), which points to the top of the stack. */
+	memset(vm->regs, 0, sizeof vm->regs);
+	vm->regs[7] = STACK_BOTTOM;
+	DEBUG_VAR("", vm->regs[7], "\t(Stack Pointer)\n", "0x%04x");
 
 	/* Set program counter to point to the first instruction */
 	vm->pc = md->text_start;
 	DEBUG_VAR("", vm->pc, "\n\n", PRINT_FORMAT);
 
-	/* Set the running flag */
-	vm->is_running = true;
+	vm->is_running	= true;
+	vm->error	= VM_OK;
+	save_origin(vm);
 
-	return vm;
+	return VM_OK;
+}
+
+/* Puts the VM back in the state it was in right after loading, without
+ * allocating anything but the pages it stores into from then on */
+vm_error_t VM_reset(RiscyVM* vm)
+{
+	origin_t*	origin	= vm->origin;
+	vm_error_t	error;
+
+	if (vm->decoded == NULL)
+		return VM_ERROR_NOT_LOADED;
+
+	memory_reset(vm);
+
+	/* Text the program wrote to has to be decoded, and translated, again */
+	if (vm->text_writes != origin->text_writes) {
+		JIT_free(vm->jit);
+		vm->jit = NULL;
+
+		error = decode_text(vm);
+		if (error != VM_OK)
+			return error;
+	}
+
+	memcpy(vm->regs, origin->regs, sizeof vm->regs);
+	vm->pc		= origin->pc;
+	vm->text_writes	= origin->text_writes;
+	vm->is_running	= origin->is_running;
+	vm->error	= VM_OK;
+
+	return io_refresh(vm);
+}
+
+void save_origin(RiscyVM* vm)
+{
+	memcpy(vm->origin->regs, vm->regs, sizeof vm->regs);
+	vm->origin->pc		= vm->pc;
+	vm->origin->text_writes	= vm->text_writes;
+	vm->origin->is_running	= vm->is_running;
+}
+
+uint16_t VM_read(RiscyVM* vm, uint16_t address)
+{
+	return mem_read(vm, address);
+}
+
+const char* VM_strerror(vm_error_t error)
+{
+	switch (error) {
+	case VM_OK:			return "No error";
+	case VM_ERROR_MEMORY:		return "Out of memory";
+	case VM_ERROR_OPEN:		return "Could not open or read the file";
+	case VM_ERROR_FORMAT:		return "Not a valid file, or too large "
+						"to fit";
+	case VM_ERROR_VERSION:		return "Unsupported image version";
+	case VM_ERROR_CHECKSUM:		return "Image checksum mismatch";
+	case VM_ERROR_NOT_LOADED:	return "No program loaded";
+	case VM_ERROR_EXTENSION:	return "Program uses extension "
+						"instructions";
+	case VM_ERROR_WRITE:		return "Could not create or write the "
+						"file";
+	case VM_ERROR_THREAD:		return "Could not start a thread";
+	case VM_ERROR_WINDOW:		return "Program overlaps the extended "
+						"memory window";
+	case VM_ERROR_DEVICE:		return "Not possible with devices "
+						"attached";
+	}
+	return "Unknown error";
+}
+
+RiscyVM* VM_clone(RiscyVM* vm, vm_error_t* error)
+{
+	RiscyVM*	clone	= malloc(sizeof *clone);
+	instruction_t*	decoded	= malloc((vm->metadata.text_size + 1)
+					* sizeof *decoded);
+
+	if (clone == NULL || decoded == NULL) {
+		free(clone);
+		free(decoded);
+		if (error != NULL)
+			*error = VM_ERROR_MEMORY;
+		return NULL;
+	}
+
+	*clone = *vm;
+	clone->jit	= NULL;
+	clone->profile	= NULL;
+	clone->stats	= NULL;
+	clone->tracer	= NULL;
+	clone->output	= NULL;
+	clone->xmem	= NULL;
+	clone->io	= false;
+	clone->verbose	= false;
+	clone->step	= false;
+
+	clone->decoded = decoded;
+	memcpy(clone->decoded, vm->decoded,
+			vm->metadata.text_size * sizeof *clone->decoded);
+
+	memory_share(clone, vm);
+
+	if (error != NULL)
+		*error = VM_OK;
+	return clone;
+}
+
+/* Forking a VM mid-run is cloning it: the pages are shared until either VM
+ * stores into one (see memory.h), so only the pages written after the fork
+ * are ever copied. */
+RiscyVM* VM_fork(RiscyVM* vm, vm_error_t* error)
+{
+	return VM_clone(vm, error);
 }
 
 void VM_shutdown(RiscyVM* vm)
 {
-	if (vm != NULL)
+	if (vm != NULL) {
+		JIT_free(vm->jit);
+		profile_free(vm->profile);
+		stats_free(vm->stats);
+		tracer_close(vm->tracer);
+		output_close(vm->output);
+		memory_free(vm);
+		xmem_close(vm->xmem);
+		free(vm->decoded);
 		free(vm);
+	}
 }
 
 bool VM_is_running(RiscyVM* vm)
@@ -139,6 +328,11 @@ bool VM_is_running(RiscyVM* vm)
 	return vm->is_running;
 }
 
+vm_error_t VM_error(RiscyVM* vm)
+{
+	return vm->error;
+}
+
 void VM_print_regs(RiscyVM* vm)
 {
 	uint16_t* r = vm->regs;
@@ -168,10 +362,19 @@ void VM_print_data(RiscyVM* vm)
 {
 	for (int i = 0; i < vm->metadata.data_size; ++i) {
 		printf("Data[ %2d ] = "PRINT_FORMAT"\n", i,
-			vm->program[vm->metadata.data_start + i]);
+			mem_read(vm, vm->metadata.data_start + i));
 	}
 }
 
+void VM_print_memory(RiscyVM* vm)
+{
+	memory_stats_t stats;
+
+	memory_stats(vm, &stats);
+	printf("Memory: %d private pages (%zu bytes), %d shared, %d zero\n",
+		stats.private, stats.bytes, stats.shared, stats.zero);
+}
+
 void VM_fetch(RiscyVM* vm)
 {
 	if (vm->pc >= vm->metadata.text_header + vm->metadata.text_size)
@@ -182,37 +385,30 @@ void VM_fetch(RiscyVM* vm)
 
 void VM_decode(RiscyVM* vm)
 {
-	uint16_t instruction	= vm->program[vm->pc - 1];
-
-	uint16_t opcode		= (instruction & MASK_OPCODE) >> (16 - 3);
-	uint16_t regA		= (instruction & MASK_REG_A)  >> (16 - 6);
-	uint16_t regB		= (instruction & MASK_REG_B)  >> (16 - 9);
-	uint16_t regC		= (instruction & MASK_REG_C);
-	uint16_t simm		= (instruction & MASK_SIMM);
-	uint16_t uimm		= (instruction & MASK_UIMM);
+	uint16_t	address	= vm->pc - 1;
+	uint16_t	offset	= address - vm->metadata.text_start;
 
 	if (print_verbose_output) {
 		char binbuf[17];
-		printf("%s\n", dec_to_bin(binbuf, instruction, 16));
+		printf("%s\n", dec_to_bin(binbuf, mem_read(vm, address), 16));
 	}
 
-	/* If the MSB of simm is 1, convert to the negative version */
-	sign_n_bits(&simm, 7);
+	/* Words of text come straight out of the pre-decoded table; anything
+	 * else (e.g. a jump into the data segment) is decoded on the spot. */
+	if (offset < vm->metadata.text_size)
+		vm->current_instruction = vm->decoded[offset];
+	else
+		vm->current_instruction = decode_word(mem_read(vm, address));
 
 	/* The contents of register 0 should always be 0 */
-	if (regA == 0)	{ vm->regs[regA] = 0; }
-	if (regB == 0)	{ vm->regs[regB] = 0; }
-	if (regC == 0)	{ vm->regs[regC] = 0; }
-
-	DEBUG_VAR("", opcode,	"\n", PRINT_FORMAT);
-	DEBUG_VAR("", regA,	"\n", PRINT_FORMAT);
-	DEBUG_VAR("", regB,	"\n", PRINT_FORMAT);
-	DEBUG_VAR("", regC,	"\n", PRINT_FORMAT);
-	DEBUG_VAR("", simm,	"\n", PRINT_FORMAT);
-	DEBUG_VAR("", uimm,	"\n", PRINT_FORMAT);
-
-	vm->current_instruction = (instruction_t) { opcode, regA, regB, regC,
-							simm, uimm };
+	vm->regs[0] = 0;
+
+	DEBUG_VAR("", vm->current_instruction.opcode,	"\n", PRINT_FORMAT);
+	DEBUG_VAR("", vm->current_instruction.regA,	"\n", PRINT_FORMAT);
+	DEBUG_VAR("", vm->current_instruction.regB,	"\n", PRINT_FORMAT);
+	DEBUG_VAR("", vm->current_instruction.regC,	"\n", PRINT_FORMAT);
+	DEBUG_VAR("", vm->current_instruction.simm,	"\n", PRINT_FORMAT);
+	DEBUG_VAR("", vm->current_instruction.uimm,	"\n", PRINT_FORMAT);
 }
 
 void VM_execute(RiscyVM* vm)
@@ -255,17 +451,25 @@ void VM_execute(RiscyVM* vm)
 					__FILE__, __func__);
 		break;
 
-	case SW:
-		vm->program[vm->regs[regB] + simm] = vm->regs[regA];
+	case SW: {
+		uint16_t address = vm->regs[regB] + simm;
+		if (!mem_write(vm, address, vm->regs[regA])) {
+			/* Stop at the store, as VM_run does */
+			vm->pc		-= 1;
+			vm->is_running	= false;
+			break;
+		}
+		redecode_if_text(vm, address);
 		if (print_verbose_output)
 			printf("sw r%d, r%d, "PRINT_FORMAT"\n",
 				regA, regB, simm);
 		break;
+	}
 
 	case LW:
 		if (print_verbose_output)
 			printf("lw r%d, r%d, "PRINT_FORMAT"\n", regA, regB, simm);
-		vm->regs[regA] = vm->program[vm->regs[regB] + simm];
+		vm->regs[regA] = mem_read(vm, vm->regs[regB] + simm);
 		break;
 
 	case BEQ:
@@ -285,34 +489,379 @@ void VM_execute(RiscyVM* vm)
 		if (print_verbose_output)
 			printf("jalr r%d, r%d\n", regA, regB);
 		break;
+
+	case EXT:
+		vm->regs[regA] = extension_result(
+				vm->current_instruction.operation,
+				vm->regs[regB], vm->regs[regC]);
+
+		if (print_verbose_output)
+			printf("%s r%d, r%d, r%d\n", extension_names[
+				vm->current_instruction.operation],
+				regA, regB, regC);
+		break;
 	}
 }
 
-static uint16_t load_to_array_from_file(uint16_t array[], FILE* file)
+/* Splits a raw instruction word into its fields, with simm sign extended */
+static instruction_t decode_word(uint16_t instruction)
+{
+	uint16_t opcode		= (instruction & MASK_OPCODE) >> (16 - 3);
+	uint16_t regA		= (instruction & MASK_REG_A)  >> (16 - 6);
+	uint16_t regB		= (instruction & MASK_REG_B)  >> (16 - 9);
+	uint16_t regC		= (instruction & MASK_REG_C);
+	uint16_t simm		= (instruction & MASK_SIMM);
+	uint16_t uimm		= (instruction & MASK_UIMM);
+	uint16_t operation	= 0;
+
+	/* If the MSB of simm is 1, convert to the negative version */
+	sign_n_bits(&simm, 7);
+
+	if (IS_EXTENSION(instruction) && !strict_risc16) {
+		opcode		= EXT;
+		operation	= EXT_OPERATION(instruction);
+	}
+
+	return (instruction_t) { opcode, regA, regB, regC, simm, uimm,
+				 operation, opcode };
+}
+
+/* Builds the table of pre-decoded instructions, one entry per word of text */
+vm_error_t decode_text(RiscyVM* vm)
+{
+	metadata_t*	md	= &vm->metadata;
+	instruction_t*	decoded;
+
+	decoded = realloc(vm->decoded, (md->text_size + 1) * sizeof *decoded);
+	if (decoded == NULL)
+		return VM_ERROR_MEMORY;
+	vm->decoded = decoded;
+
+	for (int i = 0; i < md->text_size; ++i) {
+		uint16_t word = mem_read(vm, md->text_start + i);
+
+		if (strict_risc16 && IS_EXTENSION(word))
+			return VM_ERROR_EXTENSION;
+		vm->decoded[i] = decode_word(word);
+	}
+
+	for (int i = 0; i < md->text_size; ++i)
+		fuse(vm, i);
+
+	return VM_OK;
+}
+
+/* Keeps the pre-decoded table in sync when a store hits the text segment */
+static void redecode_if_text(RiscyVM* vm, uint16_t address)
 {
-	uint16_t	num_lines = 0;
+	uint16_t offset = address - vm->metadata.text_start;
+
+	if (offset < vm->metadata.text_size) {
+		vm->decoded[offset] = decode_word(mem_read(vm, address));
+		vm->text_writes += 1;
+
+		/* The word may be part of a sequence starting a little before */
+		for (int i = 0; i < FUSE_MAX_LENGTH && i <= offset; ++i)
+			fuse(vm, offset - i);
+	}
+}
+
+/* Picks the handler of the pre-decoded instruction at `offset`: a
+ * superinstruction if one of the idioms starts there, else its opcode. Only
+ * the first instruction of a sequence changes, so a branch into the middle of
+ * one executes the rest one by one. A sequence never includes the last word
+ * of text, so that halting works as usual. */
+static void fuse(RiscyVM* vm, uint16_t offset)
+{
+	instruction_t*	in	= &vm->decoded[offset];
+	int		length	= vm->metadata.text_size - 1 - offset;
+	uint16_t	next	= length >= 2 ? in[1].opcode : JALR;
+
+	in->handler = in->opcode;
+
+	if (in->opcode == NAND && next == NAND && length >= 3
+			&& in[2].opcode == NAND)
+		in->handler = FUSED(FUSE_NAND3, NAND);
+	else if (in->opcode == NAND && next == NAND)
+		in->handler = FUSED(FUSE_NAND_NAND, NAND);
+	else if (in->opcode == LUI && next == ADDI)
+		in->handler = FUSED(FUSE_LUI_ADDI, LUI);
+	else if (in->opcode == ADDI && next == BEQ)
+		in->handler = FUSED(FUSE_ADDI_BEQ, ADDI);
+	else if (in->opcode == SW && next == SW)
+		in->handler = FUSED(FUSE_SW_SW, SW);
+	else if (in->opcode == LW && next == LW)
+		in->handler = FUSED(FUSE_LW_LW, LW);
+}
+
+/* The variants of the interpreter loop; see interp.h */
+#define RUN_NAME	run_plain
+#define RUN_FUSE	1
+#define RUN_PROFILE	0
+#define RUN_TRACE	0
+#define RUN_STATS	0
+#define RUN_VERBOSE	0
+#define RUN_STEP	0
+#include "interp.h"
+
+#define RUN_NAME	run_stats
+#define RUN_FUSE	1
+#define RUN_PROFILE	0
+#define RUN_TRACE	0
+#define RUN_STATS	1
+#define RUN_VERBOSE	0
+#define RUN_STEP	0
+#include "interp.h"
+
+#define RUN_NAME	run_profile
+#define RUN_FUSE	0
+#define RUN_PROFILE	1
+#define RUN_TRACE	0
+#define RUN_STATS	1
+#define RUN_VERBOSE	0
+#define RUN_STEP	0
+#include "interp.h"
+
+#define RUN_NAME	run_trace
+#define RUN_FUSE	0
+#define RUN_PROFILE	0
+#define RUN_TRACE	1
+#define RUN_STATS	1
+#define RUN_VERBOSE	0
+#define RUN_STEP	0
+#include "interp.h"
+
+#define RUN_NAME	run_profile_trace
+#define RUN_FUSE	0
+#define RUN_PROFILE	1
+#define RUN_TRACE	1
+#define RUN_STATS	1
+#define RUN_VERBOSE	0
+#define RUN_STEP	0
+#include "interp.h"
+
+#define RUN_NAME	run_verbose
+#define RUN_FUSE	0
+#define RUN_PROFILE	0
+#define RUN_TRACE	0
+#define RUN_STATS	1
+#define RUN_VERBOSE	1
+#define RUN_STEP	0
+#include "interp.h"
+
+#define RUN_NAME	run_step
+#define RUN_FUSE	0
+#define RUN_PROFILE	0
+#define RUN_TRACE	0
+#define RUN_STATS	1
+#define RUN_VERBOSE	0
+#define RUN_STEP	1
+#include "interp.h"
+
+#define RUN_NAME	run_step_verbose
+#define RUN_FUSE	0
+#define RUN_PROFILE	0
+#define RUN_TRACE	0
+#define RUN_STATS	1
+#define RUN_VERBOSE	1
+#define RUN_STEP	1
+#include "interp.h"
+
+/* Picks the variant of the loop once per call, so that only the ones with
+ * something to do pay for it. Stepping and verbose output replace profiling
+ * and tracing, as they did when run used VM_fetch, VM_decode and VM_execute
+ * for them. All but the plain loop count for stats, if attached. */
+uint64_t VM_run(RiscyVM* vm, uint64_t max_steps)
+{
+	if (vm->step)
+		return vm->verbose ? run_step_verbose(vm, max_steps)
+				   : run_step(vm, max_steps);
+	if (vm->verbose)
+		return run_verbose(vm, max_steps);
+
+	if (vm->profile != NULL && vm->tracer != NULL)
+		return run_profile_trace(vm, max_steps);
+	if (vm->profile != NULL)
+		return run_profile(vm, max_steps);
+	if (vm->tracer != NULL)
+		return run_trace(vm, max_steps);
+	if (vm->stats != NULL)
+		return run_stats(vm, max_steps);
+
+	return run_plain(vm, max_steps);
+}
+
+void VM_set_debug(RiscyVM* vm, bool verbose, bool step)
+{
+	vm->verbose	= verbose;
+	vm->step	= step;
+}
+
+/* Loads a binary image (see image.h) if `filename` is one, or else a legacy
+ * text file with one hexadecimal word per line, and sets `*size` to the
+ * number of words loaded. Returns VM_ERROR_OPEN if the file cannot be read,
+ * or the error from loading it; `*size` is only meaningful on success. An
+ * image is loaded straight from its mapping. */
+static vm_error_t load_program(RiscyVM* vm, const char filename[],
+				uint32_t* size)
+{
+	struct stat	st;
+	vm_error_t	error;
+	void*		image;
+	FILE*		file;
+	int		fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return VM_ERROR_OPEN;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return VM_ERROR_OPEN;
+	}
+
+	if (st.st_size >= IMAGE_HEADER_SIZE) {
+		image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (image == MAP_FAILED) {
+			close(fd);
+			return VM_ERROR_OPEN;
+		}
+
+		if (memcmp(image, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) == 0) {
+			error = load_from_image(vm, image, st.st_size);
+			munmap(image, st.st_size);
+			close(fd);
+			*size = vm->metadata.text_start
+				+ vm->metadata.text_size;
+			return error;
+		}
+		munmap(image, st.st_size);
+	}
+
+	file = fdopen(fd, "r");
+	if (file == NULL) {
+		close(fd);
+		return VM_ERROR_OPEN;
+	}
+
+	error = load_from_file(vm, file, size);
+	fclose(file);
+
+	return error;
+}
+
+/* The words of a text file have to be parsed before they can be laid out,
+ * so they go through a scratch array */
+static vm_error_t load_from_file(RiscyVM* vm, FILE* file, uint32_t* size)
+{
+	uint32_t	num_lines = 0;
 	char		buffer[WORD_SIZE + 1 + 1];
+	vm_error_t	error;
+
+	uint16_t* array = malloc((MEMORY_SIZE + 1) * sizeof *array);
+	if (array == NULL)
+		return VM_ERROR_MEMORY;
 
-	while (fgets(buffer, sizeof buffer, file)) {
+	while (fgets(buffer, sizeof buffer, file) && num_lines <= MEMORY_SIZE) {
 		strtok(buffer, "\n");
 		array[num_lines++] = (uint16_t) strtol(buffer, NULL, 16);
 	}
 
-	if (print_verbose_output) {
-		printf("done.\nPrinting loaded addresses and values:\n");
-		printf("-------------\n");
-		printf("    Address    Value\n");
-		for (int i = 0; i < num_lines; ++i) {
-			printf("    %6d:    0x%04x", i, array[i]);
-
-			printf("%s\n",	i == 0		  ? "  <-- Data header":
-					i == array[0] + 1 ? "  <-- Text header":
-					"");
-		}
-		printf("-------------\n");
+	*size = num_lines;
+	error = VM_load_buffer(vm, array, num_lines);
+	free(array);
+
+	return error;
+}
+
+/* Fills the pages straight from the segments of a mapped image, with the
+ * header word of each in front of it */
+static vm_error_t load_from_image(RiscyVM* vm, const uint8_t* image,
+					size_t size)
+{
+	const uint8_t*		segment;
+	memory_segment_t	segments[4];
+	uint8_t			headers[2][2];
+	metadata_t		md;
+	uint16_t		nbr_segments	= image_get16(image + 8);
+	uint16_t		type;
+	uint16_t		address;
+	uint16_t		nbr_words;
+	uint32_t		offset;
+	uint32_t		checksum	= IMAGE_CHECKSUM_INIT;
+	uint32_t		expected	= 1;	/* Address after a
+							   header */
+
+	if (image_get16(image + 4) != IMAGE_VERSION)
+		return VM_ERROR_VERSION;
+
+	/* Data and text, whose segment table must fit in the image */
+	if (nbr_segments != 2 || IMAGE_HEADER_SIZE
+			+ (size_t) nbr_segments * IMAGE_SEGMENT_SIZE > size)
+		return VM_ERROR_FORMAT;
+
+	for (int i = 0; i < nbr_segments; ++i) {
+		segment	  = image + IMAGE_HEADER_SIZE + i * IMAGE_SEGMENT_SIZE;
+		type	  = image_get16(segment);
+		address	  = image_get16(segment + 2);
+		nbr_words = image_get16(segment + 4);
+		offset	  = image_get32(segment + 8);
+
+		/* Data and text follow each other, each one preceded by its
+		 * header word, which is the layout the rest of the VM
+		 * expects. */
+		if ((type != IMAGE_SEGMENT_DATA && type != IMAGE_SEGMENT_TEXT)
+		|| address != expected
+		|| (uint32_t) address + nbr_words > MEMORY_SIZE)
+			return VM_ERROR_FORMAT;
+
+		/* Segment lies outside of the image */
+		if (offset > size || 2 * (size_t) nbr_words > size - offset)
+			return VM_ERROR_FORMAT;
+
+		image_put16(headers[i], nbr_words);
+		segments[2 * i] = (memory_segment_t) {
+			.address = address - 1, .size = 1,
+			.bytes = headers[i],
+		};
+		segments[2 * i + 1] = (memory_segment_t) {
+			.address = address, .size = nbr_words,
+			.bytes = image + offset,
+		};
+		checksum = image_checksum(checksum, image + offset,
+						2 * nbr_words);
+
+		expected = (uint32_t) address + nbr_words + 1;
 	}
 
-	return num_lines;
+	if (image_get16(image + 6) & IMAGE_FLAG_CHECKSUM
+	&& checksum != image_get32(image + 12))
+		return VM_ERROR_CHECKSUM;
+
+	md.data_size	= segments[1].size;
+	md.data_start	= segments[1].address;
+	md.text_header	= segments[2].address;
+	md.text_size	= segments[3].size;
+	md.text_start	= segments[3].address;
+
+	if (!memory_init_segments(vm, segments, 4))
+		return VM_ERROR_MEMORY;
+
+	return start_program(vm, &md);
+}
+
+static void print_loaded(RiscyVM* vm, uint32_t num_lines)
+{
+	printf("done.\nPrinting loaded addresses and values:\n");
+	printf("-------------\n");
+	printf("    Address    Value\n");
+	for (uint32_t i = 0; i < num_lines; ++i) {
+		printf("    %6"PRIu32":    0x%04x", i, mem_read(vm, i));
+
+		printf("%s\n",	i == 0		  ? "  <-- Data header":
+				i == mem_read(vm, 0) + 1u ? "  <-- Text header":
+				"");
+	}
+	printf("-------------\n");
 }
 
 static char* dec_to_bin(char* bin, int dec, int nbr_bits)
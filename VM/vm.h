@@ -2,19 +2,88 @@
 #define VM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct	RiscyVM		RiscyVM;
 
+/* Returned by the functions of the library instead of exiting */
+typedef enum {
+	VM_OK = 0,
+	VM_ERROR_MEMORY,	/* Out of memory */
+	VM_ERROR_OPEN,		/* Could not open or read the file */
+	VM_ERROR_FORMAT,	/* Not a program, or one that does not fit;
+				   also any other file that is not valid */
+	VM_ERROR_VERSION,	/* Image written by an unknown version */
+	VM_ERROR_CHECKSUM,	/* Image is corrupt */
+	VM_ERROR_NOT_LOADED,	/* No program has been loaded */
+	VM_ERROR_EXTENSION,	/* Uses extension instructions, which
+				   strict_risc16 rejects */
+	VM_ERROR_WRITE,		/* Could not create or write a file */
+	VM_ERROR_THREAD,	/* Could not start a thread */
+	VM_ERROR_WINDOW,	/* Program overlaps the extended memory
+				   window; see xmem.h */
+	VM_ERROR_DEVICE,	/* Not possible with devices attached */
+} vm_error_t;
+
+/* If true, loading and executing print what they do. Off by default. */
+extern bool	print_verbose_output;
+
+/* If true, programs are plain RiSC-16: one whose text uses the extension
+ * instructions (mul, divu, sll, ...) is not loaded, and extension words that
+ * come up anyway are executed as the JALRs they encode. Off by default. */
+extern bool	strict_risc16;
+
+/* Embedding the VM: a VM made by VM_create holds no program until one is
+ * loaded into it. Loading another program, or VM_reset, reuses the VM. No
+ * function of the library exits the process, except VM_init. A function that
+ * returns a pointer returns NULL on failure, with the reason in `*error`
+ * unless `error` is NULL. */
+RiscyVM*	VM_create	(void);
+vm_error_t	VM_load_buffer	(RiscyVM* vm, const uint16_t words[],
+				 uint32_t nbr_words);
+vm_error_t	VM_load_image	(RiscyVM* vm, const void* image, size_t size);
+vm_error_t	VM_load_file	(RiscyVM* vm, const char filename[]);
+vm_error_t	VM_reset	(RiscyVM* vm);
+uint16_t	VM_read		(RiscyVM* vm, uint16_t address);
+const char*	VM_strerror	(vm_error_t error);
+
+/* Loads a program or, if `filename` is one, restores a snapshot (see
+ * VM_snapshot). VM_init does the same, but exits on any error. */
+RiscyVM*	VM_open		(char filename[], vm_error_t* error);
 RiscyVM*	VM_init		(char filename[]);
+RiscyVM*	VM_clone	(RiscyVM* vm, vm_error_t* error);
+RiscyVM*	VM_fork		(RiscyVM* vm, vm_error_t* error);
 void		VM_shutdown	(RiscyVM* vm);
 bool		VM_is_running	(RiscyVM* vm);
 void		VM_print_regs	(RiscyVM* vm);
 void		VM_print_data	(RiscyVM* vm);
+void		VM_print_memory	(RiscyVM* vm);
 
 void		VM_fetch	(RiscyVM* vm);
 void		VM_decode	(RiscyVM* vm);
 void		VM_execute	(RiscyVM* vm);
 
+uint64_t	VM_run		(RiscyVM* vm, uint64_t max_steps);
+
+/* Why the program stopped before halting, if it did: a store that needed a
+ * page of memory when none could be allocated (VM_ERROR_MEMORY), or a store
+ * to a device that failed (VM_ERROR_WRITE). The VM is then stopped at that
+ * store, which was not done, and is no longer running. VM_OK otherwise;
+ * loading a program and VM_reset set it back to VM_OK. */
+vm_error_t	VM_error	(RiscyVM* vm);
+
+/* Makes VM_run print every instruction it executes, as VM_decode and
+ * VM_execute do with print_verbose_output, and/or show the registers and data
+ * and wait for ENTER after every instruction. Off by default, and for
+ * clones. */
+void		VM_set_debug	(RiscyVM* vm, bool verbose, bool step);
+
+/* A snapshot holds the VM's registers and memory only, so a VM with devices
+ * attached (see io.h), whose state lives outside of it, is refused with
+ * VM_ERROR_DEVICE. */
+vm_error_t	VM_snapshot	(RiscyVM* vm, char filename[]);
+RiscyVM*	VM_restore	(char filename[], vm_error_t* error);
+
 #endif
 
@@ -0,0 +1,192 @@
+/*
+ * vm_internal.h
+ *
+ * Layout of the virtual machine, shared by the modules in VM/ that need to
+ * look inside a RiscyVM. Users of the VM should only include vm.h.
+ */
+
+#ifndef VM_INTERNAL_H
+#define VM_INTERNAL_H
+
+#include "vm.h"
+#include "io.h"
+#include "jit.h"
+#include "output.h"
+#include "profile.h"
+#include "stats.h"
+#include "tracer.h"
+#include "xmem.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Constants  */
+#define MEMORY_SIZE		(0xffff)	/* 2^16 - 1 */
+#define STACK_BOTTOM		(MEMORY_SIZE)
+#define WORD_SIZE		(16)		/* bits */
+#define NUM_REGISTERS		(8)
+
+/* Memory is split into pages, see memory.h */
+#define PAGE_BITS		(8)
+#define PAGE_SIZE		(1 << PAGE_BITS)	/* words */
+#define PAGE_MASK		(PAGE_SIZE - 1)
+#define NUM_PAGES		((MEMORY_SIZE + 1) / PAGE_SIZE)
+
+/* Instructions */
+#define ADD	(0x000)
+#define ADDI	(0x001)
+#define NAND	(0x002)
+#define LUI	(0x003)
+#define SW	(0x004)
+#define LW	(0x005)
+#define BEQ	(0x006)
+#define JALR	(0x007)
+#define EXT	(0x008)		/* Decoded opcode of the extension below */
+
+/* Extension instructions: a JALR whose low 7 bits, unused (and 0) on RiSC-16,
+ * hold an operation in bits 3-6 and register C in bits 0-2. Words with any
+ * other operation there are plain JALRs, as are all of them when
+ * strict_risc16 is set. See documentation.txt. */
+#define EXT_MUL		(1)	/* Low 16 bits of B * C */
+#define EXT_MULH	(2)	/* High 16 bits of B * C, unsigned */
+#define EXT_DIVU	(3)	/* B / C, unsigned; 0xffff if C is 0 */
+#define EXT_REMU	(4)	/* B % C, unsigned; B if C is 0 */
+#define EXT_SLL		(5)	/* B << (C & 15) */
+#define EXT_SRL		(6)	/* B >> (C & 15), logical */
+#define EXT_SRA		(7)	/* B >> (C & 15), arithmetic */
+#define EXT_OPERATION(word)	(((word) & MASK_EXT) >> 3)
+#define IS_EXTENSION(word)	((word) >> 13 == JALR			\
+				 && EXT_OPERATION(word) >= EXT_MUL	\
+				 && EXT_OPERATION(word) <= EXT_SRA)
+
+/* Superinstructions: short sequences that VM_run executes with a single
+ * dispatch. The handler of a decoded instruction is its opcode, or, if one of
+ * these sequences starts there, FUSED(kind, opcode). Masking a handler with
+ * HANDLER_OPCODE gives the opcode back. */
+#define FUSE_LUI_ADDI	(1)	/* lui, addi: load a 16-bit constant */
+#define FUSE_NAND_NAND	(2)	/* nand, nand: AND into one register */
+#define FUSE_NAND3	(3)	/* nand, nand, nand: AND via a scratch */
+#define FUSE_ADDI_BEQ	(4)	/* addi, beq: loop back-edge */
+#define FUSE_SW_SW	(5)	/* sw, sw: save registers on the stack */
+#define FUSE_LW_LW	(6)	/* lw, lw: restore them */
+#define FUSE_MAX_LENGTH	(3)	/* Instructions in the longest one */
+
+#define FUSED(kind, op)	((kind) << 4 | (op))
+#define HANDLER_OPCODE	(0x0f)
+#define NUM_HANDLERS	(128)
+
+/* Instruction masks */
+#define MASK_OPCODE	(0xe000)	/* 1110 0000 0000 0000 */
+#define MASK_REG_A	(0x1c00)	/* 0001 1100 0000 0000 */
+#define MASK_REG_B	(0x0380)	/* 0000 0011 1000 0000 */
+#define MASK_REG_C	(0x0007)	/* 0000 0000 0000 0111 */
+#define MASK_SIMM	(0x007f)	/* 0000 0000 0111 1111 */
+#define MASK_UIMM	(0x03ff)	/* 0000 0011 1111 1111 */
+#define MASK_EXT	(0x0078)	/* 0000 0000 0111 1000 */
+
+typedef struct	metadata_t	metadata_t;
+typedef struct	instruction_t	instruction_t;
+typedef struct	origin_t	origin_t;
+
+struct metadata_t {
+	uint16_t	data_size;	/* Number of lines of data */
+	uint16_t	data_start;     /* Start address of data */
+	uint16_t	text_header;    /* The address of the text header */
+	uint16_t	text_size;      /* Number of lines of text */
+	uint16_t	text_start;     /* Start address of text */
+};
+
+struct instruction_t {
+	uint16_t	opcode;		/* Operation code */
+	uint16_t	regA;		/* Register A */
+	uint16_t	regB;		/* Register B */
+	uint16_t	regC;		/* Register C */
+	uint16_t	simm;		/* Signed immediate */
+	uint16_t	uimm;		/* Unsigned immediate */
+	uint16_t	operation;	/* EXT_*, for EXT */
+	uint16_t	handler;	/* Opcode, or FUSED(), for VM_run */
+};
+
+/* The state of a VM right after its program was loaded, which VM_reset goes
+ * back to. It is shared by the clones of the VM; see memory.h. */
+struct origin_t {
+	uint32_t	refs;			/* VMs using it */
+	uint16_t*	pages[NUM_PAGES];	/* Memory as loaded */
+	uint16_t	regs[NUM_REGISTERS];
+	uint16_t	pc;
+	uint64_t	text_writes;
+	bool		is_running;
+};
+
+struct RiscyVM {
+	uint16_t	regs[NUM_REGISTERS];	/* Registers */
+	uint16_t*	pages[NUM_PAGES];	/* Memory, for reading */
+	uint16_t*	wpages[NUM_PAGES];	/* The same page if it may be
+						   written in place, else NULL */
+	uint16_t	pc;			/* Program counter */
+
+	metadata_t	metadata;		/* Information about program */
+	instruction_t	current_instruction;	/* Instruction executed during
+						   the current cycle */
+	instruction_t*	decoded;		/* Pre-decoded text, one entry
+						   per word of text */
+	uint64_t	text_writes;		/* Stores into the text segment
+						   since the program was loaded */
+	jit_t*		jit;			/* Translated code, if any */
+	profile_t*	profile;		/* Counters, when profiling */
+	stats_t*	stats;			/* Run statistics, if any */
+	tracer_t*	tracer;			/* Trace output, when tracing */
+	output_t*	output;			/* Output port, if any */
+	xmem_t*		xmem;			/* Extended memory, if any */
+	bool		io;			/* Devices are attached; see
+						   io.h */
+	origin_t*	origin;			/* State as loaded */
+
+	bool		is_running;		/* PC != last instruction */
+	vm_error_t	error;			/* Why it stopped, if a store
+						   failed; see VM_error */
+	bool		verbose;		/* VM_run prints every
+						   instruction */
+	bool		step;			/* VM_run waits after every
+						   instruction */
+};
+
+/**
+ * decode_text
+ * 	Builds the table of pre-decoded instructions from the text segment
+ * 	currently in memory, reusing the table the VM has if any. With
+ * 	strict_risc16 set, text that holds an extension instruction is
+ * 	rejected with VM_ERROR_EXTENSION.
+ */
+vm_error_t	decode_text	(RiscyVM* vm);
+
+/**
+ * save_origin
+ * 	Records the registers and pc of `vm` as the state VM_reset goes
+ * 	back to, along with its memory (see memory_init).
+ */
+void		save_origin	(RiscyVM* vm);
+
+/* The result of the extension instruction `operation` on the values of its
+ * registers B and C, for all of the interpreters */
+static inline uint16_t extension_result(uint16_t operation, uint16_t b,
+					uint16_t c)
+{
+	switch (operation) {
+	case EXT_MUL:	return (uint32_t) b * c;
+	case EXT_MULH:	return ((uint32_t) b * c) >> 16;
+	case EXT_DIVU:	return c != 0 ? b / c : 0xffff;
+	case EXT_REMU:	return c != 0 ? b % c : b;
+	case EXT_SLL:	return b << (c & 15);
+	case EXT_SRL:	return b >> (c & 15);
+	default:	return (int16_t) b >> (c & 15);
+	}
+}
+
+struct profile_t {
+	uint64_t	hits[MEMORY_SIZE + 1];	/* Executions of each pc */
+	uint64_t	taken[MEMORY_SIZE + 1];	/* Taken BEQs at each pc */
+	uint64_t	calls[MEMORY_SIZE + 1];	/* JALRs to each pc */
+};
+
+#endif
@@ -0,0 +1,120 @@
+/* xmem.c */
+
+#define _POSIX_C_SOURCE	200809L	/* ftruncate */
+
+#include "xmem.h"
+#include "memory.h"
+#include "vm_internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BANK_BYTES	(2 * (size_t) XMEM_WINDOW_SIZE)
+
+vm_error_t xmem_start(RiscyVM* vm, char filename[])
+{
+	xmem_t*		xmem;
+	struct stat	st;
+	size_t		banks;
+	int		fd;
+	int		flags	= MAP_SHARED;
+	vm_error_t	error	= VM_OK;
+
+	if ((uint32_t) vm->metadata.text_start + vm->metadata.text_size
+			> XMEM_BASE)
+		return VM_ERROR_WINDOW;
+
+	/* Stores go to the file if it may be written to */
+	fd = open(filename, O_RDWR);
+	if (fd < 0) {
+		fd	= open(filename, O_RDONLY);
+		flags	= MAP_PRIVATE;
+	}
+	if (fd < 0)
+		return VM_ERROR_OPEN;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return VM_ERROR_OPEN;
+	}
+
+	banks = ((size_t) st.st_size + BANK_BYTES - 1) / BANK_BYTES;
+	if (banks == 0)
+		banks = 1;
+
+	/* Past the end of a file there is nothing to map, so a partial last
+	 * bank is filled up */
+	if (banks > XMEM_MAX_BANKS)
+		error = VM_ERROR_FORMAT;
+	else if ((size_t) st.st_size != banks * BANK_BYTES
+			&& flags != MAP_SHARED)
+		error = VM_ERROR_FORMAT;
+	else if ((size_t) st.st_size != banks * BANK_BYTES
+			&& ftruncate(fd, banks * BANK_BYTES) != 0)
+		error = VM_ERROR_WRITE;
+	if (error != VM_OK) {
+		close(fd);
+		return error;
+	}
+
+	xmem = malloc(sizeof *xmem);
+	if (xmem == NULL) {
+		close(fd);
+		return VM_ERROR_MEMORY;
+	}
+	xmem->size	= banks * BANK_BYTES;
+	xmem->nbr_banks	= banks;
+	xmem->bank	= 0;
+	xmem->words	= mmap(NULL, xmem->size, PROT_READ | PROT_WRITE, flags,
+					fd, 0);
+	close(fd);
+	if (xmem->words == MAP_FAILED) {
+		free(xmem);
+		return VM_ERROR_MEMORY;
+	}
+
+	error = io_attach(vm);
+	if (error != VM_OK) {
+		xmem_close(xmem);
+		return error;
+	}
+
+	/* The window still shows the file attached before, if any */
+	for (int i = 0; i < XMEM_WINDOW_SIZE / PAGE_SIZE; ++i)
+		memory_map(vm, (XMEM_BASE >> PAGE_BITS) + i,
+				&xmem->words[i * PAGE_SIZE]);
+
+	xmem_close(vm->xmem);
+	vm->xmem = xmem;
+	return io_refresh(vm);
+}
+
+void xmem_select(RiscyVM* vm, uint16_t bank)
+{
+	uint16_t*	words;
+	int		index;
+
+	vm->xmem->bank	= bank % vm->xmem->nbr_banks;
+	words		= &vm->xmem->words[(size_t) vm->xmem->bank
+						* XMEM_WINDOW_SIZE];
+
+	/* The JIT and aot code look pages up on every access, so nothing
+	 * else has to know */
+	for (int i = 0; i < XMEM_WINDOW_SIZE / PAGE_SIZE; ++i) {
+		index			= (XMEM_BASE >> PAGE_BITS) + i;
+		vm->pages[index]	= &words[i * PAGE_SIZE];
+		vm->wpages[index]	= &words[i * PAGE_SIZE];
+	}
+}
+
+void xmem_close(xmem_t* xmem)
+{
+	if (xmem == NULL)
+		return;
+
+	munmap(xmem->words, xmem->size);
+	free(xmem);
+}
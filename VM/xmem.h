@@ -0,0 +1,72 @@
+/*
+ * xmem.h
+ *
+ * Bank-switched extended memory, a device (see io.h). A file of any number of
+ * banks of XMEM_WINDOW_SIZE words is mapped into the host's memory, and the
+ * window of guest addresses from XMEM_BASE shows one bank of it at a time.
+ * Loads and stores in the window go straight to the mapping, in every engine,
+ * so the OS pages the file in as it is touched and writes back what the
+ * program stored. Storing a bank number to XMEM_BANK moves the window.
+ *
+ * 	address		load			store
+ * 	-------		----			-----
+ * 	XMEM_BANK	bank in the window	selects a bank, modulo the count
+ * 	XMEM_BANKS	number of banks		-
+ *
+ * The window takes the place of the memory it covers, so the program must end
+ * below XMEM_BASE. Neither the bank nor the contents of the file go back to
+ * what they were on VM_reset, and clones of the VM do not see the file.
+ */
+
+#ifndef XMEM_H
+#define XMEM_H
+
+#include "io.h"
+#include "vm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define XMEM_BASE		(0x8000)
+#define XMEM_WINDOW_SIZE	(0x4000)	/* Words, 32 KiB */
+#define XMEM_MAX_BANKS		(0xffff)
+
+#define XMEM_BANK		(IO_BASE + 8)
+#define XMEM_BANKS		(IO_BASE + 9)
+
+typedef struct	xmem_t		xmem_t;
+
+struct xmem_t {
+	uint16_t*	words;		/* The mapped file */
+	size_t		size;		/* Bytes mapped */
+	uint16_t	nbr_banks;
+	uint16_t	bank;		/* In the window */
+};
+
+/**
+ * xmem_start
+ * 	Maps `filename` and attaches it to `vm`, which must hold a program,
+ * 	with bank 0 in the window. The file is written to if it can be opened
+ * 	for writing, and is then extended with zeros to a whole number of
+ * 	banks; otherwise stores only change the VM's view of it. It is
+ * 	closed by VM_shutdown. Fails with VM_ERROR_WINDOW if the program
+ * 	does not end below XMEM_BASE, and with VM_ERROR_FORMAT if the file
+ * 	has too many banks, or is read-only and not a whole number of them.
+ */
+vm_error_t	xmem_start	(RiscyVM* vm, char filename[]);
+
+/**
+ * xmem_select
+ * 	Puts bank `bank` of the VM's extended memory, modulo the number of
+ * 	banks, in the window. Called by io_store.
+ */
+void		xmem_select	(RiscyVM* vm, uint16_t bank);
+
+/**
+ * xmem_close
+ * 	Unmaps the file and releases `xmem`. Called by VM_shutdown, after
+ * 	the VM let go of its memory.
+ */
+void		xmem_close	(xmem_t* xmem);
+
+#endif